@@ -0,0 +1,107 @@
+#include "banding.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "metrics.h"
+#include "protocol.h"
+#include "utils.h"
+
+int default_band_threads() {
+    // the session thread encodes bands too
+    return (int) std::max(1u, std::min<unsigned>(ER_READBACK_BANDS - 1, std::thread::hardware_concurrency() / 2));
+}
+
+Er_band_encoder::Er_band_encoder(int threads) {
+    for (int i = 0; i < threads; ++i) {
+        er_workers.emplace_back([this] { work(); });
+    }
+}
+
+Er_band_encoder::~Er_band_encoder() {
+    {
+        std::lock_guard<std::mutex> lock(er_mutex);
+        er_stop = true;
+    }
+    er_work_ready.notify_all();
+    for (auto &worker : er_workers) worker.join();
+}
+
+void Er_band_encoder::work() {
+    std::unique_lock<std::mutex> lock(er_mutex);
+    while (true) {
+        er_work_ready.wait(lock, [this] { return er_stop || !er_queue.empty(); });
+        if (er_stop) return;
+        run_one(lock);
+    }
+}
+
+void Er_band_encoder::run_one(std::unique_lock<std::mutex> &lock) {
+    Band &band = er_bands[er_queue.front()];
+    er_queue.pop_front();
+    Er_metrics::global().encoder_queue.fetch_sub(1, std::memory_order_relaxed);
+    lock.unlock();
+    // rows are tightly packed: a full-width band is a contiguous image
+    band.jpeg.encode(er_rgba + (size_t) band.first_row * er_width * 4, er_width, band.rows, band.payload);
+    lock.lock();
+    if (--er_pending == 0) er_work_done.notify_all();
+}
+
+uint8_t Er_band_encoder::encode(Er_vk_engine &engine, const char *rgba, int quality, std::string &output) {
+    uint64_t start_us = monotonic_us();
+    er_rgba = rgba;
+    er_width = engine.frame_width();
+    for (int i = 0; i < ER_READBACK_BANDS; ++i) {
+        Band &band = er_bands[i];
+        engine.band_rows(i, band.first_row, band.rows);
+        band.jpeg.set_quality(quality);
+        band.payload.clear();
+    }
+
+    er_pending = ER_READBACK_BANDS;
+    for (int i = 0; i < ER_READBACK_BANDS; ++i) {
+        uint64_t wait_start_us = monotonic_us();
+        engine.wait_band(i);
+        er_stats.wait_us += monotonic_us() - wait_start_us;
+        if (er_bands[i].rows == 0) {
+            std::lock_guard<std::mutex> lock(er_mutex);
+            er_pending--;
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(er_mutex);
+            er_queue.push_back(i);
+            Er_metrics::global().encoder_queue.fetch_add(1, std::memory_order_relaxed);
+        }
+        er_work_ready.notify_one();
+    }
+    {
+        std::unique_lock<std::mutex> lock(er_mutex);
+        while (er_pending > 0) {
+            if (!er_queue.empty()) {
+                run_one(lock);
+            } else {
+                er_work_done.wait(lock);
+            }
+        }
+    }
+
+    // ER_CODEC_TILES payload: count, then each entry followed by its jpeg image
+    uint16_t count = 0;
+    for (auto &band : er_bands) count += band.rows > 0;
+    output.append(reinterpret_cast<const char*>(&count), sizeof(count));
+    for (auto &band : er_bands) {
+        if (band.rows == 0) continue;
+        Er_tile_entry entry;
+        entry.y = band.first_row;
+        entry.width = er_width;
+        entry.height = band.rows;
+        entry.size = band.payload.size();
+        output.append(reinterpret_cast<const char*>(&entry), sizeof(entry));
+        output.append(band.payload);
+    }
+    er_stats.frames++;
+    er_stats.readback_encode_us += monotonic_us() - start_us;
+    // the bands cover the whole frame
+    return ER_FRAME_FLAG_KEY;
+}
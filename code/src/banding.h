@@ -0,0 +1,75 @@
+#ifndef ERATOSTHENE_STREAM_BANDING_H
+#define ERATOSTHENE_STREAM_BANDING_H
+
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+#include "engine.h"
+#include "encoder.h"
+
+struct Er_band_stats {
+    uint64_t frames = 0;
+    /*! from the end of rendering to the encoded payload, and the part of it spent waiting for bands */
+    uint64_t readback_encode_us = 0;
+    uint64_t wait_us = 0;
+};
+
+/*!
+ * Jpeg encoding pipelined with the readback: each of the ER_READBACK_BANDS bands of a frame is handed to a
+ * worker as soon as the engine copied it, so that bands are encoded in parallel and while the next ones are
+ * still in transit. Bands are independent jpeg images sent as a ER_CODEC_TILES payload of full-width
+ * rectangles, which the clients already draw. Belongs to the thread running its session, which encodes
+ * bands too while waiting for the workers.
+ */
+class Er_band_encoder {
+public:
+    explicit Er_band_encoder(int threads);
+    ~Er_band_encoder();
+    Er_band_encoder(const Er_band_encoder &) = delete;
+    Er_band_encoder &operator=(const Er_band_encoder &) = delete;
+
+    /*!
+     * Encodes the frame the engine started reading back into rgba (see Er_vk_engine::render_frame) and
+     * appends the payload to output. Returns the ER_FRAME_FLAG_* flags of the frame.
+     */
+    uint8_t encode(Er_vk_engine &engine, const char *rgba, int quality, std::string &output);
+
+    const Er_band_stats &stats() const { return er_stats; }
+
+private:
+    struct Band {
+        int first_row = 0;
+        int rows = 0;
+        Er_jpeg_encoder jpeg{0};
+        std::string payload;
+    };
+
+    std::vector<std::thread> er_workers;
+    std::mutex er_mutex;
+    std::condition_variable er_work_ready;
+    std::condition_variable er_work_done;
+    std::deque<int> er_queue;
+    int er_pending = 0;
+    bool er_stop = false;
+
+    /*! frame being encoded, set before its bands are queued */
+    const char *er_rgba = nullptr;
+    int er_width = 0;
+    std::array<Band, ER_READBACK_BANDS> er_bands;
+    Er_band_stats er_stats;
+
+    void work();
+    /*! encodes the band at the front of the queue, with the lock held when called and returning */
+    void run_one(std::unique_lock<std::mutex> &lock);
+};
+
+/*! number of workers for the band encoder of a session */
+int default_band_threads();
+
+#endif //ERATOSTHENE_STREAM_BANDING_H
@@ -0,0 +1,48 @@
+#include "buffer_pool.h"
+
+Er_buffer_pool::Er_buffer_pool(size_t count, size_t capacity) : er_initial_capacity(capacity) {
+    for (size_t i = 0; i < count; ++i) {
+        allocate();
+    }
+}
+
+Er_buffer Er_buffer_pool::acquire() {
+    // account for buffers that had to grow since they were last handed out
+    for (size_t i = 0; i < er_buffers.size(); ++i) {
+        if (er_buffers[i]->capacity() != er_capacities[i]) {
+            er_capacities[i] = er_buffers[i]->capacity();
+            er_allocations++;
+        }
+    }
+    for (auto &buffer : er_buffers) {
+        // the reference count is only a hint read without ordering: the reads of the other threads are
+        // published by their release of in_flight
+        if (buffer.use_count() == 1 && buffer->in_flight.load(std::memory_order_acquire) == 0) {
+            buffer->clear();
+            return buffer;
+        }
+    }
+    // every buffer is still in flight, the pool grows by one
+    return allocate();
+}
+
+uint64_t Er_buffer_pool::allocations() const {
+    return er_allocations;
+}
+
+size_t Er_buffer_pool::capacity() const {
+    size_t total = 0;
+    for (auto &buffer : er_buffers) {
+        total += buffer->capacity();
+    }
+    return total;
+}
+
+Er_buffer Er_buffer_pool::allocate() {
+    auto buffer = std::make_shared<Er_message>();
+    buffer->reserve(er_initial_capacity);
+    er_buffers.push_back(buffer);
+    er_capacities.push_back(buffer->capacity());
+    er_allocations++;
+    return buffer;
+}
@@ -0,0 +1,62 @@
+#ifndef ERATOSTHENE_STREAM_BUFFER_POOL_H
+#define ERATOSTHENE_STREAM_BUFFER_POOL_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/*!
+ * An encoded message. Threads other than the one owning its pool, e.g. spectators, count themselves in
+ * in_flight while they read it, see hold_buffer and release_buffer.
+ */
+struct Er_message : std::string {
+    std::atomic<uint32_t> in_flight{0};
+};
+
+/*! an encoded message, shared by reference between the encoder and the socket */
+typedef std::shared_ptr<Er_message> Er_buffer;
+
+/*!
+ * To be called before another thread reads the buffer, while its owner cannot reuse it yet: under the lock the
+ * buffer was shared with, the owner releasing its own reference under the same lock.
+ */
+inline void hold_buffer(const Er_buffer &buffer) {
+    buffer->in_flight.fetch_add(1, std::memory_order_relaxed);
+}
+
+/*! to be called by that thread once done reading the buffer, which the owner may then reuse */
+inline void release_buffer(const Er_buffer &buffer) {
+    buffer->in_flight.fetch_sub(1, std::memory_order_release);
+}
+
+/*!
+ * Pool of reusable output buffers owned by a session. A buffer is free again as soon as nobody but
+ * the pool holds a reference to it and no other thread still reads it, and keeps its capacity when reused,
+ * so that once the pool is warm a session streams frames without any heap allocation. Not thread safe: a
+ * pool belongs to the thread running its session.
+ */
+class Er_buffer_pool {
+public:
+    Er_buffer_pool(size_t count, size_t capacity);
+
+    /*! returns an empty buffer that is not referenced anywhere else */
+    Er_buffer acquire();
+
+    /*! number of heap allocations made by the pool, either new buffers or buffers that outgrew their capacity */
+    uint64_t allocations() const;
+
+    /*! total capacity of the buffers held by the pool, in bytes */
+    size_t capacity() const;
+
+private:
+    std::vector<Er_buffer> er_buffers;
+    std::vector<size_t> er_capacities;
+    size_t er_initial_capacity;
+    uint64_t er_allocations = 0;
+
+    Er_buffer allocate();
+};
+
+#endif //ERATOSTHENE_STREAM_BUFFER_POOL_H
@@ -0,0 +1,119 @@
+#include "compression.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include "protocol.h"
+#include "trace.h"
+#include "utils.h"
+
+Er_message_type message_type(Er_codec codec) {
+    switch (codec) {
+        case ER_CODEC_VP8: return ER_MESSAGE_VP8;
+        case ER_CODEC_TILES: return ER_MESSAGE_TILES;
+        case ER_CODEC_DEPTH: return ER_MESSAGE_DEPTH;
+        case ER_CODEC_PNG: return ER_MESSAGE_PNG;
+        default: return ER_MESSAGE_JPEG;
+    }
+}
+
+const char *message_type_name(Er_message_type type) {
+    const char *names[] = {"jpeg", "vp8", "tiles", "base64", "depth", "png"};
+    return type < ER_MESSAGE_TYPE_COUNT ? names[type] : "unknown";
+}
+
+// cpu time of the calling thread, so that the measure is not skewed by other sessions
+static uint64_t thread_cpu_us() {
+    timespec time;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    return time.tv_sec * 1000000ull + time.tv_nsec / 1000;
+}
+
+bool parse_deflate_option(const std::string &param, Er_deflate_config &config) {
+    size_t separator = param.find('=');
+    if (separator == std::string::npos) return false;
+    std::string key = param.substr(0, separator);
+    int value = (int) strtol(param.c_str() + separator + 1, nullptr, 10);
+    if (key == "deflate") {
+        if (value == 0) config.compress.fill(false);
+    } else if (key == "deflate_level") {
+        config.level = std::clamp(value, 0, 9);
+    } else if (key == "deflate_window") {
+        config.window_bits = std::clamp(value, 9, 15);
+    } else if (key == "deflate_mem") {
+        config.mem_level = std::clamp(value, 1, 9);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+Er_deflater::Er_deflater(Er_deflate_config config) : er_config(config) {
+    init();
+}
+
+Er_deflater::~Er_deflater() {
+    deflateEnd(&er_stream);
+}
+
+void Er_deflater::init() {
+    // whatever the configuration says, see Er_deflate_config::compress
+    er_config.compress[ER_MESSAGE_BASE64] = false;
+    memset(&er_stream, 0, sizeof(er_stream));
+    // negative window bits: raw deflate stream, without zlib header nor checksum
+    TEST_ASSERT(deflateInit2(&er_stream, er_config.level, Z_DEFLATED, -er_config.window_bits,
+                             er_config.mem_level, Z_DEFAULT_STRATEGY) == Z_OK,
+                "error while initializing the deflate stream");
+}
+
+size_t Er_deflater::deflate_into_scratch(const char *data, size_t size, Er_compression_stats &stats) {
+    uint64_t start = thread_cpu_us();
+    deflateReset(&er_stream);
+    size_t bound = deflateBound(&er_stream, size);
+    if (er_scratch.size() < bound) er_scratch.resize(bound);
+
+    er_stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    er_stream.avail_in = size;
+    er_stream.next_out = reinterpret_cast<Bytef*>(&er_scratch[0]);
+    er_stream.avail_out = er_scratch.size();
+    int result = deflate(&er_stream, Z_FINISH);
+    size_t compressed = result == Z_STREAM_END ? er_stream.total_out : size;
+
+    stats.input_bytes += size;
+    stats.output_bytes += compressed;
+    stats.cpu_us += thread_cpu_us() - start;
+    return compressed;
+}
+
+bool Er_deflater::deflate_message(std::string &message, size_t offset, Er_message_type type) {
+    auto &stats = er_stats[type];
+    size_t size = message.size() - offset;
+    if (!er_config.compress[type]) {
+        if (er_config.sample_interval > 0 && stats.messages++ % er_config.sample_interval == 0 && er_sample.empty()) {
+            // a copy is far cheaper than deflating, and keeps its capacity for the next samples
+            er_sample.assign(message, offset, std::string::npos);
+            er_sample_type = type;
+        }
+        return false;
+    }
+    stats.messages++;
+    size_t compressed = deflate_into_scratch(&message[offset], size, stats);
+    if (compressed >= size) return false;
+
+    memcpy(&message[offset], er_scratch.data(), compressed);
+    message.resize(offset + compressed);
+    stats.compressed++;
+    return true;
+}
+
+bool Er_deflater::deflate_sample() {
+    if (er_sample.empty()) return false;
+    ER_TRACE_SPAN("deflate_sample");
+    auto &stats = er_stats[er_sample_type];
+    deflate_into_scratch(er_sample.data(), er_sample.size(), stats);
+    stats.sampled++;
+    er_sample.clear();
+    return true;
+}
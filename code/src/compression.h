@@ -0,0 +1,116 @@
+#ifndef ERATOSTHENE_STREAM_COMPRESSION_H
+#define ERATOSTHENE_STREAM_COMPRESSION_H
+
+#include <array>
+#include <string>
+#include <cstdint>
+
+#include <zlib.h>
+
+/*! see protocol.h, which includes this header for the compression options of the clients */
+enum Er_codec : uint8_t;
+
+/*!
+ * Kinds of messages sent to the clients, each with its own compression policy and statistics.
+ */
+enum Er_message_type : uint8_t {
+    ER_MESSAGE_JPEG,
+    ER_MESSAGE_VP8,
+    ER_MESSAGE_TILES,
+    /*! legacy text frames, base64 encoded jpeg */
+    ER_MESSAGE_BASE64,
+    /*! depth maps sent along the frames for client-side reprojection */
+    ER_MESSAGE_DEPTH,
+    /*! lossless refined frames */
+    ER_MESSAGE_PNG,
+    ER_MESSAGE_TYPE_COUNT,
+};
+
+/*! message type of a binary frame encoded with the given codec */
+Er_message_type message_type(Er_codec codec);
+const char *message_type_name(Er_message_type type);
+
+struct Er_deflate_config {
+    /*! zlib compression level, speed matters more than ratio for interactive streaming */
+    int level = 1;
+    /*! log2 of the deflate window, from 9 to 15: memory used by the client and the server per message */
+    int window_bits = 15;
+    /*! zlib memory level, from 1 to 9 */
+    int mem_level = 8;
+    /*!
+     * one message out of sample_interval of the types that are not compressed is copied, and deflated later
+     * when the session has nothing to send, to measure what compressing them would save
+     */
+    uint32_t sample_interval = 64;
+    /*!
+     * Whether payloads of each type are compressed. Entropy-coded images (jpeg, vp8, jpeg tiles) barely shrink,
+     * and base64 text frames go to legacy clients that cannot inflate them: text frames have no header to flag
+     * them as deflated, and the deflater never compresses them. Depth maps are raw byte planes made of large
+     * flat areas, they compress well. Png images are deflated already.
+     */
+    std::array<bool, ER_MESSAGE_TYPE_COUNT> compress = {false, false, false, false, true, false};
+};
+
+/*!
+ * Reads one "key=value" url parameter into config, returns false if it is not a compression parameter:
+ * deflate=0 (nothing is compressed, for clients unable to inflate), deflate_level=<0-9>, deflate_window=<9-15>,
+ * deflate_mem=<1-9>.
+ */
+bool parse_deflate_option(const std::string &param, Er_deflate_config &config);
+
+/*!
+ * Compression trade-off observed for a message type: bytes before and after deflating the messages that
+ * were compressed or sampled, and the cpu time it took.
+ */
+struct Er_compression_stats {
+    uint64_t messages = 0;
+    uint64_t compressed = 0;
+    uint64_t sampled = 0;
+    uint64_t input_bytes = 0;
+    uint64_t output_bytes = 0;
+    uint64_t cpu_us = 0;
+};
+
+/*!
+ * Per-message deflate of the payloads sent to a client. Compression happens in the application protocol
+ * rather than through websocket permessage-deflate: the websocket library compresses either every message
+ * of a connection or none, and would burn cpu deflating jpeg. Each message is a standalone raw deflate
+ * stream (no context takeover), flagged with ER_FRAME_FLAG_DEFLATE in its frame header.
+ * Not thread safe: a deflater belongs to the thread running its session.
+ */
+class Er_deflater {
+public:
+    explicit Er_deflater(Er_deflate_config config = Er_deflate_config());
+    ~Er_deflater();
+    Er_deflater(const Er_deflater &) = delete;
+    Er_deflater &operator=(const Er_deflater &) = delete;
+
+    /*!
+     * Replaces message[offset:] by its raw deflate stream if the policy of its type says so and it shrinks,
+     * and returns whether it did. Messages of other types are kept for deflate_sample once every
+     * sample_interval, unless the previous sample is still pending.
+     */
+    bool deflate_message(std::string &message, size_t offset, Er_message_type type);
+    /*!
+     * Deflates the message kept for sampling, if any, and returns whether there was one. Called while the
+     * session has nothing to send, so that measuring never delays a frame.
+     */
+    bool deflate_sample();
+
+    const Er_compression_stats &stats(Er_message_type type) const { return er_stats[type]; }
+
+private:
+    Er_deflate_config er_config;
+    z_stream er_stream;
+    std::string er_scratch;
+    /*! copy of the message to sample, of er_sample_type, empty when none is pending */
+    std::string er_sample;
+    Er_message_type er_sample_type = ER_MESSAGE_JPEG;
+    std::array<Er_compression_stats, ER_MESSAGE_TYPE_COUNT> er_stats;
+
+    void init();
+    /*! deflates into er_scratch, returns the compressed size */
+    size_t deflate_into_scratch(const char *data, size_t size, Er_compression_stats &stats);
+};
+
+#endif //ERATOSTHENE_STREAM_COMPRESSION_H
@@ -0,0 +1,61 @@
+#include "depth.h"
+
+#include <cstring>
+
+#include "protocol.h"
+#include "utils.h"
+
+// factors divide both WIDTH and HEIGHT, reduced frames may drop a partial block on their edges
+const int MIN_FACTOR = 2;
+const int MAX_FACTOR = 16;
+// weight of the last frame in the ratio average
+const double RATIO_SMOOTHING = 0.2;
+
+void Er_depth_stream::encode(Er_vk_engine &engine, const Er_transform &pose, std::string &output) {
+    uint64_t start_us = monotonic_us();
+    int width = engine.frame_width() / er_factor, height = engine.frame_height() / er_factor;
+    er_depth.resize((size_t) width * height);
+    engine.read_depth(er_factor, er_depth.data());
+
+    const UniformBufferObject &matrices = engine.get_matrices();
+    Er_depth_entry entry;
+    entry.width = width;
+    entry.height = height;
+    float values[7] = {pose.rotate_x, pose.rotate_y, pose.rotate_z, pose.translate_camera_x,
+                       pose.translate_camera_y, pose.translate_camera_z, pose.zoom};
+    memcpy(entry.pose, values, sizeof(entry.pose));
+    memcpy(entry.model, &matrices.model, sizeof(entry.model));
+    memcpy(entry.view, &matrices.view, sizeof(entry.view));
+    memcpy(entry.projection, &matrices.proj, sizeof(entry.projection));
+
+    size_t offset = output.size();
+    output.resize(offset + sizeof(entry) + er_depth.size() * 2);
+    memcpy(&output[offset], &entry, sizeof(entry));
+    char *high = &output[offset + sizeof(entry)];
+    char *low = high + er_depth.size();
+    for (size_t i = 0; i < er_depth.size(); ++i) {
+        high[i] = (char) (er_depth[i] >> 8);
+        low[i] = (char) (er_depth[i] & 0xff);
+    }
+    er_stats.read_us += monotonic_us() - start_us;
+}
+
+void Er_depth_stream::on_sent(size_t depth_bytes, size_t color_bytes) {
+    ++er_stats.maps;
+    er_stats.depth_bytes += depth_bytes;
+    er_stats.color_bytes += color_bytes;
+    if (color_bytes == 0) return;
+
+    double ratio = (double) depth_bytes / color_bytes;
+    er_ratio = er_stats.maps == 1 ? ratio : er_ratio + RATIO_SMOOTHING * (ratio - er_ratio);
+    // doubling the factor divides the map size by 4, keep some margin so that the factor does not oscillate
+    if (er_ratio > ER_DEPTH_BUDGET && er_factor < MAX_FACTOR) {
+        er_factor *= 2;
+        er_ratio /= 4;
+        ++er_stats.factor_up;
+    } else if (er_ratio * 4 < ER_DEPTH_BUDGET * 0.75 && er_factor > MIN_FACTOR) {
+        er_factor /= 2;
+        er_ratio *= 4;
+        ++er_stats.factor_down;
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef ERATOSTHENE_STREAM_DEPTH_H
+#define ERATOSTHENE_STREAM_DEPTH_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "engine.h"
+
+/*! share of the bytes of the color frames the depth maps may add to the stream */
+const double ER_DEPTH_BUDGET = 0.25;
+
+struct Er_depth_stats {
+    uint64_t maps = 0;
+    /*! bytes of the depth messages and of the color frames they went with, as sent */
+    uint64_t depth_bytes = 0;
+    uint64_t color_bytes = 0;
+    uint64_t read_us = 0;
+    uint64_t factor_up = 0;
+    uint64_t factor_down = 0;
+};
+
+/*!
+ * Depth maps sent after the frames of a session so that its client can reproject the last frame to the
+ * camera it is moving to, before the matching frame arrives. Maps are downsampled by a factor picked to keep
+ * their share of the stream under ER_DEPTH_BUDGET: it doubles when depth costs too much and halves once
+ * the finer map would still fit. Not thread safe: belongs to the thread running its session.
+ */
+class Er_depth_stream {
+public:
+    /*! appends the Er_depth_entry and the depth map of the last frame drawn by engine to output */
+    void encode(Er_vk_engine &engine, const Er_transform &pose, std::string &output);
+
+    /*! sizes of a depth message and of its color frame once sent, adapts the downsampling factor */
+    void on_sent(size_t depth_bytes, size_t color_bytes);
+
+    int factor() const { return er_factor; }
+    const Er_depth_stats &stats() const { return er_stats; }
+
+private:
+    int er_factor = 4;
+    /*! moving average of the depth bytes per color byte */
+    double er_ratio = 0;
+    std::vector<uint16_t> er_depth;
+    Er_depth_stats er_stats;
+};
+
+#endif //ERATOSTHENE_STREAM_DEPTH_H
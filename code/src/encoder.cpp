@@ -0,0 +1,174 @@
+#include "encoder.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb/stb_image_write.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+#include "utils.h"
+#include "tiles.h"
+#include "trace.h"
+
+const int JPEG_QUALITY = 30;
+const int VP8_BITRATE_KBPS = 2000;
+/*! duration given to the first frame, one frame at 60 fps */
+const int64_t VP8_FIRST_FRAME_MS = 17;
+/*! longest duration given to a frame: a view left still must not let the next frame take seconds of bitrate */
+const int64_t VP8_MAX_FRAME_MS = 250;
+
+/* ---------------- Image codecs ---------------- */
+
+void encode_callback(void *context, void *data, int size) {
+    auto output = reinterpret_cast<std::string*>(context);
+    output->append(reinterpret_cast<char*>(data), size);
+}
+
+uint8_t Er_jpeg_encoder::encode(const char *rgba, int width, int height, std::string &output) {
+    ER_TRACE_SPAN("jpeg_encode");
+    stbi_write_jpg_to_func(encode_callback, reinterpret_cast<void*>(&output), width, height, 4, rgba, er_quality);
+//    stbi_write_bmp_to_func(encode_callback, reinterpret_cast<void*>(&output), width, height, 4, rgba);
+    return ER_FRAME_FLAG_KEY;
+}
+
+uint8_t Er_png_encoder::encode(const char *rgba, int width, int height, std::string &output) {
+    ER_TRACE_SPAN("png_encode");
+    stbi_write_png_to_func(encode_callback, reinterpret_cast<void*>(&output), width, height, 4, rgba, width * 4);
+    return ER_FRAME_FLAG_KEY;
+}
+
+/* ------------- End of image codecs ------------ */
+
+
+/* ---------------- Video codecs ---------------- */
+
+#ifdef ER_WITH_VPX
+Er_vp8_encoder::Er_vp8_encoder(int width, int height, int bitrate_kbps) {
+    vpx_codec_enc_cfg_t cfg;
+    TEST_ASSERT(vpx_codec_enc_config_default(vpx_codec_vp8_cx(), &cfg, 0) == VPX_CODEC_OK,
+                "error while getting the default vp8 configuration");
+    cfg.g_w = width;
+    cfg.g_h = height;
+    cfg.g_timebase = {1, 1000};
+    cfg.g_threads = std::max(1u, std::min(4u, std::thread::hardware_concurrency() / 2));
+    cfg.g_pass = VPX_RC_ONE_PASS;
+    // no look-ahead: every input frame must produce its packet immediately
+    cfg.g_lag_in_frames = 0;
+    cfg.g_error_resilient = VPX_ERROR_RESILIENT_DEFAULT;
+    cfg.rc_end_usage = VPX_CBR;
+    cfg.rc_target_bitrate = bitrate_kbps;
+    cfg.rc_min_quantizer = 4;
+    cfg.rc_max_quantizer = 56;
+    cfg.kf_mode = VPX_KF_AUTO;
+    cfg.kf_max_dist = 600;
+
+    TEST_ASSERT(vpx_codec_enc_init(&er_codec, vpx_codec_vp8_cx(), &cfg, 0) == VPX_CODEC_OK,
+                "error while initializing the vp8 encoder");
+    vpx_codec_control(&er_codec, VP8E_SET_CPUUSED, 16);
+    vpx_codec_control(&er_codec, VP8E_SET_STATIC_THRESHOLD, 1);
+    TEST_ASSERT(vpx_img_alloc(&er_image, VPX_IMG_FMT_I420, width, height, 16) != nullptr,
+                "error while allocating the vp8 input image");
+}
+
+Er_vp8_encoder::~Er_vp8_encoder() {
+    vpx_img_free(&er_image);
+    vpx_codec_destroy(&er_codec);
+}
+
+uint8_t Er_vp8_encoder::encode(const char *rgba, int width, int height, std::string &output) {
+    ER_TRACE_SPAN("vp8_encode");
+    rgba_to_i420(reinterpret_cast<const uint8_t*>(rgba), width, height,
+                 er_image.planes[VPX_PLANE_Y], er_image.stride[VPX_PLANE_Y],
+                 er_image.planes[VPX_PLANE_U], er_image.stride[VPX_PLANE_U],
+                 er_image.planes[VPX_PLANE_V], er_image.stride[VPX_PLANE_V]);
+
+    // frames are only rendered when the view changes: the rate control budgets each one with its real
+    // duration in the 1/1000 timebase, taken as the time since the previous frame
+    uint64_t now_us = monotonic_us();
+    if (er_pts < 0) er_start_us = now_us;
+    int64_t pts = std::max((int64_t) ((now_us - er_start_us) / 1000), er_pts + 1);
+    int64_t duration = er_pts < 0 ? VP8_FIRST_FRAME_MS : std::min(pts - er_pts, VP8_MAX_FRAME_MS);
+    er_pts = pts;
+
+    vpx_enc_frame_flags_t flags = er_force_key_frame ? VPX_EFLAG_FORCE_KF : 0;
+    er_force_key_frame = false;
+    TEST_ASSERT(vpx_codec_encode(&er_codec, &er_image, pts, (unsigned long) duration, flags, VPX_DL_REALTIME)
+                == VPX_CODEC_OK,
+                "error while encoding a vp8 frame");
+
+    uint8_t frame_flags = 0;
+    vpx_codec_iter_t iter = nullptr;
+    const vpx_codec_cx_pkt_t *packet;
+    while ((packet = vpx_codec_get_cx_data(&er_codec, &iter)) != nullptr) {
+        if (packet->kind != VPX_CODEC_CX_FRAME_PKT) continue;
+        output.append(reinterpret_cast<const char*>(packet->data.frame.buf), packet->data.frame.sz);
+        if (packet->data.frame.flags & VPX_FRAME_IS_KEY) frame_flags |= ER_FRAME_FLAG_KEY;
+    }
+    return frame_flags;
+}
+#endif
+
+void rgba_to_i420(const uint8_t *rgba, int width, int height,
+                  uint8_t *y, int y_stride, uint8_t *u, int u_stride, uint8_t *v, int v_stride) {
+    // BT.601 limited range in fixed point, chroma averaged over each 2x2 block
+    for (int row = 0; row < height; row += 2) {
+        const uint8_t *line0 = rgba + row * width * 4;
+        const uint8_t *line1 = row + 1 < height ? line0 + width * 4 : line0;
+        uint8_t *y0 = y + row * y_stride;
+        uint8_t *y1 = row + 1 < height ? y0 + y_stride : y0;
+        uint8_t *u_line = u + (row / 2) * u_stride;
+        uint8_t *v_line = v + (row / 2) * v_stride;
+
+        for (int col = 0; col < width; col += 2) {
+            int next = col + 1 < width ? 4 : 0;
+            const uint8_t *p[4] = {line0 + col * 4, line0 + col * 4 + next, line1 + col * 4, line1 + col * 4 + next};
+            uint8_t *out[4] = {y0 + col, y0 + col + next / 4, y1 + col, y1 + col + next / 4};
+            int r = 0, g = 0, b = 0;
+            for (int i = 0; i < 4; ++i) {
+                *out[i] = (uint8_t) (((66 * p[i][0] + 129 * p[i][1] + 25 * p[i][2] + 128) >> 8) + 16);
+                r += p[i][0];
+                g += p[i][1];
+                b += p[i][2];
+            }
+            r /= 4; g /= 4; b /= 4;
+            u_line[col / 2] = (uint8_t) (((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+            v_line[col / 2] = (uint8_t) (((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+        }
+    }
+}
+
+/* ------------- End of video codecs ------------ */
+
+
+bool encoder_available(Er_codec codec) {
+    switch (codec) {
+        case ER_CODEC_JPEG:
+        case ER_CODEC_TILES:
+        case ER_CODEC_PNG:
+            return true;
+#ifdef ER_WITH_VPX
+        case ER_CODEC_VP8:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+std::unique_ptr<Er_encoder> create_encoder(Er_codec codec, int width, int height) {
+    switch (codec) {
+        case ER_CODEC_JPEG:
+            return std::make_unique<Er_jpeg_encoder>(JPEG_QUALITY);
+        case ER_CODEC_TILES:
+            return std::make_unique<Er_tile_encoder>(JPEG_QUALITY);
+        case ER_CODEC_PNG:
+            return std::make_unique<Er_png_encoder>();
+#ifdef ER_WITH_VPX
+        case ER_CODEC_VP8:
+            return std::make_unique<Er_vp8_encoder>(width, height, VP8_BITRATE_KBPS);
+#endif
+        default:
+            throw std::runtime_error("codec not available in this build");
+    }
+}
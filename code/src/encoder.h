@@ -0,0 +1,88 @@
+#ifndef ERATOSTHENE_STREAM_ENCODER_H
+#define ERATOSTHENE_STREAM_ENCODER_H
+
+#include <memory>
+#include <string>
+#include <cstdint>
+
+#include "protocol.h"
+
+#ifdef ER_WITH_VPX
+#include <vpx/vpx_encoder.h>
+#include <vpx/vp8cx.h>
+#endif
+
+/*!
+ * Turns RGBA images read back from the engine into payloads for the web client. An encoder
+ * belongs to a single session and may keep state between frames (inter-frame codecs).
+ */
+class Er_encoder {
+public:
+    virtual ~Er_encoder() = default;
+    virtual Er_codec codec() const = 0;
+
+    /*!
+     * Appends the encoded image to output, without clearing it (the caller may have written a header).
+     * Returns the ER_FRAME_FLAG_* flags describing the encoded frame.
+     */
+    virtual uint8_t encode(const char *rgba, int width, int height, std::string &output) = 0;
+
+    /*! forces the next frame to be decodable on its own, e.g. after frames were lost */
+    virtual void request_key_frame() {}
+
+    /*! quality of the next frames, from 1 to 100, for codecs without their own rate control */
+    virtual void set_quality(int quality) {}
+};
+
+class Er_jpeg_encoder : public Er_encoder {
+public:
+    explicit Er_jpeg_encoder(int quality) : er_quality(quality) {}
+    Er_codec codec() const override { return ER_CODEC_JPEG; }
+    uint8_t encode(const char *rgba, int width, int height, std::string &output) override;
+    void set_quality(int quality) override { er_quality = quality; }
+
+private:
+    int er_quality;
+};
+
+/*! lossless encoder for the refined frames, the quality is ignored */
+class Er_png_encoder : public Er_encoder {
+public:
+    Er_codec codec() const override { return ER_CODEC_PNG; }
+    uint8_t encode(const char *rgba, int width, int height, std::string &output) override;
+};
+
+#ifdef ER_WITH_VPX
+/*!
+ * VP8 encoder tuned for interactive streaming: one pass, no lagged frames, fastest real-time speed.
+ * Frames are converted from RGBA to I420 on the cpu before being handed to libvpx.
+ */
+class Er_vp8_encoder : public Er_encoder {
+public:
+    Er_vp8_encoder(int width, int height, int bitrate_kbps);
+    ~Er_vp8_encoder() override;
+    Er_codec codec() const override { return ER_CODEC_VP8; }
+    uint8_t encode(const char *rgba, int width, int height, std::string &output) override;
+    void request_key_frame() override { er_force_key_frame = true; }
+
+private:
+    vpx_codec_ctx_t er_codec;
+    vpx_image_t er_image;
+    /*! capture time of the first frame, timestamps are counted in ms from it */
+    uint64_t er_start_us = 0;
+    /*! timestamp of the last frame encoded, negative before the first one */
+    int64_t er_pts = -1;
+    bool er_force_key_frame = true;
+};
+#endif
+
+/*! tells whether this build of the server is able to encode with the given codec */
+bool encoder_available(Er_codec codec);
+
+/*! creates the encoder of a session, the codec must be available */
+std::unique_ptr<Er_encoder> create_encoder(Er_codec codec, int width, int height);
+
+void rgba_to_i420(const uint8_t *rgba, int width, int height,
+                  uint8_t *y, int y_stride, uint8_t *u, int u_stride, uint8_t *v, int v_stride);
+
+#endif //ERATOSTHENE_STREAM_ENCODER_H
@@ -1,8 +1,13 @@
 #include <iostream>
 #include <stdexcept>
 #include <cstdint>
+#include <cstdlib>
 #include <vector>
 #include <chrono>
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <mutex>
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
@@ -12,6 +17,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "engine.h"
+#include "trace.h"
 
 
 const char* SHADER_VERT_FILE = "shaders/shader.vert.spv";
@@ -25,19 +31,47 @@ const std::vector<const char *> extensions = {
         VK_EXT_DEBUG_REPORT_EXTENSION_NAME,
 };
 
+/*! instance extensions VK_EXT_external_memory_host and VK_EXT_memory_budget depend on in vulkan 1.0, enabled when available */
+const std::vector<const char *> properties2_instance_extensions = {
+        VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME,
+        VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME,
+};
+
+const std::vector<const char *> host_import_device_extensions = {
+        VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME,
+        VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME,
+};
+
+/*! alignment of imported host allocations when the device cannot be asked for its own */
+const VkDeviceSize ER_HOST_IMPORT_ALIGNMENT = 64 * 1024;
+
 /* ----------- Vulkan setup methods ------------ */
 
 VkInstance Er_vk_engine::er_instance = nullptr;
 VkPhysicalDevice Er_vk_engine::er_phys_device = nullptr;
+bool Er_vk_engine::er_properties2 = false;
+bool Er_vk_engine::er_memory_budget = false;
+std::atomic<bool> Er_vk_engine::er_shared_ready{false};
 const size_t Er_vk_engine::er_imagedata_size = sizeof(uint8_t) * 4 * WIDTH * HEIGHT;
 
 
+// any range of the shuffled point indices is an even sample of the whole cloud, the same for every engine
+static std::vector<uint32_t> shuffle_points(Indices &points) {
+    std::vector<uint32_t> shuffled(points);
+    std::mt19937 generator(0x5eed);
+    std::shuffle(shuffled.begin(), shuffled.end(), generator);
+    return shuffled;
+}
+
 Er_vk_engine::Er_vk_engine(Vertices &v, Indices &t, Indices &l, Indices &p) :
-er_data_vertices(v), er_data_triangles(t), er_data_lines(l), er_data_points(p) {
-    if (!Er_vk_engine::er_instance && !er_phys_device) {
+er_data_vertices(v), er_data_triangles(t), er_data_lines(l), er_data_points(shuffle_points(p)) {
+    // engines are created concurrently by the sessions and the warm engine pool
+    static std::once_flag shared_objects;
+    std::call_once(shared_objects, [] {
         create_instance();
         create_phys_device();
-    }
+        er_shared_ready.store(true, std::memory_order_release);
+    });
 #ifdef DEBUG
     setup_debugger();
 #endif
@@ -48,14 +82,26 @@ er_data_vertices(v), er_data_triangles(t), er_data_lines(l), er_data_points(p) {
     create_render_pass();
     create_pipeline();
     create_descriptor_set();
+    create_readback_buffer();
     create_command_buffers();
+    er_memory.add_host(ER_HOST_SCENE, (int64_t) scene_bytes());
 }
 
 Er_vk_engine::~Er_vk_engine() {
-    // TODO: free up all vulkan objects
-    std::cerr << "Freeing up a engine instance..." << std::endl;
+    // the members then destroy every vulkan object of the engine, which the gpu must be done with
+    if (er_device != VK_NULL_HANDLE) vkDeviceWaitIdle(er_device);
+    er_memory.add_host(ER_HOST_SCENE, -(int64_t) scene_bytes());
 }
 
+void Er_vk_engine::reset() {
+    finish_readback();
+    er_transform = Er_transform();
+    er_ubo = UniformBufferObject();
+    er_gpu_stats = Er_gpu_stats();
+    er_last_frame = Er_frame_timing();
+    // the next frame clears the attachments, what the previous client saw is never read back
+    if (!(er_recorded_options == Er_draw_options())) record_frame(Er_draw_options());
+}
 
 void Er_vk_engine::create_instance() {
     VkApplicationInfo appInfo = {
@@ -71,6 +117,12 @@ void Er_vk_engine::create_instance() {
     TEST_ASSERT(check_validation_layers_support(validation_layers),
                 "validation layers requested, but not available!");
 #endif
+    std::vector<const char *> instanceExtensions = extensions;
+    er_properties2 = std::all_of(properties2_instance_extensions.begin(), properties2_instance_extensions.end(),
+                                 [](const char *name) { return check_extension_support(VK_NULL_HANDLE, name); });
+    if (er_properties2) {
+        instanceExtensions.insert(instanceExtensions.end(), properties2_instance_extensions.begin(), properties2_instance_extensions.end());
+    }
 
     VkInstanceCreateInfo createInfo = {
         .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
@@ -82,8 +134,8 @@ void Er_vk_engine::create_instance() {
 #else
         .enabledLayerCount = 0,
 #endif
-        .enabledExtensionCount = static_cast<uint32_t>(extensions.size()),
-        .ppEnabledExtensionNames = extensions.data(),
+        .enabledExtensionCount = static_cast<uint32_t>(instanceExtensions.size()),
+        .ppEnabledExtensionNames = instanceExtensions.data(),
     };
 
     TEST_VK_ASSERT(vkCreateInstance(&createInfo, nullptr, &er_instance),
@@ -111,6 +163,7 @@ void Er_vk_engine::create_phys_device() {
         }
     }
     TEST_ASSERT(er_phys_device != VK_NULL_HANDLE, "failed to find a suitable GPU!");
+    er_memory_budget = er_properties2 && check_extension_support(er_phys_device, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
 }
 
 void Er_vk_engine::setup_debugger() {
@@ -121,7 +174,7 @@ void Er_vk_engine::setup_debugger() {
     };
     auto vkCreateDebugReportCallbackEXT = reinterpret_cast<PFN_vkCreateDebugReportCallbackEXT>(
             vkGetInstanceProcAddr(er_instance, "vkCreateDebugReportCallbackEXT"));
-    TEST_VK_ASSERT(vkCreateDebugReportCallbackEXT(er_instance, &debugReportCreateInfo, nullptr, &er_debug_report),
+    TEST_VK_ASSERT(vkCreateDebugReportCallbackEXT(er_instance, &debugReportCreateInfo, nullptr, er_debug_report.replace(er_instance)),
                    "error while creating debug reporter");
 }
 
@@ -159,14 +212,40 @@ void Er_vk_engine::create_device() {
             continue;
         }
     }
-    std::vector<VkDeviceQueueCreateInfo> queuesCreateInfos = {graphicsQueueInfo, transferQueueInfo};
+    TEST_ASSERT(has_gq, "failed to find a graphics queue family!");
+    std::vector<VkDeviceQueueCreateInfo> queuesCreateInfos = {graphicsQueueInfo};
+    if (has_tq) {
+        queuesCreateInfos.push_back(transferQueueInfo);
+    } else {
+        // devices with a single queue family (e.g. lavapipe) transfer on the graphics queue
+        er_transfer_queue_family_index = er_graphics_queue_family_index;
+    }
+    er_timestamp_valid_bits = queueFamilyProperties[er_graphics_queue_family_index].timestampValidBits;
+
+    // the readback buffer is imported from host memory when the device can, see create_readback_buffer
+    std::vector<const char *> deviceExtensions;
+    er_host_import = er_properties2 &&
+            std::all_of(host_import_device_extensions.begin(), host_import_device_extensions.end(),
+                        [](const char *name) { return check_extension_support(er_phys_device, name); });
+    if (er_host_import) deviceExtensions = host_import_device_extensions;
+    if (er_memory_budget) deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+    // vertex and clipping counters of each frame, when supported (lavapipe does)
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(er_phys_device, &supportedFeatures);
+    VkPhysicalDeviceFeatures enabledFeatures = {};
+    enabledFeatures.pipelineStatisticsQuery = supportedFeatures.pipelineStatisticsQuery;
+    er_pipeline_statistics = supportedFeatures.pipelineStatisticsQuery == VK_TRUE;
     VkDeviceCreateInfo deviceCreateInfo = {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-        .queueCreateInfoCount = 2,
+        .queueCreateInfoCount = static_cast<uint32_t>(queuesCreateInfos.size()),
         .pQueueCreateInfos = queuesCreateInfos.data(),
+        .enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size()),
+        .ppEnabledExtensionNames = deviceExtensions.data(),
+        .pEnabledFeatures = &enabledFeatures,
     };
 
-    TEST_VK_ASSERT(vkCreateDevice(er_phys_device, &deviceCreateInfo, nullptr, &er_device),
+    TEST_VK_ASSERT(vkCreateDevice(er_phys_device, &deviceCreateInfo, nullptr, er_device.replace()),
                    "failed to create logical device!");
 
     vkGetDeviceQueue(er_device, er_graphics_queue_family_index, 0, &er_graphics_queue);
@@ -179,12 +258,13 @@ void Er_vk_engine::create_command_pool() {
         .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
         .queueFamilyIndex = er_graphics_queue_family_index,
     };
-    TEST_VK_ASSERT(vkCreateCommandPool(er_device, &cmdPoolInfo, nullptr, &er_graphics_command_pool), "error while creating graphics command pool");
+    TEST_VK_ASSERT(vkCreateCommandPool(er_device, &cmdPoolInfo, nullptr, er_graphics_command_pool.replace(er_device)), "error while creating graphics command pool");
     cmdPoolInfo.queueFamilyIndex = er_transfer_queue_family_index;
-    TEST_VK_ASSERT(vkCreateCommandPool(er_device, &cmdPoolInfo, nullptr, &er_transfer_command_pool), "error while creating graphics command pool");
+    TEST_VK_ASSERT(vkCreateCommandPool(er_device, &cmdPoolInfo, nullptr, er_transfer_command_pool.replace(er_device)), "error while creating graphics command pool");
 }
 
 void Er_vk_engine::bind_data() {
+    ER_TRACE_SPAN("bind_data");
     BufferWrap stagingWrap;
     VkDeviceSize vertexBufferSize = er_data_vertices.size() * sizeof(Vertex);
     VkDeviceSize triangleBufferSize = er_data_triangles.size() * sizeof(uint32_t);
@@ -196,10 +276,10 @@ void Er_vk_engine::bind_data() {
         std::cerr << "Loaded " << er_data_vertices.size() << " vertices in gpu memory" << std::endl;
         create_buffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                      &stagingWrap, vertexBufferSize, (void *) er_data_vertices.data());
+                      &stagingWrap, vertexBufferSize, ER_MEMORY_STAGING, (void *) er_data_vertices.data());
         create_buffer(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                      &er_vertices_buffer, vertexBufferSize);
+                      &er_vertices_buffer, vertexBufferSize, ER_MEMORY_GEOMETRY);
         bind_memory(vertexBufferSize, stagingWrap, er_vertices_buffer);
     }
 
@@ -209,10 +289,10 @@ void Er_vk_engine::bind_data() {
         std::cerr << "Loaded " << er_data_triangles.size() << " triangle indices in gpu memory" << std::endl;
         create_buffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                      &stagingWrap, triangleBufferSize, (void *) er_data_triangles.data());
+                      &stagingWrap, triangleBufferSize, ER_MEMORY_STAGING, (void *) er_data_triangles.data());
         create_buffer(VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                      &er_triangles_buffer, triangleBufferSize);
+                      &er_triangles_buffer, triangleBufferSize, ER_MEMORY_GEOMETRY);
         bind_memory(triangleBufferSize, stagingWrap, er_triangles_buffer);
     }
 
@@ -221,10 +301,10 @@ void Er_vk_engine::bind_data() {
         std::cerr << "Loaded " << er_data_lines.size() << " line indices in gpu memory" << std::endl;
         create_buffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                      &stagingWrap, lineBufferSize, (void *) er_data_lines.data());
+                      &stagingWrap, lineBufferSize, ER_MEMORY_STAGING, (void *) er_data_lines.data());
         create_buffer(VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                      &er_lines_buffer, lineBufferSize);
+                      &er_lines_buffer, lineBufferSize, ER_MEMORY_GEOMETRY);
         bind_memory(lineBufferSize, stagingWrap, er_lines_buffer);
     }
 
@@ -233,10 +313,10 @@ void Er_vk_engine::bind_data() {
         std::cerr << "Loaded " << er_data_points.size() << " point indices in gpu memory " << std::endl;
         create_buffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                      &stagingWrap, pointBufferSize, (void *) er_data_points.data());
+                      &stagingWrap, pointBufferSize, ER_MEMORY_STAGING, (void *) er_data_points.data());
         create_buffer(VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                      &er_points_buffer, pointBufferSize);
+                      &er_points_buffer, pointBufferSize, ER_MEMORY_GEOMETRY);
         bind_memory(pointBufferSize, stagingWrap, er_points_buffer);
     }
 }
@@ -250,17 +330,21 @@ void Er_vk_engine::create_attachments() {
             VK_IMAGE_ASPECT_COLOR_BIT
     );
 
-    // Depth attachment
+    // Depth attachment, stencil is not used: depth-only formats come first as they are cheaper to read back
     er_depth_format = find_supported_format(
-            {VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D32_SFLOAT,
+            {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT,
              VK_FORMAT_D24_UNORM_S8_UINT, VK_FORMAT_D16_UNORM_S8_UINT, VK_FORMAT_D16_UNORM},
             VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
     );
+    er_depth_aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+    if (er_depth_format != VK_FORMAT_D32_SFLOAT && er_depth_format != VK_FORMAT_D16_UNORM) {
+        er_depth_aspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
+    }
     create_attachment(
             er_depth_attachment,
-            VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+            VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
             er_depth_format,
-            VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT
+            er_depth_aspect
     );
 
 }
@@ -278,16 +362,16 @@ void Er_vk_engine::create_render_pass() {
             .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
             .finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
         },
-        // Depth attachment
+        // Depth attachment, kept for the clients reprojecting frames with it
         VkAttachmentDescription {
             .format = er_depth_format,
             .samples = VK_SAMPLE_COUNT_1_BIT,
             .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-            .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+            .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
             .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
             .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
             .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-            .finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+            .finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
         },
     };
     VkAttachmentReference colorReference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
@@ -305,18 +389,20 @@ void Er_vk_engine::create_render_pass() {
                 .srcSubpass = VK_SUBPASS_EXTERNAL,
                 .dstSubpass = 0,
                 .srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
-                .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
                 .srcAccessMask = VK_ACCESS_MEMORY_READ_BIT,
-                .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+                        | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
                 .dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT,
             },
             VkSubpassDependency {
                 .srcSubpass = 0,
                 .dstSubpass = VK_SUBPASS_EXTERNAL,
-                .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-                .dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
-                .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-                .dstAccessMask = VK_ACCESS_MEMORY_READ_BIT,
+                .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                // the readback copy may follow in the same command buffer
+                .dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_MEMORY_READ_BIT,
                 .dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT,
             },
     };
@@ -329,7 +415,14 @@ void Er_vk_engine::create_render_pass() {
         .dependencyCount = static_cast<uint32_t>(dependencies.size()),
         .pDependencies = dependencies.data(),
     };
-    TEST_VK_ASSERT(vkCreateRenderPass(er_device, &renderPassInfo, nullptr, &er_render_pass), "error while creating render pass");
+    TEST_VK_ASSERT(vkCreateRenderPass(er_device, &renderPassInfo, nullptr, er_render_pass.replace(er_device)), "error while creating render pass");
+
+    // same pass drawing over the previous frame, for accumulated frames: compatible with the framebuffer and pipelines
+    for (auto &description : attchmentDescriptions) {
+        description.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+        description.initialLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    }
+    TEST_VK_ASSERT(vkCreateRenderPass(er_device, &renderPassInfo, nullptr, er_accumulate_render_pass.replace(er_device)), "error while creating accumulation render pass");
     VkImageView attachments[2] = {er_color_attachment.view, er_depth_attachment.view};
 
     VkFramebufferCreateInfo framebufferCreateInfo = {
@@ -341,7 +434,7 @@ void Er_vk_engine::create_render_pass() {
         .height = HEIGHT,
         .layers = 1,
     };
-    TEST_VK_ASSERT(vkCreateFramebuffer(er_device, &framebufferCreateInfo, nullptr, &er_framebuffer), "error while creating framebuffer");
+    TEST_VK_ASSERT(vkCreateFramebuffer(er_device, &framebufferCreateInfo, nullptr, er_framebuffer.replace(er_device)), "error while creating framebuffer");
 }
 
 void Er_vk_engine::create_pipeline() {
@@ -357,7 +450,7 @@ void Er_vk_engine::create_pipeline() {
         .bindingCount = 1,
         .pBindings = &uboLayoutBinding,
     };
-    TEST_VK_ASSERT(vkCreateDescriptorSetLayout(er_device, &layoutInfo, nullptr, &er_descriptor_set_layout), "failed to create descriptor set layout!");
+    TEST_VK_ASSERT(vkCreateDescriptorSetLayout(er_device, &layoutInfo, nullptr, er_descriptor_set_layout.replace(er_device)), "failed to create descriptor set layout!");
 
     VkPushConstantRange pushConstantRange = {
         .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
@@ -367,14 +460,14 @@ void Er_vk_engine::create_pipeline() {
     VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
         .setLayoutCount = 1,
-        .pSetLayouts = &er_descriptor_set_layout,
+        .pSetLayouts = er_descriptor_set_layout.ptr(),
         .pushConstantRangeCount = 1,
         .pPushConstantRanges = &pushConstantRange,
     };
-    TEST_VK_ASSERT(vkCreatePipelineLayout(er_device, &pipelineLayoutCreateInfo, nullptr, &er_pipeline_layout), "error while creating pipeline layout");
+    TEST_VK_ASSERT(vkCreatePipelineLayout(er_device, &pipelineLayoutCreateInfo, nullptr, er_pipeline_layout.replace(er_device)), "error while creating pipeline layout");
 
     VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO};
-    TEST_VK_ASSERT(vkCreatePipelineCache(er_device, &pipelineCacheCreateInfo, nullptr, &er_pipeline_cache), "error while creating pipeline cache");
+    TEST_VK_ASSERT(vkCreatePipelineCache(er_device, &pipelineCacheCreateInfo, nullptr, er_pipeline_cache.replace(er_device)), "error while creating pipeline cache");
 
     VkPipelineInputAssemblyStateCreateInfo inputAssemblyState = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
@@ -426,17 +519,20 @@ void Er_vk_engine::create_pipeline() {
         .pDynamicStates = dynamicStateEnables.data(),
     };
 
+    // only needed until the pipelines are created
+    Er_vk_shader_module vertexShader = create_shader_module(readFile(SHADER_VERT_FILE));
+    Er_vk_shader_module fragmentShader = create_shader_module(readFile(SHADER_FRAG_FILE));
     std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages = {
         VkPipelineShaderStageCreateInfo {
             .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
             .stage = VK_SHADER_STAGE_VERTEX_BIT,
-            .module = create_shader_module(readFile(SHADER_VERT_FILE)),
+            .module = vertexShader,
             .pName = "main",
         },
         VkPipelineShaderStageCreateInfo {
             .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
             .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
-            .module = create_shader_module(readFile(SHADER_FRAG_FILE)),
+            .module = fragmentShader,
             .pName = "main",
         }
     };
@@ -473,21 +569,17 @@ void Er_vk_engine::create_pipeline() {
     if (!er_data_triangles.empty()) {
         inputAssemblyState.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
         TEST_VK_ASSERT(vkCreateGraphicsPipelines(er_device, er_pipeline_cache, 1, &pipelineCreateInfo, nullptr,
-                                                 &er_pipeline_triangles), "error while creating triangles pipeline");
+                                                 er_pipeline_triangles.replace(er_device)), "error while creating triangles pipeline");
     }
     if (!er_data_lines.empty()) {
         inputAssemblyState.topology = VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
         TEST_VK_ASSERT(vkCreateGraphicsPipelines(er_device, er_pipeline_cache, 1, &pipelineCreateInfo, nullptr,
-                                                 &er_pipeline_lines), "error while creating lines pipeline");
+                                                 er_pipeline_lines.replace(er_device)), "error while creating lines pipeline");
     }
     if (!er_data_points.empty()) {
         inputAssemblyState.topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
         TEST_VK_ASSERT(vkCreateGraphicsPipelines(er_device, er_pipeline_cache, 1, &pipelineCreateInfo, nullptr,
-                                                 &er_pipeline_points), "error while creating points pipeline");
-    }
-
-    for (auto stage : shaderStages) {
-        vkDestroyShaderModule(er_device, stage.module, nullptr);
+                                                 er_pipeline_points.replace(er_device)), "error while creating points pipeline");
     }
 }
 
@@ -500,19 +592,71 @@ void Er_vk_engine::create_command_buffers() {
     };
     TEST_VK_ASSERT(vkAllocateCommandBuffers(er_device, &allocInfo, &er_command_buffer), "failed to allocate command buffers!");
 
+    // copies of the rendered image and of its depth to the readback buffers
+    allocInfo.commandPool = er_transfer_command_pool;
+    TEST_VK_ASSERT(vkAllocateCommandBuffers(er_device, &allocInfo, &er_copy_command_buffer), "failed to allocate copy command buffer!");
+    TEST_VK_ASSERT(vkAllocateCommandBuffers(er_device, &allocInfo, &er_depth_copy_command_buffer), "failed to allocate depth copy command buffer!");
+
+    // signalled by the copy of each band of the image, polled by the host
+    VkEventCreateInfo eventInfo = { VK_STRUCTURE_TYPE_EVENT_CREATE_INFO };
+    er_band_events.resize(ER_READBACK_BANDS);
+    for (auto &event : er_band_events) {
+        TEST_VK_ASSERT(vkCreateEvent(er_device, &eventInfo, nullptr, event.replace(er_device)), "error while creating band event");
+    }
+    VkFenceCreateInfo fenceInfo = { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+    TEST_VK_ASSERT(vkCreateFence(er_device, &fenceInfo, nullptr, er_readback_fence.replace(er_device)), "error while creating readback fence");
+
+    // timestamps around the render pass and the readback copy, when the graphics queue supports them
+    if (er_timestamp_valid_bits > 0) {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(er_phys_device, &properties);
+        er_timestamp_period = properties.limits.timestampPeriod;
+        VkQueryPoolCreateInfo queryPoolInfo = {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType = VK_QUERY_TYPE_TIMESTAMP,
+            .queryCount = ER_FRAME_TIMESTAMPS,
+        };
+        TEST_VK_ASSERT(vkCreateQueryPool(er_device, &queryPoolInfo, nullptr, er_timestamp_pool.replace(er_device)), "error while creating timestamp query pool");
+    }
+    if (er_pipeline_statistics) {
+        VkQueryPoolCreateInfo queryPoolInfo = {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+            .queryCount = 1,
+            .pipelineStatistics = ER_PIPELINE_STATISTICS,
+        };
+        TEST_VK_ASSERT(vkCreateQueryPool(er_device, &queryPoolInfo, nullptr, er_statistics_pool.replace(er_device)), "error while creating pipeline statistics query pool");
+    }
+    record_frame(Er_draw_options());
+}
+
+void Er_vk_engine::record_frame(const Er_draw_options &options) {
+    // command buffers are recorded again only when the options change, e.g. between refinement tiers
+    er_recorded_options = options;
+    er_frame_width = WIDTH / options.scale;
+    er_frame_height = HEIGHT / options.scale;
+
     VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
     TEST_VK_ASSERT(vkBeginCommandBuffer(er_command_buffer, &beginInfo), "failed to begin recording command buffer!");
+    if (er_timestamp_pool != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(er_command_buffer, er_timestamp_pool, 0, ER_FRAME_TIMESTAMPS);
+        vkCmdWriteTimestamp(er_command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, er_timestamp_pool, 0);
+    }
+    if (er_statistics_pool != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(er_command_buffer, er_statistics_pool, 0, 1);
+        vkCmdBeginQuery(er_command_buffer, er_statistics_pool, 0, 0);
+    }
 
     std::array<VkClearValue, 2> clearValues = {};
     clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
     clearValues[1].depthStencil = { 1.0f, 0 };
     VkRenderPassBeginInfo renderPassInfo = {
         .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-        .renderPass = er_render_pass,
+        .renderPass = options.accumulate ? er_accumulate_render_pass : er_render_pass,
         .framebuffer = er_framebuffer,
         .renderArea = {
             .offset = {0, 0},
-            .extent = {WIDTH, HEIGHT},},
+            .extent = {(uint32_t) er_frame_width, (uint32_t) er_frame_height},},
         .clearValueCount = static_cast<uint32_t>(clearValues.size()),
         .pClearValues = clearValues.data(),
     };
@@ -521,38 +665,144 @@ void Er_vk_engine::create_command_buffers() {
     VkDeviceSize offsets[] = {0};
     vkCmdBeginRenderPass(er_command_buffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
 
+    // reduced images are rendered in the top-left corner of the attachments
     VkViewport viewport = {
-        .width = (float) WIDTH,
-        .height = (float) HEIGHT,
+        .width = (float) er_frame_width,
+        .height = (float) er_frame_height,
         .minDepth = (float)0.0f,
         .maxDepth = (float)1.0f,
     };
     vkCmdSetViewport(er_command_buffer, 0, 1, &viewport);
-    VkRect2D scissor = {.extent = {WIDTH, HEIGHT},};
+    VkRect2D scissor = {.extent = {(uint32_t) er_frame_width, (uint32_t) er_frame_height},};
 
     vkCmdSetScissor(er_command_buffer, 0, 1, &scissor);
     vkCmdBindDescriptorSets(er_command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, er_pipeline_layout, 0, 1, &er_descriptor_set, 0, nullptr);
     vkCmdBindVertexBuffers(er_command_buffer, 0, 1, vertexBuffers, offsets);
 
-    if (!er_data_triangles.empty()) {
+    // accumulated frames only add points, triangles and lines are already drawn
+    if (!er_data_triangles.empty() && !options.accumulate) {
         vkCmdBindPipeline(er_command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, er_pipeline_triangles);
         vkCmdBindIndexBuffer(er_command_buffer, er_triangles_buffer.buf, 0, VK_INDEX_TYPE_UINT32);
         vkCmdDrawIndexed(er_command_buffer, er_data_triangles.size(), 1, 0, 0, 0);
     }
-    if (!er_data_lines.empty()) {
+    if (!er_data_lines.empty() && !options.accumulate) {
         vkCmdBindPipeline(er_command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, er_pipeline_lines);
         vkCmdBindIndexBuffer(er_command_buffer, er_lines_buffer.buf, 0, VK_INDEX_TYPE_UINT32);
         vkCmdDrawIndexed(er_command_buffer, er_data_lines.size(), 1, 0, 0, 0);
     }
-    if (!er_data_points.empty()) {
+    uint32_t firstPoint = std::min<size_t>(options.first_point, er_data_points.size());
+    uint32_t pointCount = std::min<size_t>(options.point_count, er_data_points.size() - firstPoint);
+    if (pointCount > 0) {
         vkCmdBindPipeline(er_command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, er_pipeline_points);
         vkCmdBindIndexBuffer(er_command_buffer, er_points_buffer.buf, 0, VK_INDEX_TYPE_UINT32);
-        vkCmdDrawIndexed(er_command_buffer, er_data_points.size(), 1, 0, 0, 0);
+        vkCmdDrawIndexed(er_command_buffer, pointCount, 1, firstPoint, 0, 0);
     }
 
     vkCmdEndRenderPass(er_command_buffer);
+    if (er_statistics_pool != VK_NULL_HANDLE) {
+        vkCmdEndQuery(er_command_buffer, er_statistics_pool, 0);
+    }
+    if (er_timestamp_pool != VK_NULL_HANDLE) {
+        vkCmdWriteTimestamp(er_command_buffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, er_timestamp_pool, 1);
+    }
+#ifndef ER_SPLIT_SUBMISSION
+    // a frame is a single submission: the render pass leaves the color attachment in the transfer layout and its
+    // outgoing dependency orders the copy after it, the cpu only waits for the fence of the whole command buffer
+    record_copy(er_command_buffer, er_color_attachment.img, VK_IMAGE_ASPECT_COLOR_BIT, er_readback_buffer, er_band_events);
+    if (er_timestamp_pool != VK_NULL_HANDLE) {
+        vkCmdWriteTimestamp(er_command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, er_timestamp_pool, 2);
+    }
+#endif
 
     TEST_VK_ASSERT(vkEndCommandBuffer(er_command_buffer), "failed to record command buffer!");
+
+#ifdef ER_SPLIT_SUBMISSION
+    record_readback(er_copy_command_buffer, er_color_attachment.img, VK_IMAGE_ASPECT_COLOR_BIT, er_readback_buffer, er_band_events);
+#endif
+    record_readback(er_depth_copy_command_buffer, er_depth_attachment.img, VK_IMAGE_ASPECT_DEPTH_BIT, er_depth_readback_buffer, {});
+}
+
+void Er_vk_engine::record_readback(VkCommandBuffer cmd, VkImage image, VkImageAspectFlags aspect, BufferWrap &buffer,
+                                   const std::vector<Er_vk_event> &events) {
+    VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+    TEST_VK_ASSERT(vkBeginCommandBuffer(cmd, &beginInfo), "failed to begin recording copy command buffer!");
+    record_copy(cmd, image, aspect, buffer, events);
+    TEST_VK_ASSERT(vkEndCommandBuffer(cmd), "failed to record copy command buffer!");
+}
+
+void Er_vk_engine::record_copy(VkCommandBuffer cmd, VkImage image, VkImageAspectFlags aspect, BufferWrap &buffer,
+                               const std::vector<Er_vk_event> &events) {
+    // one copy per band, each made visible to the host and signalled on its own so that encoding can start
+    // with the first bands while the next ones are still copied
+    VkDeviceSize texelSize = aspect == VK_IMAGE_ASPECT_COLOR_BIT ? 4 : depth_texel_size();
+    int bands = events.empty() ? 1 : (int) events.size();
+    for (int band = 0; band < bands; ++band) {
+        int firstRow = 0, rowCount = er_frame_height;
+        if (!events.empty()) band_rows(band, firstRow, rowCount);
+        VkDeviceSize offset = firstRow * er_frame_width * texelSize;
+        VkDeviceSize size = rowCount * er_frame_width * texelSize;
+        if (rowCount > 0) {
+            // tightly packed rows (bufferRowLength = 0) so that encoders can read the buffer as a plain RGBA image
+            VkBufferImageCopy copyRegion = {
+                .bufferOffset = offset,
+                .bufferRowLength = 0,
+                .bufferImageHeight = 0,
+                .imageSubresource = {
+                    .aspectMask = aspect,
+                    .layerCount = 1,},
+                .imageOffset = {0, firstRow, 0},
+                .imageExtent = {
+                    .width = (uint32_t) er_frame_width,
+                    .height = (uint32_t) rowCount,
+                    .depth = 1,},
+            };
+            vkCmdCopyImageToBuffer(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer.buf, 1, &copyRegion);
+
+            VkBufferMemoryBarrier hostBarrier = {
+                .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+                .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .buffer = buffer.buf,
+                .offset = offset,
+                .size = size,
+            };
+            vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr,
+                                 1, &hostBarrier, 0, nullptr);
+        }
+        if (!events.empty()) vkCmdSetEvent(cmd, events[band], VK_PIPELINE_STAGE_TRANSFER_BIT);
+    }
+}
+
+void Er_vk_engine::band_rows(int band, int &first, int &count) const {
+    // bands are whole jpeg mcu rows (16 pixels), the last one takes the remainder
+    int bandHeight = ((er_frame_height + ER_READBACK_BANDS - 1) / ER_READBACK_BANDS + 15) / 16 * 16;
+    first = std::min(band * bandHeight, er_frame_height);
+    count = std::min(bandHeight, er_frame_height - first);
+}
+
+void Er_vk_engine::create_readback_buffer() {
+    // the copy writes straight into ordinary, page-aligned host memory the encoders read, when it can be imported
+    if (er_host_import && import_host_buffer(VK_BUFFER_USAGE_TRANSFER_DST_BIT, &er_readback_buffer, er_imagedata_size,
+                                             er_readback_host)) {
+        er_readback_data = static_cast<char *>(er_readback_host);
+    } else {
+        // the cpu reads back every pixel, cached memory is requested and dropped by create_buffer if unavailable
+        create_buffer(VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+                &er_readback_buffer, er_imagedata_size, ER_MEMORY_READBACK);
+
+        // mapped for the whole lifetime of the engine, encoders read the pixels straight from it
+        TEST_VK_ASSERT(vkMapMemory(er_device, er_readback_buffer.mem, 0, VK_WHOLE_SIZE, 0, (void **) &er_readback_data),
+                       "error while mapping readback buffer");
+    }
+
+    create_buffer(VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+            &er_depth_readback_buffer, depth_texel_size() * WIDTH * HEIGHT, ER_MEMORY_READBACK);
+    TEST_VK_ASSERT(vkMapMemory(er_device, er_depth_readback_buffer.mem, 0, VK_WHOLE_SIZE, 0, (void **) &er_depth_readback_data),
+                   "error while mapping depth readback buffer");
 }
 
 void Er_vk_engine::create_descriptor_set() {
@@ -566,13 +816,13 @@ void Er_vk_engine::create_descriptor_set() {
         .poolSizeCount = 1,
         .pPoolSizes = &poolSize,
     };
-    TEST_VK_ASSERT(vkCreateDescriptorPool(er_device, &poolInfo, nullptr, &er_descriptor_pool), "failed to create descriptor pool!");
+    TEST_VK_ASSERT(vkCreateDescriptorPool(er_device, &poolInfo, nullptr, er_descriptor_pool.replace(er_device)), "failed to create descriptor pool!");
 
     VkDescriptorSetAllocateInfo allocInfo = {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
         .descriptorPool = er_descriptor_pool,
         .descriptorSetCount = 1,
-        .pSetLayouts = &er_descriptor_set_layout,
+        .pSetLayouts = er_descriptor_set_layout.ptr(),
     };
     TEST_VK_ASSERT(vkAllocateDescriptorSets(er_device, &allocInfo, &er_descriptor_set), "failed to allocate descriptor sets!");
 
@@ -580,7 +830,7 @@ void Er_vk_engine::create_descriptor_set() {
 
     create_buffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-            &er_uniform_buffer, bufferSize);
+            &er_uniform_buffer, bufferSize, ER_MEMORY_UNIFORMS);
 
     VkDescriptorBufferInfo bufferInfo = {
         .buffer = er_uniform_buffer.buf,
@@ -615,6 +865,7 @@ void Er_vk_engine::set_transform(Er_transform transform) {
 }
 
 void Er_vk_engine::update_uniform_buffers() {
+    ER_TRACE_SPAN("update_uniform_buffers");
     auto eye = glm::vec3(-2.f, -2.f, 2.5f);
     auto center = glm::vec3(0.0f, 0.0f, 1.f);
     auto zoomF = glm::normalize(center-eye) * er_transform.zoom / 10.f;
@@ -623,7 +874,7 @@ void Er_vk_engine::update_uniform_buffers() {
                     * glm::rotate(glm::mat4(1.0f), glm::radians(er_transform.rotate_y), glm::vec3(0.0f, 1.0f, 0.0f))
                     * glm::rotate(glm::mat4(1.0f), glm::radians(180 + er_transform.rotate_z), glm::vec3(0.0f, 0.0f, 1.0f));
 
-    UniformBufferObject ubo = {
+    er_ubo = {
             .model = rotation,
             .view = glm::lookAt(
                     eye, // eye
@@ -632,120 +883,139 @@ void Er_vk_engine::update_uniform_buffers() {
             ),
             .proj = glm::perspective(glm::radians(30.0f), WIDTH / (float) HEIGHT, 0.1f, 256.0f),
     };
-    ubo.proj[1][1] *= -1;
+    er_ubo.proj[1][1] *= -1;
 
     void *data;
-    vkMapMemory(er_device, er_uniform_buffer.mem, 0, sizeof(ubo), 0, &data);
-    memcpy(data, &ubo, sizeof(ubo));
+    vkMapMemory(er_device, er_uniform_buffer.mem, 0, sizeof(er_ubo), 0, &data);
+    memcpy(data, &er_ubo, sizeof(er_ubo));
     vkUnmapMemory(er_device, er_uniform_buffer.mem);
 }
 
-void Er_vk_engine::draw_frame(char* imagedata, VkSubresourceLayout subresourceLayout) {
+const char *Er_vk_engine::draw_frame(const Er_draw_options &options) {
+    ER_TRACE_SPAN("draw_frame");
+    const char *imagedata = render_frame(options);
+    finish_readback();
+    return imagedata;
+}
+
+const char *Er_vk_engine::render_frame(const Er_draw_options &options) {
+    ER_TRACE_SPAN("render_frame");
+    finish_readback();
+    if (!(options == er_recorded_options)) {
+        record_frame(options);
+    }
     update_uniform_buffers();
+    er_submit_us = monotonic_us();
+#ifdef ER_SPLIT_SUBMISSION
     submit_work(er_command_buffer, er_graphics_queue);
     vkDeviceWaitIdle(er_device);
-    output_result(imagedata, subresourceLayout);
+    submit_readback(er_copy_command_buffer, er_transfer_queue);
+#else
+    submit_readback(er_command_buffer, er_graphics_queue);
+#endif
+    return er_readback_data;
 }
 
-void Er_vk_engine::output_result(char* imagedata, VkSubresourceLayout subresourceLayout) {
-    VkImage copyImage;
-    VkMemoryRequirements memRequirements;
-    VkDeviceMemory dstImageMemory;
-    VkCommandBuffer copyCmd;
-
-    VkImageCreateInfo imageCreateInfo = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
-        .imageType = VK_IMAGE_TYPE_2D,
-        .format = er_color_format,
-        .extent = {
-                .width = WIDTH,
-                .height = HEIGHT,
-                .depth = 1,
-        },
-        .mipLevels = 1,
-        .arrayLayers = 1,
-        .samples = VK_SAMPLE_COUNT_1_BIT,
-        .tiling = VK_IMAGE_TILING_LINEAR,
-        .usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT,
-        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+void Er_vk_engine::submit_readback(VkCommandBuffer cmd, VkQueue queue) {
+    ER_TRACE_SPAN("submit_readback");
+    // the copy is pre-recorded and signals each band as it lands in er_readback_data, see wait_band
+    for (auto &event : er_band_events) {
+        TEST_VK_ASSERT(vkResetEvent(er_device, event), "error while resetting band event");
+    }
+    TEST_VK_ASSERT(vkResetFences(er_device, 1, er_readback_fence.ptr()), "error while resetting readback fence");
+    VkSubmitInfo submitInfo = {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &cmd,
     };
-    TEST_VK_ASSERT(vkCreateImage(er_device, &imageCreateInfo, nullptr, &copyImage), "error while creating copy image");
+    TEST_VK_ASSERT(vkQueueSubmit(queue, 1, &submitInfo, er_readback_fence), "error while submitting readback");
+    er_readback_pending = true;
+}
 
-    vkGetImageMemoryRequirements(er_device, copyImage, &memRequirements);
-    VkMemoryAllocateInfo memAllocInfo = {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .allocationSize = memRequirements.size,
-        .memoryTypeIndex = get_memtype_index(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT),
-    };
+void Er_vk_engine::wait_band(int band) {
+    // a band copy takes well under a millisecond, polling keeps the latency low
+    while (vkGetEventStatus(er_device, er_band_events[band]) != VK_EVENT_SET) {
+        std::this_thread::sleep_for(std::chrono::microseconds(20));
+    }
+    if (band == ER_READBACK_BANDS - 1) finish_readback();
+}
 
-    TEST_VK_ASSERT(vkAllocateMemory(er_device, &memAllocInfo, nullptr, &dstImageMemory), "error while allocating memory for copy image");
-    TEST_VK_ASSERT(vkBindImageMemory(er_device, copyImage, dstImageMemory, 0), "error while binding memory to copy image");
+void Er_vk_engine::finish_readback() {
+    if (!er_readback_pending) return;
+    ER_TRACE_SPAN("finish_readback");
+    TEST_VK_ASSERT(vkWaitForFences(er_device, 1, er_readback_fence.ptr(), VK_TRUE, UINT64_MAX), "error while waiting for the readback");
+    er_readback_pending = false;
 
-    VkCommandBufferAllocateInfo cmdBufAllocateInfo = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-        .commandPool = er_transfer_command_pool,
-        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-        .commandBufferCount = 1,
-    };
-    TEST_VK_ASSERT(vkAllocateCommandBuffers(er_device, &cmdBufAllocateInfo, &copyCmd), "error while allocating command buffer for image copy");
-    VkCommandBufferBeginInfo cmdBufInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
-    TEST_VK_ASSERT(vkBeginCommandBuffer(copyCmd, &cmdBufInfo), "error while beginning command buffer for image copy");
-
-    VkImageMemoryBarrier imageMemoryBarrier = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-        .srcAccessMask = 0,
-        .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
-        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-        .image = copyImage,
-        .subresourceRange = VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 },
-    };
-    vkCmdPipelineBarrier(copyCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
-                         nullptr, 1, &imageMemoryBarrier);
-
-    VkImageCopy imageCopyRegion = {
-        .srcSubresource = {
-            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-            .layerCount = 1,
-        },
-        .dstSubresource = {
-            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-            .layerCount = 1,
-        },
-        .extent = {
-            .width = WIDTH,
-            .height = HEIGHT,
-            .depth = 1,
+    collect_queries();
+}
+
+void Er_vk_engine::collect_queries() {
+    // called once the fence of the frame signalled: every query of its command buffer is available, reading
+    // them never stalls and the next submission can reset them
+    er_last_frame = { .submitted_us = er_submit_us, .done_us = monotonic_us() };
+    er_gpu_stats.frames++;
+    er_gpu_stats.submit_to_done_us += er_last_frame.done_us - er_submit_us;
+    if (er_statistics_pool != VK_NULL_HANDLE) {
+        // counters come in the order of their bits in ER_PIPELINE_STATISTICS
+        uint64_t counters[3] = {};
+        if (vkGetQueryPoolResults(er_device, er_statistics_pool, 0, 1, sizeof(counters), counters,
+                                  sizeof(counters), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+            er_last_frame.vertices = counters[0];
+            er_last_frame.vertex_invocations = counters[1];
+            er_last_frame.clipping_primitives = counters[2];
+            er_gpu_stats.vertices += counters[0];
+            er_gpu_stats.vertex_invocations += counters[1];
+            er_gpu_stats.clipping_primitives += counters[2];
         }
+    }
+    if (er_timestamp_pool == VK_NULL_HANDLE) return;
+#ifdef ER_SPLIT_SUBMISSION
+    const uint32_t count = 2;
+#else
+    const uint32_t count = ER_FRAME_TIMESTAMPS;
+#endif
+    uint64_t timestamps[ER_FRAME_TIMESTAMPS] = {};
+    if (vkGetQueryPoolResults(er_device, er_timestamp_pool, 0, count, sizeof(timestamps), timestamps,
+                              sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) return;
+    uint64_t mask = er_timestamp_valid_bits >= 64 ? UINT64_MAX : (1ull << er_timestamp_valid_bits) - 1;
+    auto elapsed_us = [&](int from, int to) {
+        return ((timestamps[to] - timestamps[from]) & mask) * er_timestamp_period / 1000.;
     };
+    er_last_frame.render_us = elapsed_us(0, 1);
+    er_last_frame.copy_us = count > 2 ? elapsed_us(1, 2) : 0;
+    er_gpu_stats.render_us += er_last_frame.render_us;
+    er_gpu_stats.copy_us += er_last_frame.copy_us;
+}
 
-    vkCmdCopyImage(copyCmd, er_color_attachment.img, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                   copyImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageCopyRegion);
-
-    imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    imageMemoryBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-    imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-    imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
-    vkCmdPipelineBarrier(copyCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
-                         nullptr, 1, &imageMemoryBarrier);
-
-    TEST_VK_ASSERT(vkEndCommandBuffer(copyCmd), "error while ending command buffers for image copy");
-    submit_work(copyCmd, er_transfer_queue);
-
-    VkImageSubresource subResource{VK_IMAGE_ASPECT_COLOR_BIT};
-
-    vkGetImageSubresourceLayout(er_device, copyImage, &subResource, &subresourceLayout);
-
-    char *tmpdata;
-    vkMapMemory(er_device, dstImageMemory, 0, VK_WHOLE_SIZE, 0, (void**)&tmpdata);
-    memcpy(imagedata, tmpdata, er_imagedata_size);
-
-    vkUnmapMemory(er_device, dstImageMemory);
-    vkFreeMemory(er_device, dstImageMemory, nullptr);
-    vkDestroyImage(er_device, copyImage, nullptr);
+void Er_vk_engine::read_depth(int factor, uint16_t *output) {
+    ER_TRACE_SPAN("read_depth");
+    finish_readback();
+    submit_work(er_depth_copy_command_buffer, er_transfer_queue);
+
+    // depth texels as values between 0 and 1: float for D32 formats, normalized integers otherwise
+    VkDeviceSize texelSize = depth_texel_size();
+    bool floating = er_depth_format == VK_FORMAT_D32_SFLOAT || er_depth_format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+    auto depth_at = [&](int x, int y) {
+        const char *texel = er_depth_readback_data + (y * er_frame_width + x) * texelSize;
+        if (floating) return *reinterpret_cast<const float*>(texel);
+        if (texelSize == 2) return *reinterpret_cast<const uint16_t*>(texel) / 65535.f;
+        // D24 formats are copied into 32 bits texels with undefined upper bits
+        return (*reinterpret_cast<const uint32_t*>(texel) & 0xffffffu) / 16777215.f;
+    };
 
+    int width = er_frame_width / factor, height = er_frame_height / factor;
+    for (int by = 0; by < height; ++by) {
+        for (int bx = 0; bx < width; ++bx) {
+            // the nearest depth of the block keeps thin geometry and points visible
+            float nearest = 1.f;
+            for (int y = by * factor; y < (by + 1) * factor; ++y) {
+                for (int x = bx * factor; x < (bx + 1) * factor; ++x) {
+                    nearest = std::min(nearest, depth_at(x, y));
+                }
+            }
+            output[by * width + bx] = (uint16_t) (std::max(nearest, 0.f) * 65535.f + .5f);
+        }
+    }
 }
 
 /* ----- End of vulkan rendering methods ------ */
@@ -754,6 +1024,7 @@ void Er_vk_engine::output_result(char* imagedata, VkSubresourceLayout subresourc
 /* --------------- Helper methods --------------- */
 
 inline void Er_vk_engine::submit_work(VkCommandBuffer cmd, VkQueue queue) {
+    ER_TRACE_SPAN("submit_work");
     VkSubmitInfo submitInfo = {
             .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
             .commandBufferCount = 1,
@@ -763,42 +1034,54 @@ inline void Er_vk_engine::submit_work(VkCommandBuffer cmd, VkQueue queue) {
             .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
             .flags = 0,
     };
-    VkFence fence;
-    TEST_VK_ASSERT(vkCreateFence(er_device, &fenceInfo, nullptr, &fence), "error while creating fence");
+    Er_vk_fence fence;
+    TEST_VK_ASSERT(vkCreateFence(er_device, &fenceInfo, nullptr, fence.replace(er_device)), "error while creating fence");
     TEST_VK_ASSERT(vkQueueSubmit(queue, 1, &submitInfo, fence), "error while submitting to queue");
-    TEST_VK_ASSERT(vkWaitForFences(er_device, 1, &fence, VK_TRUE, UINT64_MAX), "error while waiting for queue submission fences");
-    vkDestroyFence(er_device, fence, nullptr);
+    TEST_VK_ASSERT(vkWaitForFences(er_device, 1, fence.ptr(), VK_TRUE, UINT64_MAX), "error while waiting for queue submission fences");
 }
 
 inline uint32_t Er_vk_engine::get_memtype_index(uint32_t typeBits, VkMemoryPropertyFlags properties) {
+    uint32_t index = 0;
+    find_memtype_index(typeBits, properties, index);
+    return index;
+}
+
+inline bool Er_vk_engine::find_memtype_index(uint32_t typeBits, VkMemoryPropertyFlags properties, uint32_t &index) {
     VkPhysicalDeviceMemoryProperties deviceMemoryProperties;
     vkGetPhysicalDeviceMemoryProperties(er_phys_device, &deviceMemoryProperties);
     for (uint32_t i = 0; i < deviceMemoryProperties.memoryTypeCount; i++) {
         if ((typeBits & 1) == 1 && (deviceMemoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-            return i;
+            index = i;
+            return true;
         }
         typeBits >>= 1;
     }
-    return 0;
+    return false;
 }
 
-inline void Er_vk_engine::create_buffer(VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryPropertyFlags, BufferWrap *wrap, VkDeviceSize size, void *data) {
+inline void Er_vk_engine::create_buffer(VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryPropertyFlags, BufferWrap *wrap, VkDeviceSize size,
+                                        Er_memory_category category, void *data) {
     VkBufferCreateInfo bufferCreateInfo {
             .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
             .size = size,
             .usage = usageFlags,
             .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
     };
-    TEST_VK_ASSERT(vkCreateBuffer(er_device, &bufferCreateInfo, nullptr, &wrap->buf), "error while creating buffer");
+    TEST_VK_ASSERT(vkCreateBuffer(er_device, &bufferCreateInfo, nullptr, wrap->buf.replace(er_device)), "error while creating buffer");
 
     VkMemoryRequirements memReqs;
     vkGetBufferMemoryRequirements(er_device, wrap->buf, &memReqs);
+    uint32_t memoryTypeIndex;
+    // host cached memory is only a preference, fall back to uncached memory when the device has none
+    if (!find_memtype_index(memReqs.memoryTypeBits, memoryPropertyFlags, memoryTypeIndex)) {
+        memoryTypeIndex = get_memtype_index(memReqs.memoryTypeBits, memoryPropertyFlags & ~VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+    }
     VkMemoryAllocateInfo memAlloc = {
             .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
             .allocationSize = memReqs.size,
-            .memoryTypeIndex = get_memtype_index(memReqs.memoryTypeBits, memoryPropertyFlags),
+            .memoryTypeIndex = memoryTypeIndex,
     };
-    TEST_VK_ASSERT(vkAllocateMemory(er_device, &memAlloc, nullptr, &wrap->mem), "error while allocating memory to buffer");
+    TEST_VK_ASSERT(allocate_memory(memAlloc, category, wrap->mem), "error while allocating memory to buffer");
 
     if (data != nullptr) {
         void *mapped;
@@ -810,6 +1093,85 @@ inline void Er_vk_engine::create_buffer(VkBufferUsageFlags usageFlags, VkMemoryP
     TEST_VK_ASSERT(vkBindBufferMemory(er_device, wrap->buf, wrap->mem, 0), "error while binding buffer memory");
 }
 
+bool Er_vk_engine::import_host_buffer(VkBufferUsageFlags usageFlags, BufferWrap *wrap, VkDeviceSize size, void *&host) {
+    VkDeviceSize alignment = ER_HOST_IMPORT_ALIGNMENT;
+    auto vkGetPhysicalDeviceProperties2KHR = reinterpret_cast<PFN_vkGetPhysicalDeviceProperties2KHR>(
+            vkGetInstanceProcAddr(er_instance, "vkGetPhysicalDeviceProperties2KHR"));
+    if (vkGetPhysicalDeviceProperties2KHR != nullptr) {
+        VkPhysicalDeviceExternalMemoryHostPropertiesEXT hostProperties = {
+                VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT };
+        VkPhysicalDeviceProperties2KHR properties = {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR,
+                .pNext = &hostProperties,
+        };
+        vkGetPhysicalDeviceProperties2KHR(er_phys_device, &properties);
+        alignment = std::max(hostProperties.minImportedHostPointerAlignment, VkDeviceSize(1));
+    }
+    auto vkGetMemoryHostPointerPropertiesEXT = reinterpret_cast<PFN_vkGetMemoryHostPointerPropertiesEXT>(
+            vkGetDeviceProcAddr(er_device, "vkGetMemoryHostPointerPropertiesEXT"));
+    if (vkGetMemoryHostPointerPropertiesEXT == nullptr) return false;
+
+    // both the pointer and the size of an import must be multiples of the alignment
+    VkDeviceSize allocationSize = (size + alignment - 1) / alignment * alignment;
+    void *pointer = aligned_alloc(alignment, allocationSize);
+    if (pointer == nullptr) return false;
+
+    VkExternalMemoryBufferCreateInfoKHR externalInfo = {
+            .sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO_KHR,
+            .handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+    };
+    VkBufferCreateInfo bufferCreateInfo {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .pNext = &externalInfo,
+            .size = size,
+            .usage = usageFlags,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    BufferWrap imported;
+    if (vkCreateBuffer(er_device, &bufferCreateInfo, nullptr, imported.buf.replace(er_device)) != VK_SUCCESS) {
+        free(pointer);
+        return false;
+    }
+
+    VkMemoryRequirements memReqs;
+    vkGetBufferMemoryRequirements(er_device, imported.buf, &memReqs);
+    VkMemoryHostPointerPropertiesEXT pointerProperties = { VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT };
+    uint32_t memoryTypeIndex;
+    bool importable = allocationSize >= memReqs.size && memReqs.alignment <= alignment &&
+            vkGetMemoryHostPointerPropertiesEXT(er_device, VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+                                                pointer, &pointerProperties) == VK_SUCCESS &&
+            find_memtype_index(memReqs.memoryTypeBits & pointerProperties.memoryTypeBits,
+                               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, memoryTypeIndex);
+    if (importable) {
+        VkImportMemoryHostPointerInfoEXT importInfo = {
+                .sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT,
+                .handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+                .pHostPointer = pointer,
+        };
+        VkMemoryAllocateInfo memAlloc = {
+                .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+                .pNext = &importInfo,
+                .allocationSize = allocationSize,
+                .memoryTypeIndex = memoryTypeIndex,
+        };
+        importable = allocate_memory(memAlloc, ER_MEMORY_READBACK, imported.mem) == VK_SUCCESS;
+    }
+    if (importable) {
+        // freed right after the memory imported from it
+        imported.mem.own_host(pointer);
+        importable = vkBindBufferMemory(er_device, imported.buf, imported.mem, 0) == VK_SUCCESS;
+    } else {
+        free(pointer);
+    }
+    if (!importable) {
+        std::cerr << "Host memory import failed, reading frames back through a mapped buffer" << std::endl;
+        return false;
+    }
+    *wrap = std::move(imported);
+    host = pointer;
+    return true;
+}
+
 inline void Er_vk_engine::bind_memory(VkDeviceSize dataSize, BufferWrap &stagingWrap, BufferWrap &destWrap) {
     VkCommandBufferAllocateInfo cmdBufAllocateInfo = {
             .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
@@ -830,9 +1192,48 @@ inline void Er_vk_engine::bind_memory(VkDeviceSize dataSize, BufferWrap &staging
     vkCmdCopyBuffer(copyCmd, stagingWrap.buf, destWrap.buf, 1, &copyRegion);
     TEST_VK_ASSERT(vkEndCommandBuffer(copyCmd), "error while terminating command buffer");
     submit_work(copyCmd, er_transfer_queue);
+    vkFreeCommandBuffers(er_device, er_transfer_command_pool, 1, &copyCmd);
+
+    stagingWrap.buf.reset();
+    stagingWrap.mem.reset();
+}
 
-    vkDestroyBuffer(er_device, stagingWrap.buf, nullptr);
-    vkFreeMemory(er_device, stagingWrap.mem, nullptr);
+VkResult Er_vk_engine::allocate_memory(const VkMemoryAllocateInfo &info, Er_memory_category category, Er_vk_memory &memory) {
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    vkGetPhysicalDeviceMemoryProperties(er_phys_device, &memoryProperties);
+    return memory.allocate(er_device, info, memoryProperties.memoryTypes[info.memoryTypeIndex].heapIndex, category, &er_memory);
+}
+
+std::vector<Er_heap_budget> Er_vk_engine::heap_budgets() {
+    std::vector<Er_heap_budget> heaps;
+    // called from the metrics threads, possibly while the first engine is being created
+    if (!er_shared_ready.load(std::memory_order_acquire)) return heaps;
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT };
+    VkPhysicalDeviceMemoryProperties2KHR properties = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR,
+            .pNext = &budgetProperties,
+    };
+    auto vkGetPhysicalDeviceMemoryProperties2KHR = er_memory_budget ? reinterpret_cast<PFN_vkGetPhysicalDeviceMemoryProperties2KHR>(
+            vkGetInstanceProcAddr(er_instance, "vkGetPhysicalDeviceMemoryProperties2KHR")) : nullptr;
+    bool fromDriver = vkGetPhysicalDeviceMemoryProperties2KHR != nullptr;
+    if (fromDriver) {
+        vkGetPhysicalDeviceMemoryProperties2KHR(er_phys_device, &properties);
+    } else {
+        vkGetPhysicalDeviceMemoryProperties(er_phys_device, &properties.memoryProperties);
+    }
+    const VkPhysicalDeviceMemoryProperties &memoryProperties = properties.memoryProperties;
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; ++i) {
+        Er_heap_budget heap = {
+                .size = memoryProperties.memoryHeaps[i].size,
+                .budget = fromDriver ? budgetProperties.heapBudget[i] : memoryProperties.memoryHeaps[i].size,
+                .usage = fromDriver ? budgetProperties.heapUsage[i]
+                                    : (VkDeviceSize) std::max<int64_t>(0, Er_memory_accounting::global().heap_bytes(i)),
+                .device_local = (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0,
+                .from_driver = fromDriver,
+        };
+        heaps.push_back(heap);
+    }
+    return heaps;
 }
 
 inline VkFormat Er_vk_engine::find_supported_format(const std::vector<VkFormat> &candidates, VkFormatFeatureFlags features) {
@@ -846,6 +1247,16 @@ inline VkFormat Er_vk_engine::find_supported_format(const std::vector<VkFormat>
     throw std::runtime_error("failed to find supported format!");
 }
 
+size_t Er_vk_engine::scene_bytes() const {
+    return er_data_vertices.size() * sizeof(Vertex) +
+           (er_data_triangles.size() + er_data_lines.size() + er_data_points.size()) * sizeof(uint32_t);
+}
+
+VkDeviceSize Er_vk_engine::depth_texel_size() const {
+    // size of the texels of the depth aspect once copied to a buffer
+    return er_depth_format == VK_FORMAT_D16_UNORM || er_depth_format == VK_FORMAT_D16_UNORM_S8_UINT ? 2 : 4;
+}
+
 inline void Er_vk_engine::create_attachment(Attachment &att, VkImageUsageFlags imgUsage, VkFormat format, VkImageAspectFlags aspect) {
     VkImageCreateInfo imageInfo = {
             .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
@@ -861,15 +1272,22 @@ inline void Er_vk_engine::create_attachment(Attachment &att, VkImageUsageFlags i
             .tiling = VK_IMAGE_TILING_OPTIMAL,
             .usage = imgUsage,
     };
+    // the transfer queue reads back the attachments between frames, accumulated frames must survive it
+    uint32_t queueFamilies[] = {er_graphics_queue_family_index, er_transfer_queue_family_index};
+    if (er_graphics_queue_family_index != er_transfer_queue_family_index) {
+        imageInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        imageInfo.queueFamilyIndexCount = 2;
+        imageInfo.pQueueFamilyIndices = queueFamilies;
+    }
     VkMemoryRequirements memReqs;
-    TEST_VK_ASSERT(vkCreateImage(er_device, &imageInfo, nullptr, &att.img), "error while creating image");
+    TEST_VK_ASSERT(vkCreateImage(er_device, &imageInfo, nullptr, att.img.replace(er_device)), "error while creating image");
     vkGetImageMemoryRequirements(er_device, att.img, &memReqs);
     VkMemoryAllocateInfo memAlloc = {
             .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
             .allocationSize = memReqs.size,
             .memoryTypeIndex = get_memtype_index(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
     };
-    TEST_VK_ASSERT(vkAllocateMemory(er_device, &memAlloc, nullptr, &att.mem), "error while allocating attachment image memory");
+    TEST_VK_ASSERT(allocate_memory(memAlloc, ER_MEMORY_ATTACHMENTS, att.mem), "error while allocating attachment image memory");
     TEST_VK_ASSERT(vkBindImageMemory(er_device, att.img, att.mem, 0), "error while binding attachment image to memory");
 
     VkImageViewCreateInfo viewInfo = {
@@ -884,17 +1302,17 @@ inline void Er_vk_engine::create_attachment(Attachment &att, VkImageUsageFlags i
                     .baseArrayLayer = 0,
                     .layerCount = 1,},
     };
-    TEST_VK_ASSERT(vkCreateImageView(er_device, &viewInfo, nullptr, &att.view), "error while creating attachment view");
+    TEST_VK_ASSERT(vkCreateImageView(er_device, &viewInfo, nullptr, att.view.replace(er_device)), "error while creating attachment view");
 }
 
-inline VkShaderModule Er_vk_engine::create_shader_module(const std::vector<char> &code) {
+inline Er_vk_shader_module Er_vk_engine::create_shader_module(const std::vector<char> &code) {
     VkShaderModuleCreateInfo createInfo = {
             .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
             .codeSize = code.size(),
             .pCode = reinterpret_cast<const uint32_t *>(code.data()),
     };
-    VkShaderModule shaderModule;
-    TEST_VK_ASSERT(vkCreateShaderModule(er_device, &createInfo, nullptr, &shaderModule),
+    Er_vk_shader_module shaderModule;
+    TEST_VK_ASSERT(vkCreateShaderModule(er_device, &createInfo, nullptr, shaderModule.replace(er_device)),
                    "failed to create shader module!");
     return shaderModule;
 }
@@ -4,6 +4,10 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#include <atomic>
+
+#include "handles.h"
+#include "memory.h"
 #include "models.h"
 #include "utils.h"
 
@@ -13,6 +17,53 @@ typedef const std::vector<uint32_t> Indices;
 const int WIDTH = 1600;
 const int HEIGHT = 1200;
 const float FPS = 60.f;
+/*! horizontal bands the readback of a frame is split into, so that encoding overlaps the copy */
+const int ER_READBACK_BANDS = 5;
+/*! start of the frame, end of the render pass, end of the readback copy */
+const uint32_t ER_FRAME_TIMESTAMPS = 3;
+/*! counters of the pipeline statistics query around the render pass */
+const VkQueryPipelineStatisticFlags ER_PIPELINE_STATISTICS = VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT | VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT;
+
+/*!
+ * Time the frames of an engine took, measured on the gpu with timestamps (when the graphics queue supports
+ * them) and on the cpu from the submission to the readback fence.
+ */
+struct Er_gpu_stats {
+    uint64_t frames = 0;
+    double render_us = 0;
+    /*! only measured when the copy is in the same submission as the render pass */
+    double copy_us = 0;
+    uint64_t submit_to_done_us = 0;
+    /*! pipeline statistics, left at zero when the device does not support them */
+    uint64_t vertices = 0;
+    uint64_t vertex_invocations = 0;
+    uint64_t clipping_primitives = 0;
+
+    Er_gpu_stats &operator+=(const Er_gpu_stats &other) {
+        frames += other.frames;
+        render_us += other.render_us;
+        copy_us += other.copy_us;
+        submit_to_done_us += other.submit_to_done_us;
+        vertices += other.vertices;
+        vertex_invocations += other.vertex_invocations;
+        clipping_primitives += other.clipping_primitives;
+        return *this;
+    }
+};
+
+/*! the last frame read back: submission and end of its readback on the monotonic clock, and its gpu times */
+struct Er_frame_timing {
+    uint64_t submitted_us = 0;
+    uint64_t done_us = 0;
+    /*! 0 without timestamps */
+    double render_us = 0;
+    double copy_us = 0;
+    /*! pipeline statistics, 0 when not supported */
+    uint64_t vertices = 0;
+    uint64_t vertex_invocations = 0;
+    uint64_t clipping_primitives = 0;
+};
 
 struct Er_transform {
     float rotate_x = 0.f;
@@ -41,20 +92,86 @@ struct Er_transform {
 
 };
 
+/*!
+ * What a frame draws. Point indices are shuffled when the engine is created so that any range of them is
+ * an even sample of the cloud; the image can be rendered at a fraction of WIDTH x HEIGHT.
+ */
+struct Er_draw_options {
+    /*! range of the shuffled point indices drawn, clamped to the number of points */
+    uint32_t first_point = 0;
+    uint32_t point_count = UINT32_MAX;
+    /*! divides the width and height of the image, which stays tightly packed in the readback buffer */
+    int scale = 1;
+    /*!
+     * draws the points over the previous frame instead of clearing it, which must have been drawn from the
+     * same camera and scale: successive ranges of points build the full image over several frames
+     */
+    bool accumulate = false;
+
+    bool operator==(const Er_draw_options &other) const {
+        return first_point == other.first_point && point_count == other.point_count && scale == other.scale
+               && accumulate == other.accumulate;
+    }
+};
+
 class Er_vk_engine {
 public:
     Er_vk_engine(Vertices &v, Indices &t, Indices &l, Indices &p);
+    /*! waits for the gpu to be done with the engine and destroys all its vulkan objects */
     ~Er_vk_engine();
-    void draw_frame(char *imagedata, VkSubresourceLayout subresourceLayout);
+    Er_vk_engine(const Er_vk_engine &) = delete;
+    Er_vk_engine &operator=(const Er_vk_engine &) = delete;
+    /*!
+     * Gets the engine ready for another client as if it had just been created: waits for the frame in
+     * flight and forgets the camera, draw options and statistics. The vulkan objects are all kept.
+     */
+    void reset();
+    /*! renders a frame, the returned RGBA image is frame_width() x frame_height() */
+    const char *draw_frame(const Er_draw_options &options = Er_draw_options());
+    /*!
+     * Renders a frame and returns as soon as its readback started: each band of rows of the returned image
+     * may only be read once wait_band returned for it. The readback completes before any other engine call.
+     */
+    const char *render_frame(const Er_draw_options &options = Er_draw_options());
+    void wait_band(int band);
+    /*! rows of the image in a band, multiples of 16 except for the last band */
+    void band_rows(int band, int &first, int &count) const;
+    int frame_width() const { return er_frame_width; }
+    int frame_height() const { return er_frame_height; }
+    size_t point_count() const { return er_data_points.size(); }
+    const Er_gpu_stats &gpu_stats() const { return er_gpu_stats; }
+    const Er_frame_timing &last_frame_timing() const { return er_last_frame; }
+    /*! memory allocated by this engine, also counted in Er_memory_accounting::global() */
+    const Er_memory_accounting &memory() const { return er_memory; }
     void set_transform(Er_transform transform);
     Er_transform get_transform();
 
+    /*!
+     * Reads back the depth of the last frame drawn, downsampled by factor (keeping the nearest depth of each
+     * block) and quantized to 16 bits: output receives (frame_width() / factor) * (frame_height() / factor) values.
+     */
+    void read_depth(int factor, uint16_t *output);
+    /*! model, view and projection matrices of the last frame drawn */
+    const UniformBufferObject &get_matrices() const { return er_ubo; }
+
     static const size_t er_imagedata_size;
 
+    /*! budget and usage of the heaps of the device, empty before the first engine was created */
+    static std::vector<Er_heap_budget> heap_budgets();
+
 private:
     /* Shared vulkan objects among all engines running */
     static VkInstance er_instance;
     static VkPhysicalDevice er_phys_device;
+    /*! the instance extensions needed to import host memory and query memory budgets are enabled */
+    static bool er_properties2;
+    /*! VK_EXT_memory_budget is supported by the physical device and enabled on the devices */
+    static bool er_memory_budget;
+    /*!
+     * the shared objects above are set: released once they are written by the first engine, acquired by the
+     * threads that read them without creating an engine (the metrics endpoint)
+     */
+    static std::atomic<bool> er_shared_ready;
     constexpr static const VkSurfaceKHR er_surface = VK_NULL_HANDLE; // @FUTURE obtain a headless surface for swapchain rendering
 
     static void create_instance();
@@ -62,36 +179,66 @@ private:
 
     Vertices er_data_vertices;
     Indices er_data_triangles, er_data_lines, er_data_points;
+    /*! outlives the memory of the engine, which is accounted in it until freed */
+    Er_memory_accounting er_memory{&Er_memory_accounting::global()};
 
-    VkDevice er_device;
-    VkDebugReportCallbackEXT er_debug_report;
+    /* Vulkan objects, destroyed in the reverse order: the device goes last */
+    Er_vk_device er_device;
+    Er_vk_debug_report er_debug_report;
     uint32 er_graphics_queue_family_index;
     uint32 er_transfer_queue_family_index;
     VkQueue er_graphics_queue;
     VkQueue er_transfer_queue;
-    VkCommandPool er_graphics_command_pool;
-    VkCommandPool er_transfer_command_pool;
+    Er_vk_command_pool er_graphics_command_pool;
+    Er_vk_command_pool er_transfer_command_pool;
     VkFormat er_color_format = VK_FORMAT_R8G8B8A8_UNORM;
     VkFormat er_depth_format;
+    VkImageAspectFlags er_depth_aspect;
     Attachment er_color_attachment;
     Attachment er_depth_attachment;
-    VkRenderPass er_render_pass;
-    VkFramebuffer er_framebuffer;
-    VkDescriptorSetLayout er_descriptor_set_layout;
-    VkDescriptorPool er_descriptor_pool;
+    Er_vk_render_pass er_render_pass;
+    Er_vk_render_pass er_accumulate_render_pass;
+    Er_vk_framebuffer er_framebuffer;
+    Er_vk_descriptor_set_layout er_descriptor_set_layout;
+    Er_vk_descriptor_pool er_descriptor_pool;
     VkDescriptorSet er_descriptor_set;
-    VkPipeline er_pipeline_triangles;
-    VkPipeline er_pipeline_lines;
-    VkPipeline er_pipeline_points;
-    VkPipelineLayout er_pipeline_layout;
-    VkPipelineCache er_pipeline_cache;
+    Er_vk_pipeline er_pipeline_triangles;
+    Er_vk_pipeline er_pipeline_lines;
+    Er_vk_pipeline er_pipeline_points;
+    Er_vk_pipeline_layout er_pipeline_layout;
+    Er_vk_pipeline_cache er_pipeline_cache;
     VkCommandBuffer er_command_buffer;
+    VkCommandBuffer er_copy_command_buffer;
+    VkCommandBuffer er_depth_copy_command_buffer;
+    std::vector<Er_vk_event> er_band_events;
+    Er_vk_fence er_readback_fence;
+    bool er_readback_pending = false;
+    uint64_t er_submit_us = 0;
+    Er_vk_query_pool er_timestamp_pool;
+    uint32_t er_timestamp_valid_bits = 0;
+    float er_timestamp_period = 1.f;
+    bool er_pipeline_statistics = false;
+    Er_vk_query_pool er_statistics_pool;
+    Er_gpu_stats er_gpu_stats;
+    Er_frame_timing er_last_frame;
     BufferWrap er_vertices_buffer;
     BufferWrap er_triangles_buffer;
     BufferWrap er_lines_buffer;
     BufferWrap er_points_buffer;
     BufferWrap er_uniform_buffer;
+    BufferWrap er_readback_buffer;
+    char *er_readback_data;
+    /*! VK_EXT_external_memory_host is enabled on the device */
+    bool er_host_import = false;
+    /*! page-aligned allocation imported as the memory of er_readback_buffer and owned by it, null when it is a mapped buffer */
+    void *er_readback_host = nullptr;
+    BufferWrap er_depth_readback_buffer;
+    char *er_depth_readback_data;
     Er_transform er_transform;
+    UniformBufferObject er_ubo;
+    Er_draw_options er_recorded_options;
+    int er_frame_width = WIDTH;
+    int er_frame_height = HEIGHT;
 
     void setup_debugger();
     void create_device();
@@ -101,17 +248,33 @@ private:
     void create_descriptor_set();
     void create_attachments();
     void create_render_pass();
+    void create_readback_buffer();
     void create_command_buffers();
+    void record_frame(const Er_draw_options &options);
     void update_uniform_buffers();
-    void output_result(char *imagedata, VkSubresourceLayout subresourceLayout);
 
     /* Helper methods */
-    VkShaderModule create_shader_module(const std::vector<char> &code);
+    Er_vk_shader_module create_shader_module(const std::vector<char> &code);
     void create_attachment(Attachment &att, VkImageUsageFlags imgUsage, VkFormat format, VkImageAspectFlags aspect);
     VkFormat find_supported_format(const std::vector<VkFormat> &candidates, VkFormatFeatureFlags features);
+    VkDeviceSize depth_texel_size() const;
+    /*! host memory of the copy of the scene */
+    size_t scene_bytes() const;
+    void record_readback(VkCommandBuffer cmd, VkImage image, VkImageAspectFlags aspect, BufferWrap &buffer,
+                         const std::vector<Er_vk_event> &events);
+    void record_copy(VkCommandBuffer cmd, VkImage image, VkImageAspectFlags aspect, BufferWrap &buffer,
+                     const std::vector<Er_vk_event> &events);
+    void submit_readback(VkCommandBuffer cmd, VkQueue queue);
+    void finish_readback();
+    void collect_queries();
     void bind_memory(VkDeviceSize dataSize, BufferWrap &stagingWrap, BufferWrap &destWrap);
-    void create_buffer(VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryPropertyFlags, BufferWrap *wrap, VkDeviceSize size, void *data = nullptr);
+    void create_buffer(VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryPropertyFlags, BufferWrap *wrap, VkDeviceSize size,
+                       Er_memory_category category, void *data = nullptr);
+    /*! allocates memory accounted in er_memory until memory is reset or destroyed */
+    VkResult allocate_memory(const VkMemoryAllocateInfo &info, Er_memory_category category, Er_vk_memory &memory);
+    bool import_host_buffer(VkBufferUsageFlags usageFlags, BufferWrap *wrap, VkDeviceSize size, void *&host);
     uint32_t get_memtype_index(uint32_t typeBits, VkMemoryPropertyFlags properties);
+    bool find_memtype_index(uint32_t typeBits, VkMemoryPropertyFlags properties, uint32_t &index);
     void submit_work(VkCommandBuffer cmd, VkQueue queue);
     static VKAPI_ATTR VkBool32 VKAPI_CALL debug_callback(VkDebugReportFlagsEXT flags, VkDebugReportObjectTypeEXT objectType,
                                                          uint64_t object, size_t location, int32_t messageCode, const char* pLayerPrefix, const char* pMessage, void* pUserData);
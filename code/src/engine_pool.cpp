@@ -0,0 +1,118 @@
+#include "engine_pool.h"
+#include "metrics.h"
+#include "trace.h"
+
+#include <atomic>
+#include <iostream>
+
+Er_engine_pool::Er_engine_pool(Vertices &v, Indices &t, Indices &l, Indices &p, size_t warm) :
+        er_vertices(v), er_triangles(t), er_lines(l), er_points(p), er_warm(warm) {
+    if (er_warm > 0) er_refiller = std::thread(&Er_engine_pool::refill_loop, this);
+}
+
+Er_engine_pool::~Er_engine_pool() {
+    {
+        std::lock_guard<std::mutex> lock(er_mutex);
+        er_stopping = true;
+    }
+    er_refill.notify_all();
+    if (er_refiller.joinable()) er_refiller.join();
+    Er_metrics::global().engines -= er_idle.size();
+    Er_metrics::global().engines_idle -= er_idle.size();
+}
+
+std::shared_ptr<Er_vk_engine> Er_engine_pool::create() {
+    ER_TRACE_SPAN("create_engine");
+    auto engine = std::make_shared<Er_vk_engine>(er_vertices, er_triangles, er_lines, er_points);
+    Er_metrics::global().engines++;
+    return engine;
+}
+
+std::shared_ptr<Er_vk_engine> Er_engine_pool::acquire(bool *warm) {
+    {
+        std::lock_guard<std::mutex> lock(er_mutex);
+        if (warm != nullptr) *warm = !er_idle.empty();
+        if (!er_idle.empty()) {
+            auto engine = std::move(er_idle.back());
+            er_idle.pop_back();
+            er_stats.reused++;
+            Er_metrics::global().engines_idle--;
+            Er_metrics::global().engines_reused++;
+            er_refill.notify_one();
+            return engine;
+        }
+        er_stats.created++;
+        er_stats.cold++;
+        er_refill.notify_one();
+    }
+    Er_metrics::global().engines_cold++;
+    // creating a device takes far longer than any other session is willing to wait for the lock
+    return create();
+}
+
+void Er_engine_pool::release(std::shared_ptr<Er_vk_engine> engine) {
+    if (!engine) return;
+    if (engine.use_count() == 1) {
+        // the count is read without ordering: what other threads did with the engine before dropping their
+        // references (released by the reference count) must be visible before it is reset and handed out again
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // waits for the last frame of the session, outside the lock
+        engine->reset();
+        std::lock_guard<std::mutex> lock(er_mutex);
+        if (er_idle.size() < er_warm) {
+            er_idle.push_back(std::move(engine));
+            Er_metrics::global().engines_idle++;
+            return;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(er_mutex);
+        er_stats.destroyed++;
+    }
+    Er_metrics::global().engines--;
+    // the last reference, if this is it, destroys the engine once the lock is released
+    engine.reset();
+}
+
+Er_engine_pool_stats Er_engine_pool::stats() {
+    std::lock_guard<std::mutex> lock(er_mutex);
+    Er_engine_pool_stats stats = er_stats;
+    stats.idle = er_idle.size();
+    return stats;
+}
+
+void Er_engine_pool::refill_loop() {
+    std::unique_lock<std::mutex> lock(er_mutex);
+    while (!er_stopping) {
+        if (er_idle.size() >= er_warm) {
+            er_refill.wait(lock);
+            continue;
+        }
+        // one engine at a time, created while sessions keep taking and releasing engines
+        lock.unlock();
+        std::shared_ptr<Er_vk_engine> engine;
+        try {
+            engine = create();
+        } catch (const std::exception &e) {
+            std::cerr << "Could not create a warm engine: " << e.what() << std::endl;
+        }
+        lock.lock();
+        if (!engine) {
+            // a device that failed once will likely fail again, sessions still create theirs meanwhile
+            er_refill.wait_for(lock, std::chrono::seconds(1));
+            continue;
+        }
+        er_stats.created++;
+        if (er_idle.size() < er_warm) {
+            er_idle.push_back(std::move(engine));
+            Er_metrics::global().engines_idle++;
+            continue;
+        }
+        // released engines filled the pool meanwhile
+        er_stats.destroyed++;
+        Er_metrics::global().engines--;
+        lock.unlock();
+        engine.reset();
+        lock.lock();
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef ERATOSTHENE_STREAM_ENGINE_POOL_H
+#define ERATOSTHENE_STREAM_ENGINE_POOL_H
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "engine.h"
+
+/*! engines created ahead of the clients by default, the engines of closed sessions are kept up to as many */
+const size_t ER_WARM_ENGINES = 2;
+/*! time from the connection of a client to its first frame sent that warm engines are meant to keep */
+const uint64_t ER_FIRST_FRAME_TARGET_US = 50000;
+
+struct Er_engine_pool_stats {
+    uint64_t created = 0;
+    /*! engines handed to a session from the idle ones, warm or from a closed session */
+    uint64_t reused = 0;
+    /*! sessions that found no idle engine and created theirs */
+    uint64_t cold = 0;
+    /*! engines released but not kept, destroyed by their last reference */
+    uint64_t destroyed = 0;
+    size_t idle = 0;
+};
+
+/*!
+ * Engines of a scene shared by all the sessions of a server. A background thread keeps warm engines ready
+ * so that a new client takes one in constant time instead of waiting for a device, its pipelines and its
+ * buffers to be created; the engine of a closed session is reset and kept as well, and the idle engines
+ * never exceed the warm count: a server with connection churn keeps a bounded number of devices and of
+ * device memory. The scene must outlive the pool.
+ */
+class Er_engine_pool {
+public:
+    /*! starts creating warm engines, up to warm of them (none when 0) */
+    Er_engine_pool(Vertices &v, Indices &t, Indices &l, Indices &p, size_t warm = ER_WARM_ENGINES);
+    /*! waits for the engine being created, if any */
+    ~Er_engine_pool();
+    Er_engine_pool(const Er_engine_pool &) = delete;
+    Er_engine_pool &operator=(const Er_engine_pool &) = delete;
+
+    /*!
+     * An idle engine if any, otherwise a new one created on the calling thread; warm, if given, tells which.
+     * Either way the pool starts replacing the engine taken.
+     */
+    std::shared_ptr<Er_vk_engine> acquire(bool *warm = nullptr);
+    /*!
+     * Takes back the engine of a closed session, which must not be used anymore: it is kept when it is
+     * the last reference to it and there is room for it, and destroyed on the calling thread otherwise.
+     */
+    void release(std::shared_ptr<Er_vk_engine> engine);
+
+    Er_engine_pool_stats stats();
+
+private:
+    Vertices &er_vertices;
+    Indices &er_triangles, &er_lines, &er_points;
+    size_t er_warm;
+    std::mutex er_mutex;
+    std::condition_variable er_refill;
+    bool er_stopping = false;
+    std::vector<std::shared_ptr<Er_vk_engine>> er_idle;
+    Er_engine_pool_stats er_stats;
+    std::thread er_refiller;
+
+    std::shared_ptr<Er_vk_engine> create();
+    void refill_loop();
+};
+
+#endif //ERATOSTHENE_STREAM_ENGINE_POOL_H
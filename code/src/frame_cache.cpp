@@ -0,0 +1,153 @@
+#include "frame_cache.h"
+#include "metrics.h"
+
+#include <cmath>
+#include <string_view>
+
+// transforms closer than this are considered the same camera
+const float TRANSFORM_QUANTUM = 1e-4f;
+// buffers of evicted entries kept for the next insertions
+const size_t FREE_BUFFERS = 4;
+// a buffer more than this many times larger than the payload it is acquired for is replaced by a smaller one
+const size_t BUFFER_SLACK = 2;
+
+static int32_t quantize(float value) {
+    return (int32_t) std::lround(value / TRANSFORM_QUANTUM);
+}
+
+Er_frame_key::Er_frame_key(uint64_t scene_id, int width, int height, Er_codec codec, int quality, const Er_transform &transform,
+                           uint32_t points) :
+        scene_id(scene_id), width(width), height(height), codec(codec), quality(quality), points(points),
+        transform({quantize(transform.rotate_x), quantize(transform.rotate_y), quantize(transform.rotate_z),
+                   quantize(transform.translate_camera_x), quantize(transform.translate_camera_y),
+                   quantize(transform.translate_camera_z), quantize(transform.zoom)}) {}
+
+bool Er_frame_key::operator==(const Er_frame_key &other) const {
+    return scene_id == other.scene_id && width == other.width && height == other.height &&
+           codec == other.codec && quality == other.quality && points == other.points && transform == other.transform;
+}
+
+size_t Er_frame_key_hash::operator()(const Er_frame_key &key) const {
+    uint64_t hash = key.scene_id ^ ((uint64_t) key.width << 48 | (uint64_t) key.height << 32 | key.codec << 8 | key.quality);
+    hash = (hash ^ key.points) * 0x100000001b3ull;
+    for (int32_t value : key.transform) {
+        hash = (hash ^ (uint32_t) value) * 0x100000001b3ull;
+    }
+    return hash ^ (hash >> 29);
+}
+
+Er_frame_cache::~Er_frame_cache() {
+    account(-(int64_t) er_stats.capacity);
+}
+
+bool Er_frame_cache::find(const Er_frame_key &key, std::string &output) {
+    std::lock_guard<std::mutex> lock(er_mutex);
+    auto it = er_index.find(key);
+    if (it == er_index.end()) {
+        er_stats.misses++;
+        return false;
+    }
+    er_entries.splice(er_entries.begin(), er_entries, it->second);
+    er_stats.hits++;
+    er_stats.saved_us += it->second->cost_us;
+    Er_metrics::global().cache_saved_us.fetch_add(it->second->cost_us, std::memory_order_relaxed);
+    output.append(*it->second->payload);
+    return true;
+}
+
+Er_buffer Er_frame_cache::acquire(size_t size) {
+    Er_buffer buffer;
+    {
+        std::lock_guard<std::mutex> lock(er_mutex);
+        if (!er_free_buffers.empty()) {
+            buffer = std::move(er_free_buffers.back());
+            er_free_buffers.pop_back();
+            // accounted again once inserted, with the capacity it has then
+            account(-(int64_t) buffer->capacity());
+        }
+    }
+    // a buffer that held a far larger frame, e.g. a lossless one, gives its memory back instead of holding it
+    // against the cap for a small one
+    if (buffer == nullptr || buffer->capacity() < size || buffer->capacity() > size * BUFFER_SLACK) {
+        buffer = std::make_shared<Er_message>();
+        buffer->reserve(size);
+        er_allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    buffer->clear();
+    return buffer;
+}
+
+void Er_frame_cache::insert(const Er_frame_key &key, Er_buffer payload, uint64_t cost_us) {
+    if (payload->capacity() > er_max_bytes) return;
+    std::lock_guard<std::mutex> lock(er_mutex);
+    if (er_index.count(key) > 0) {
+        // another session rendered the same frame meanwhile
+        recycle(std::move(payload));
+    } else {
+        account((int64_t) payload->capacity());
+        er_stats.bytes += payload->size();
+        if (er_free_entries.empty()) {
+            er_entries.push_front({key, std::move(payload), cost_us});
+        } else {
+            er_entries.splice(er_entries.begin(), er_free_entries, er_free_entries.begin());
+            er_entries.front() = {key, std::move(payload), cost_us};
+        }
+        if (er_free_nodes.empty()) {
+            er_index[key] = er_entries.begin();
+        } else {
+            Index::node_type node = std::move(er_free_nodes.back());
+            er_free_nodes.pop_back();
+            node.key() = key;
+            node.mapped() = er_entries.begin();
+            er_index.insert(std::move(node));
+        }
+    }
+    // the buffers kept count against the cap: older frames make room for them, unless only the newest is left
+    while (er_stats.capacity > er_max_bytes) {
+        if (er_entries.size() <= 1) {
+            if (er_free_buffers.empty()) break;
+            account(-(int64_t) er_free_buffers.back()->capacity());
+            er_free_buffers.pop_back();
+            continue;
+        }
+        auto &oldest = er_entries.back();
+        er_stats.bytes -= oldest.payload->size();
+        er_free_nodes.push_back(er_index.extract(oldest.key));
+        account(-(int64_t) oldest.payload->capacity());
+        recycle(std::move(oldest.payload));
+        er_free_entries.splice(er_free_entries.begin(), er_entries, std::prev(er_entries.end()));
+        er_stats.evictions++;
+    }
+    er_stats.entries = er_entries.size();
+}
+
+void Er_frame_cache::recycle(Er_buffer buffer) {
+    // the buffer is released otherwise, the memory it held leaves the cache
+    if (er_free_buffers.size() >= FREE_BUFFERS) return;
+    account((int64_t) buffer->capacity());
+    er_free_buffers.push_back(std::move(buffer));
+}
+
+void Er_frame_cache::account(int64_t capacity) {
+    er_stats.capacity += capacity;
+    Er_memory_accounting::global().add_host(ER_HOST_CACHE, capacity);
+    Er_metrics::global().cache_bytes.fetch_add(capacity, std::memory_order_relaxed);
+}
+
+Er_frame_cache_stats Er_frame_cache::stats() {
+    std::lock_guard<std::mutex> lock(er_mutex);
+    Er_frame_cache_stats stats = er_stats;
+    stats.allocations = er_allocations.load(std::memory_order_relaxed);
+    return stats;
+}
+
+uint64_t scene_id(Vertices &v, Indices &t, Indices &l, Indices &p) {
+    auto hash = [](const void *data, size_t size) {
+        return std::hash<std::string_view>()(std::string_view(reinterpret_cast<const char*>(data), size));
+    };
+    uint64_t id = hash(v.data(), v.size() * sizeof(v[0]));
+    for (auto *indices : {&t, &l, &p}) {
+        id = id * 31 + hash(indices->data(), indices->size() * sizeof(uint32_t));
+    }
+    return id;
+}
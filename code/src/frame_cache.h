@@ -0,0 +1,115 @@
+#ifndef ERATOSTHENE_STREAM_FRAME_CACHE_H
+#define ERATOSTHENE_STREAM_FRAME_CACHE_H
+
+#include <array>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+#include "engine.h"
+#include "buffer_pool.h"
+#include "memory.h"
+#include "protocol.h"
+
+/*!
+ * Identifies an encoded frame: the same scene seen from the same camera, at the same size, point budget
+ * and quality, gives the same image. Transforms are quantized so that float noise does not defeat the cache.
+ */
+struct Er_frame_key {
+    uint64_t scene_id = 0;
+    uint16_t width = 0;
+    uint16_t height = 0;
+    uint8_t codec = 0;
+    uint8_t quality = 0;
+    /*! points drawn, as the first points of the shuffled point indices */
+    uint32_t points = 0;
+    std::array<int32_t, 7> transform = {};
+
+    Er_frame_key() = default;
+    Er_frame_key(uint64_t scene_id, int width, int height, Er_codec codec, int quality, const Er_transform &transform,
+                 uint32_t points = UINT32_MAX);
+
+    bool operator==(const Er_frame_key &other) const;
+};
+
+struct Er_frame_key_hash {
+    size_t operator()(const Er_frame_key &key) const;
+};
+
+struct Er_frame_cache_stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t entries = 0;
+    /*! size of the payloads cached */
+    size_t bytes = 0;
+    /*! capacity of the buffers held, entries and buffers kept for the next ones: what the cache is capped to */
+    size_t capacity = 0;
+    /*! render, readback and encode time the hits did not spend */
+    uint64_t saved_us = 0;
+    /*! heap allocations of the payload buffers, which stop once the cache is full */
+    uint64_t allocations = 0;
+};
+
+/*!
+ * Memory-capped LRU cache of encoded frames, shared by all the sessions of a server. Only intra-coded
+ * payloads (jpeg) are cached since delta codecs depend on the frames a client already has.
+ * The cap applies to the capacity of the payload buffers, accounted as ER_HOST_CACHE. The buffers and the
+ * entries evicted are kept for the next insertions, unless the buffers are far larger than the payloads they
+ * are given: once full, the cache inserts frames of similar sizes without any heap allocation.
+ */
+class Er_frame_cache {
+public:
+    explicit Er_frame_cache(size_t max_bytes) : er_max_bytes(max_bytes) {}
+    ~Er_frame_cache();
+
+    /*!
+     * Appends the cached payload to output and returns true, or returns false. The payload is copied under
+     * the lock of the cache, whose buffers are reused once evicted.
+     */
+    bool find(const Er_frame_key &key, std::string &output);
+    /*! an empty buffer to copy a payload of size bytes into before inserting it, with room for them */
+    Er_buffer acquire(size_t size);
+    /*!
+     * payload must come from acquire(); cost_us is the time it took to produce it, counted as saved by
+     * each hit
+     */
+    void insert(const Er_frame_key &key, Er_buffer payload, uint64_t cost_us);
+
+    Er_frame_cache_stats stats();
+
+private:
+    struct Entry {
+        Er_frame_key key;
+        Er_buffer payload;
+        uint64_t cost_us;
+    };
+
+    typedef std::unordered_map<Er_frame_key, std::list<Entry>::iterator, Er_frame_key_hash> Index;
+
+    size_t er_max_bytes;
+    std::mutex er_mutex;
+    /*! most recently used first */
+    std::list<Entry> er_entries;
+    Index er_index;
+    /*! list and index nodes of the entries evicted, reused by the next insertions */
+    std::list<Entry> er_free_entries;
+    std::vector<Index::node_type> er_free_nodes;
+    /*! buffers of the entries evicted, never referenced outside the cache */
+    std::vector<Er_buffer> er_free_buffers;
+    std::atomic<uint64_t> er_allocations{0};
+    Er_frame_cache_stats er_stats;
+
+    /*! buffer of an evicted entry, or given back by an insertion, kept for the next ones if there is room */
+    void recycle(Er_buffer buffer);
+    /*! changes the capacity held, in the stats, the memory accounting and the metrics */
+    void account(int64_t capacity);
+};
+
+/*! identifies the data a server renders */
+uint64_t scene_id(Vertices &v, Indices &t, Indices &l, Indices &p);
+
+#endif //ERATOSTHENE_STREAM_FRAME_CACHE_H
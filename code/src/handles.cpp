@@ -0,0 +1,67 @@
+#include "handles.h"
+
+#include <atomic>
+#include <cstdlib>
+
+static std::atomic<int64_t> vk_objects{0};
+
+void count_vk_objects(int64_t count) {
+    vk_objects.fetch_add(count, std::memory_order_relaxed);
+}
+
+int64_t vk_object_count() {
+    return vk_objects.load(std::memory_order_relaxed);
+}
+
+void Er_vk_device::reset() {
+    if (er_counted) count_vk_objects(-1);
+    er_counted = false;
+    if (er_device == VK_NULL_HANDLE) return;
+    // queued work may still use the objects destroyed before the device
+    vkDeviceWaitIdle(er_device);
+    vkDestroyDevice(er_device, nullptr);
+    er_device = VK_NULL_HANDLE;
+}
+
+Er_vk_memory &Er_vk_memory::operator=(Er_vk_memory &&other) noexcept {
+    if (this != &other) {
+        reset();
+        er_device = other.er_device;
+        er_memory = std::exchange(other.er_memory, VK_NULL_HANDLE);
+        er_size = other.er_size;
+        er_heap = other.er_heap;
+        er_category = other.er_category;
+        er_accounting = other.er_accounting;
+        er_host = std::exchange(other.er_host, nullptr);
+    }
+    return *this;
+}
+
+VkResult Er_vk_memory::allocate(VkDevice device, const VkMemoryAllocateInfo &info, uint32_t heap,
+                                Er_memory_category category, Er_memory_accounting *accounting) {
+    reset();
+    VkDeviceMemory memory;
+    VkResult result = vkAllocateMemory(device, &info, nullptr, &memory);
+    if (result != VK_SUCCESS) return result;
+    er_device = device;
+    er_memory = memory;
+    er_size = info.allocationSize;
+    er_heap = heap;
+    er_category = category;
+    er_accounting = accounting;
+    if (er_accounting != nullptr) er_accounting->add_device(er_category, er_heap, (int64_t) er_size);
+    count_vk_objects(1);
+    return result;
+}
+
+void Er_vk_memory::reset() {
+    if (er_memory != VK_NULL_HANDLE) {
+        // also unmaps the memory
+        vkFreeMemory(er_device, er_memory, nullptr);
+        if (er_accounting != nullptr) er_accounting->add_device(er_category, er_heap, -(int64_t) er_size);
+        count_vk_objects(-1);
+        er_memory = VK_NULL_HANDLE;
+    }
+    free(er_host);
+    er_host = nullptr;
+}
@@ -0,0 +1,162 @@
+#ifndef ERATOSTHENE_STREAM_HANDLES_H
+#define ERATOSTHENE_STREAM_HANDLES_H
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <utility>
+
+#include "memory.h"
+#include "utils.h"
+
+/*
+ * Move-only owners of the vulkan objects of an engine, destroying them when reset or going out of scope.
+ * Objects are destroyed in the reverse order of their declaration: the device must be declared before
+ * everything created from it, and nothing may still be in use by the gpu when its owner goes away.
+ * Command buffers and descriptor sets are not owned, they are freed with the pool they come from.
+ */
+
+/*! adds to the count of the objects owned, kept by the owners below */
+void count_vk_objects(int64_t count);
+/*!
+ * Vulkan objects (memory and device included) currently owned across all the engines, an object counting from
+ * the moment its owner hands out where vkCreate* writes it. Back to the same value once engines are released.
+ */
+int64_t vk_object_count();
+
+/*! an object of type T created from parent and destroyed with Destroy, e.g. a VkBuffer and vkDestroyBuffer */
+template<typename Parent, typename T, void (VKAPI_PTR *Destroy)(Parent, T, const VkAllocationCallbacks *)>
+class Er_vk_handle {
+public:
+    Er_vk_handle() = default;
+    Er_vk_handle(Er_vk_handle &&other) noexcept : er_parent(other.er_parent),
+            er_handle(std::exchange(other.er_handle, VK_NULL_HANDLE)), er_counted(std::exchange(other.er_counted, false)) {}
+    Er_vk_handle &operator=(Er_vk_handle &&other) noexcept {
+        if (this != &other) {
+            reset();
+            er_parent = other.er_parent;
+            er_handle = std::exchange(other.er_handle, VK_NULL_HANDLE);
+            er_counted = std::exchange(other.er_counted, false);
+        }
+        return *this;
+    }
+    Er_vk_handle(const Er_vk_handle &) = delete;
+    Er_vk_handle &operator=(const Er_vk_handle &) = delete;
+    ~Er_vk_handle() { reset(); }
+
+    operator T() const { return er_handle; }
+    /*! for the vulkan calls taking an array of handles */
+    const T *ptr() const { return &er_handle; }
+
+    /*! destroys the object owned, if any, and returns where vkCreate* writes the next one, owned from then on */
+    T *replace(Parent parent) {
+        reset();
+        er_parent = parent;
+        er_counted = true;
+        count_vk_objects(1);
+        return &er_handle;
+    }
+    void reset() {
+        if (er_handle != VK_NULL_HANDLE) Destroy(er_parent, er_handle, nullptr);
+        er_handle = VK_NULL_HANDLE;
+        uncount();
+    }
+    /*! gives up the ownership of the object, which the caller destroys */
+    T release() {
+        uncount();
+        return std::exchange(er_handle, VK_NULL_HANDLE);
+    }
+
+private:
+    Parent er_parent = VK_NULL_HANDLE;
+    T er_handle = VK_NULL_HANDLE;
+    bool er_counted = false;
+
+    void uncount() {
+        if (er_counted) count_vk_objects(-1);
+        er_counted = false;
+    }
+};
+
+typedef Er_vk_handle<VkInstance, VkDebugReportCallbackEXT, destroy_debug_report> Er_vk_debug_report;
+typedef Er_vk_handle<VkDevice, VkCommandPool, vkDestroyCommandPool> Er_vk_command_pool;
+typedef Er_vk_handle<VkDevice, VkBuffer, vkDestroyBuffer> Er_vk_buffer;
+typedef Er_vk_handle<VkDevice, VkImage, vkDestroyImage> Er_vk_image;
+typedef Er_vk_handle<VkDevice, VkImageView, vkDestroyImageView> Er_vk_image_view;
+typedef Er_vk_handle<VkDevice, VkRenderPass, vkDestroyRenderPass> Er_vk_render_pass;
+typedef Er_vk_handle<VkDevice, VkFramebuffer, vkDestroyFramebuffer> Er_vk_framebuffer;
+typedef Er_vk_handle<VkDevice, VkDescriptorSetLayout, vkDestroyDescriptorSetLayout> Er_vk_descriptor_set_layout;
+typedef Er_vk_handle<VkDevice, VkDescriptorPool, vkDestroyDescriptorPool> Er_vk_descriptor_pool;
+typedef Er_vk_handle<VkDevice, VkPipeline, vkDestroyPipeline> Er_vk_pipeline;
+typedef Er_vk_handle<VkDevice, VkPipelineLayout, vkDestroyPipelineLayout> Er_vk_pipeline_layout;
+typedef Er_vk_handle<VkDevice, VkPipelineCache, vkDestroyPipelineCache> Er_vk_pipeline_cache;
+typedef Er_vk_handle<VkDevice, VkShaderModule, vkDestroyShaderModule> Er_vk_shader_module;
+typedef Er_vk_handle<VkDevice, VkEvent, vkDestroyEvent> Er_vk_event;
+typedef Er_vk_handle<VkDevice, VkFence, vkDestroyFence> Er_vk_fence;
+typedef Er_vk_handle<VkDevice, VkQueryPool, vkDestroyQueryPool> Er_vk_query_pool;
+
+/*! the logical device, waited for before being destroyed */
+class Er_vk_device {
+public:
+    Er_vk_device() = default;
+    Er_vk_device(Er_vk_device &&other) noexcept : er_device(std::exchange(other.er_device, VK_NULL_HANDLE)),
+            er_counted(std::exchange(other.er_counted, false)) {}
+    Er_vk_device &operator=(Er_vk_device &&other) noexcept {
+        if (this != &other) {
+            reset();
+            er_device = std::exchange(other.er_device, VK_NULL_HANDLE);
+            er_counted = std::exchange(other.er_counted, false);
+        }
+        return *this;
+    }
+    Er_vk_device(const Er_vk_device &) = delete;
+    Er_vk_device &operator=(const Er_vk_device &) = delete;
+    ~Er_vk_device() { reset(); }
+
+    operator VkDevice() const { return er_device; }
+    VkDevice *replace() {
+        reset();
+        er_counted = true;
+        count_vk_objects(1);
+        return &er_device;
+    }
+    void reset();
+
+private:
+    VkDevice er_device = VK_NULL_HANDLE;
+    bool er_counted = false;
+};
+
+/*!
+ * Device memory, accounted in an Er_memory_accounting from its allocation to its release. Memory imported
+ * from a host allocation owns it too, and frees it once the device memory is.
+ */
+class Er_vk_memory {
+public:
+    Er_vk_memory() = default;
+    Er_vk_memory(Er_vk_memory &&other) noexcept { *this = std::move(other); }
+    Er_vk_memory &operator=(Er_vk_memory &&other) noexcept;
+    Er_vk_memory(const Er_vk_memory &) = delete;
+    Er_vk_memory &operator=(const Er_vk_memory &) = delete;
+    ~Er_vk_memory() { reset(); }
+
+    operator VkDeviceMemory() const { return er_memory; }
+
+    /*! replaces the memory owned by a new allocation from heap, accounted under category */
+    VkResult allocate(VkDevice device, const VkMemoryAllocateInfo &info, uint32_t heap, Er_memory_category category,
+                      Er_memory_accounting *accounting);
+    /*! takes the ownership of the host allocation (from aligned_alloc) the memory was imported from */
+    void own_host(void *host) { er_host = host; }
+    void reset();
+
+private:
+    VkDevice er_device = VK_NULL_HANDLE;
+    VkDeviceMemory er_memory = VK_NULL_HANDLE;
+    VkDeviceSize er_size = 0;
+    uint32_t er_heap = 0;
+    Er_memory_category er_category = ER_MEMORY_GEOMETRY;
+    Er_memory_accounting *er_accounting = nullptr;
+    void *er_host = nullptr;
+};
+
+#endif //ERATOSTHENE_STREAM_HANDLES_H
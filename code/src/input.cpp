@@ -0,0 +1,242 @@
+#include "input.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "trace.h"
+
+/* ---------------- Binary messages ---------------- */
+
+static bool decode_binary_input(const char *data, size_t size, Er_input &input) {
+    Er_input_header header;
+    if (size < sizeof(header)) return false;
+    memcpy(&header, data, sizeof(header));
+    if (header.version != ER_PROTOCOL_VERSION || header.size > size) return false;
+
+    switch (header.type) {
+        case ER_INPUT_DELTA:
+        case ER_INPUT_POSE: {
+            Er_camera_input camera;
+            if (header.size < sizeof(camera)) return false;
+            memcpy(&camera, data, sizeof(camera));
+            input.type = static_cast<Er_input_type>(header.type);
+            input.sequence = camera.sequence;
+            input.timestamp = camera.timestamp;
+            input.transform.rotate_x = camera.rotate[0];
+            input.transform.rotate_y = camera.rotate[1];
+            input.transform.rotate_z = camera.rotate[2];
+            input.transform.translate_camera_x = camera.translate_camera[0];
+            input.transform.translate_camera_y = camera.translate_camera[1];
+            input.transform.translate_camera_z = camera.translate_camera[2];
+            input.transform.zoom = camera.zoom;
+            return true;
+        }
+        case ER_INPUT_ACK: {
+            Er_ack_input ack;
+            if (header.size < sizeof(ack)) return false;
+            memcpy(&ack, data, sizeof(ack));
+            input.type = ER_INPUT_ACK;
+            input.frame_id = ack.frame_id;
+            input.hold_us = ack.hold_us;
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+/* ------------- End of binary messages ------------ */
+
+
+/* ----------------- Json messages ----------------- */
+
+/*!
+ * Allocation-free SAX parser for the flat json objects sent by clients: every member whose value is a
+ * number or a string is reported to the handler, booleans and null are skipped, nested objects and arrays
+ * are rejected. Strings are reported raw, escape sequences are not decoded.
+ */
+class Er_flat_json_parser {
+public:
+    Er_flat_json_parser(const char *data, size_t size) : er_cursor(data), er_end(data + size) {}
+
+    template<typename Handler>
+    bool parse(Handler &handler) {
+        skip_spaces();
+        if (!consume('{')) return false;
+        skip_spaces();
+        if (consume('}')) return at_end();
+        do {
+            const char *key, *value;
+            size_t key_size, value_size;
+            double number;
+            skip_spaces();
+            if (!parse_string(key, key_size)) return false;
+            skip_spaces();
+            if (!consume(':')) return false;
+            skip_spaces();
+            if (er_cursor == er_end) return false;
+            if (*er_cursor == '"') {
+                if (!parse_string(value, value_size) || !handler.string(key, key_size, value, value_size)) return false;
+            } else if (*er_cursor == 't' || *er_cursor == 'f' || *er_cursor == 'n') {
+                if (!parse_literal()) return false;
+            } else {
+                if (!parse_number(number) || !handler.number(key, key_size, number)) return false;
+            }
+            skip_spaces();
+        } while (consume(','));
+        return consume('}') && at_end();
+    }
+
+private:
+    const char *er_cursor;
+    const char *er_end;
+
+    void skip_spaces() {
+        while (er_cursor != er_end && (*er_cursor == ' ' || *er_cursor == '\t' || *er_cursor == '\n' || *er_cursor == '\r')) {
+            ++er_cursor;
+        }
+    }
+
+    bool consume(char c) {
+        if (er_cursor == er_end || *er_cursor != c) return false;
+        ++er_cursor;
+        return true;
+    }
+
+    bool at_end() {
+        skip_spaces();
+        return er_cursor == er_end;
+    }
+
+    bool parse_string(const char *&value, size_t &size) {
+        if (!consume('"')) return false;
+        value = er_cursor;
+        while (er_cursor != er_end && *er_cursor != '"') {
+            if (*er_cursor == '\\' && ++er_cursor == er_end) return false;
+            ++er_cursor;
+        }
+        size = er_cursor - value;
+        return consume('"');
+    }
+
+    bool parse_literal() {
+        for (const char *literal : {"true", "false", "null"}) {
+            size_t size = strlen(literal);
+            if ((size_t) (er_end - er_cursor) >= size && memcmp(er_cursor, literal, size) == 0) {
+                er_cursor += size;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool parse_number(double &value) {
+        // strtod needs a terminated string: numbers are copied on the stack first
+        char digits[64];
+        size_t size = 0;
+        while (er_cursor != er_end && size < sizeof(digits) - 1 && *er_cursor && strchr("+-.0123456789eE", *er_cursor)) {
+            digits[size++] = *er_cursor++;
+        }
+        digits[size] = '\0';
+        char *parsed;
+        value = strtod(digits, &parsed);
+        return size > 0 && parsed == digits + size;
+    }
+};
+
+static bool key_is(const char *key, size_t size, const char *name) {
+    return strlen(name) == size && memcmp(key, name, size) == 0;
+}
+
+/*! fills an Er_input from the members reported by Er_flat_json_parser */
+struct Er_json_input_handler {
+    Er_input &input;
+
+    bool string(const char *key, size_t key_size, const char *value, size_t value_size) {
+        if (!key_is(key, key_size, "type")) return true;
+        if (key_is(value, value_size, "delta")) input.type = ER_INPUT_DELTA;
+        else if (key_is(value, value_size, "pose")) input.type = ER_INPUT_POSE;
+        else if (key_is(value, value_size, "ack")) input.type = ER_INPUT_ACK;
+        else return false;
+        return true;
+    }
+
+    bool number(const char *key, size_t key_size, double value) {
+        // e.g. 1e999, parsed as infinity
+        if (!std::isfinite(value)) return false;
+        bool is_id = key_is(key, key_size, "seq") || key_is(key, key_size, "frame_id");
+        bool is_time = key_is(key, key_size, "timestamp") || key_is(key, key_size, "hold");
+        if ((is_id && (value < 0 || value > UINT32_MAX)) || (is_time && (value < 0 || value > 1e18))) return false;
+        if (key_is(key, key_size, "seq")) input.sequence = (uint32_t) value;
+        else if (key_is(key, key_size, "timestamp")) input.timestamp = (uint64_t) value;
+        else if (key_is(key, key_size, "frame_id")) input.frame_id = (uint32_t) value;
+        else if (key_is(key, key_size, "hold")) input.hold_us = (uint64_t) (value * 1000);
+        else if (key_is(key, key_size, "rotate_x")) input.transform.rotate_x = (float) value;
+        else if (key_is(key, key_size, "rotate_y")) input.transform.rotate_y = (float) value;
+        else if (key_is(key, key_size, "rotate_z")) input.transform.rotate_z = (float) value;
+        else if (key_is(key, key_size, "translate_camera_x")) input.transform.translate_camera_x = (float) value;
+        else if (key_is(key, key_size, "translate_camera_y")) input.transform.translate_camera_y = (float) value;
+        else if (key_is(key, key_size, "translate_camera_z")) input.transform.translate_camera_z = (float) value;
+        else if (key_is(key, key_size, "zoom")) input.transform.zoom = (float) value;
+        return true;
+    }
+};
+
+/* -------------- End of json messages ------------- */
+
+/* ---------------- Input coalescing ---------------- */
+
+static void add_transform(Er_transform &transform, const Er_transform &delta) {
+    transform.rotate_x += delta.rotate_x;
+    transform.rotate_y += delta.rotate_y;
+    transform.rotate_z += delta.rotate_z;
+    transform.translate_camera_x += delta.translate_camera_x;
+    transform.translate_camera_y += delta.translate_camera_y;
+    transform.translate_camera_z += delta.translate_camera_z;
+    transform.zoom += delta.zoom;
+}
+
+void coalesce_input(Er_pending_input &pending, const Er_input &input, uint64_t now_us) {
+    if (pending.count == 0) pending.received_us = now_us;
+    pending.count++;
+    pending.sequence = std::max(pending.sequence, input.sequence);
+    if (input.type == ER_INPUT_POSE) {
+        pending.pose = true;
+        pending.transform = input.transform;
+    } else {
+        add_transform(pending.transform, input.transform);
+    }
+}
+
+void apply_input(const Er_pending_input &pending, Er_transform &camera) {
+    if (pending.pose) {
+        camera = pending.transform;
+    } else {
+        add_transform(camera, pending.transform);
+    }
+}
+
+bool transform_finite(const Er_transform &transform) {
+    for (float value : {transform.rotate_x, transform.rotate_y, transform.rotate_z, transform.translate_camera_x,
+                        transform.translate_camera_y, transform.translate_camera_z, transform.zoom}) {
+        if (!std::isfinite(value)) return false;
+    }
+    return true;
+}
+
+/* ------------- End of input coalescing ------------ */
+
+bool decode_input(const char *data, size_t size, bool binary, Er_input &input) {
+    ER_TRACE_SPAN("decode_input");
+    input = Er_input();
+    if (binary) {
+        if (!decode_binary_input(data, size, input)) return false;
+    } else {
+        Er_json_input_handler handler{input};
+        if (!Er_flat_json_parser(data, size).parse(handler)) return false;
+    }
+    // doubles in range for json still overflow the floats of the camera
+    return transform_finite(input.transform);
+}
@@ -0,0 +1,56 @@
+#ifndef ERATOSTHENE_STREAM_INPUT_H
+#define ERATOSTHENE_STREAM_INPUT_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "engine.h"
+#include "protocol.h"
+
+/*!
+ * A client message once decoded, whatever its encoding.
+ */
+struct Er_input {
+    Er_input_type type = ER_INPUT_DELTA;
+    /*! camera inputs: sequence number and client time in microseconds since the unix epoch, 0 if not sent */
+    uint32_t sequence = 0;
+    uint64_t timestamp = 0;
+    /*! camera inputs: the move, or the pose */
+    Er_transform transform;
+    /*! acknowledgments: the displayed frame and the time the client held it */
+    uint32_t frame_id = 0;
+    uint64_t hold_us = 0;
+};
+
+/*!
+ * Camera inputs received since the session main loop last took them: deltas are summed and a pose
+ * replaces everything received before it, so that a burst of inputs costs a single render.
+ */
+struct Er_pending_input {
+    /*! number of inputs merged, 0 when there is nothing to apply */
+    uint32_t count = 0;
+    bool pose = false;
+    /*! the pose if any, plus the sum of the deltas received after it */
+    Er_transform transform;
+    /*! highest sequence number merged */
+    uint32_t sequence = 0;
+    /*! reception of the oldest input merged */
+    uint64_t received_us = 0;
+};
+
+void coalesce_input(Er_pending_input &pending, const Er_input &input, uint64_t now_us);
+/*! moves the camera by the merged inputs */
+void apply_input(const Er_pending_input &pending, Er_transform &camera);
+/*! false if any member is NaN or infinite, which would never compare equal to the last rendered camera */
+bool transform_finite(const Er_transform &transform);
+
+/*!
+ * Decodes a client message, either a binary message (see Er_input_header) or a json object such as
+ * {"type": "delta", "seq": 3, "timestamp": 1700000000000000, "rotate_z": 0.5} where every field but the
+ * camera ones is optional ("hold" being in milliseconds for acks). Neither path allocates nor throws;
+ * returns false for malformed messages, binary ones of another protocol version, and numbers that are not
+ * finite or out of the range of their field.
+ */
+bool decode_input(const char *data, size_t size, bool binary, Er_input &input);
+
+#endif //ERATOSTHENE_STREAM_INPUT_H
@@ -0,0 +1,88 @@
+#include "latency.h"
+
+#include <algorithm>
+#include <cmath>
+
+const uint64_t MAX_VALUE = (1ull << ER_HISTOGRAM_MAX_BITS) - 1;
+const int SUB_BUCKETS = 1 << ER_HISTOGRAM_SUB_BITS;
+
+static int bucket_index(uint64_t value) {
+    value = std::min(value, MAX_VALUE);
+    if (value < SUB_BUCKETS) return (int) value;
+    // the top ER_HISTOGRAM_SUB_BITS bits below the most significant one pick the sub-bucket
+    int shift = 63 - __builtin_clzll(value) - ER_HISTOGRAM_SUB_BITS;
+    return ((shift + 1) << ER_HISTOGRAM_SUB_BITS) + (int) ((value >> shift) & (SUB_BUCKETS - 1));
+}
+
+static uint64_t bucket_highest(int index) {
+    if (index < SUB_BUCKETS) return index;
+    int shift = (index >> ER_HISTOGRAM_SUB_BITS) - 1;
+    return ((uint64_t) (SUB_BUCKETS + (index & (SUB_BUCKETS - 1)) + 1) << shift) - 1;
+}
+
+void Er_histogram::record(uint64_t value) {
+    er_buckets[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+    er_count.fetch_add(1, std::memory_order_relaxed);
+    er_sum.fetch_add(value, std::memory_order_relaxed);
+    uint64_t max = er_max.load(std::memory_order_relaxed);
+    while (value > max && !er_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {}
+}
+
+uint64_t Er_histogram::percentile(double quantile) const {
+    uint64_t total = 0;
+    for (auto &bucket : er_buckets) total += bucket.load(std::memory_order_relaxed);
+    if (total == 0) return 0;
+    auto rank = std::max<uint64_t>(1, (uint64_t) std::ceil(quantile * total));
+    uint64_t seen = 0;
+    for (int i = 0; i < ER_HISTOGRAM_BUCKETS; ++i) {
+        seen += er_buckets[i].load(std::memory_order_relaxed);
+        // the bucket bound may overshoot the largest sample
+        if (seen >= rank) return std::min(bucket_highest(i), max());
+    }
+    return max();
+}
+
+uint64_t Er_histogram::count_below(uint64_t bound) const {
+    uint64_t seen = 0;
+    for (int i = 0; i < ER_HISTOGRAM_BUCKETS && bucket_highest(i) <= bound; ++i) {
+        seen += er_buckets[i].load(std::memory_order_relaxed);
+    }
+    return seen;
+}
+
+const char *stage_name(Er_stage stage) {
+    static const char *names[ER_STAGE_COUNT] = {
+            "uplink", "input", "submit", "gpu", "gpu_render", "gpu_copy", "encode", "base64", "send", "display", "client",
+            "input_to_sent", "input_to_display", "first_frame",
+    };
+    return names[stage];
+}
+
+void Er_latency::record(Er_stage stage, uint64_t us) {
+    er_histograms[stage].record(us);
+    if (er_parent != nullptr) er_parent->record(stage, us);
+}
+
+Er_latency &Er_latency::global() {
+    static Er_latency latency;
+    return latency;
+}
+
+void Er_sent_frames::on_sent(uint32_t frame_id, uint64_t sent_us, uint64_t input_us) {
+    Entry &entry = er_entries[frame_id % ER_SENT_FRAMES];
+    // the id is cleared while the times change, so that a reader never matches half written times
+    entry.frame_id.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    entry.sent_us.store(sent_us, std::memory_order_relaxed);
+    entry.input_us.store(input_us, std::memory_order_relaxed);
+    entry.frame_id.store(frame_id, std::memory_order_release);
+}
+
+bool Er_sent_frames::find(uint32_t frame_id, uint64_t &sent_us, uint64_t &input_us) const {
+    const Entry &entry = er_entries[frame_id % ER_SENT_FRAMES];
+    if (frame_id == 0 || entry.frame_id.load(std::memory_order_acquire) != frame_id) return false;
+    sent_us = entry.sent_us.load(std::memory_order_relaxed);
+    input_us = entry.input_us.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return entry.frame_id.load(std::memory_order_relaxed) == frame_id;
+}
@@ -0,0 +1,124 @@
+#ifndef ERATOSTHENE_STREAM_LATENCY_H
+#define ERATOSTHENE_STREAM_LATENCY_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+/*! sub-buckets per power of two of the histograms, values are kept within 1/16 (~6%) of their magnitude */
+const int ER_HISTOGRAM_SUB_BITS = 4;
+/*! values above 2^40 us (12 days) are counted in the last bucket */
+const int ER_HISTOGRAM_MAX_BITS = 40;
+const int ER_HISTOGRAM_BUCKETS = (ER_HISTOGRAM_MAX_BITS - ER_HISTOGRAM_SUB_BITS + 1) << ER_HISTOGRAM_SUB_BITS;
+
+/*!
+ * Histogram of durations in microseconds with log-linear buckets, in the manner of HdrHistogram: exact below
+ * 16 us, then 16 buckets per power of two. Recording is a few relaxed atomic increments, so that any thread
+ * may record while another reads percentiles; readers may see a sample counted but not yet added to the sum.
+ */
+class Er_histogram {
+public:
+    void record(uint64_t value);
+
+    uint64_t count() const { return er_count.load(std::memory_order_relaxed); }
+    uint64_t sum() const { return er_sum.load(std::memory_order_relaxed); }
+    uint64_t max() const { return er_max.load(std::memory_order_relaxed); }
+    /*! highest value of the bucket holding the given quantile (between 0 and 1) of the samples, 0 when empty */
+    uint64_t percentile(double quantile) const;
+    /*! samples recorded in the buckets holding values up to bound, for cumulative exports */
+    uint64_t count_below(uint64_t bound) const;
+
+private:
+    std::array<std::atomic<uint64_t>, ER_HISTOGRAM_BUCKETS> er_buckets{};
+    std::atomic<uint64_t> er_count{0};
+    std::atomic<uint64_t> er_sum{0};
+    std::atomic<uint64_t> er_max{0};
+};
+
+/*!
+ * Stages of a frame, from the inputs it includes to its display by the client. Most are the time between
+ * two consecutive points of the main loop; gpu render and copy come from the engine timestamps, uplink and
+ * client from the client messages, and the last three span the whole pipeline.
+ */
+enum Er_stage {
+    /*!
+     * input timestamped by the client, until received by the websocket thread: compares the wall clocks of
+     * the client and the server, see ER_MAX_UPLINK_US
+     */
+    ER_STAGE_UPLINK,
+    /*! oldest input included received by the websocket thread, until the main loop applies it to the camera */
+    ER_STAGE_INPUT,
+    /*! the main loop decided to draw, until the command buffer is submitted */
+    ER_STAGE_SUBMIT,
+    /*! submitted, until the readback fence signalled: rendering and copy, plus queueing on the device */
+    ER_STAGE_GPU,
+    ER_STAGE_GPU_RENDER,
+    ER_STAGE_GPU_COPY,
+    /*! readback done, until the payload is encoded (banded frames encode most bands before the readback ends) */
+    ER_STAGE_ENCODE,
+    /*! base64 encoding of the frames of text sessions */
+    ER_STAGE_BASE64,
+    /*! payload ready, until handed to the socket: header, deflate and send */
+    ER_STAGE_SEND,
+    /*! sent, until the client acknowledgment is received */
+    ER_STAGE_DISPLAY,
+    /*! decoding and drawing time reported by the client in its acknowledgment */
+    ER_STAGE_CLIENT,
+    ER_STAGE_INPUT_TO_SENT,
+    ER_STAGE_INPUT_TO_DISPLAY,
+    /*! connection of the client, until its first frame is sent: engine, encoder and first rendering */
+    ER_STAGE_FIRST_FRAME,
+    ER_STAGE_COUNT
+};
+
+const char *stage_name(Er_stage stage);
+
+/*!
+ * uplink delays are only recorded below this: above it, or when the client timestamp is ahead of the server
+ * clock, the clocks of both ends are too far apart for the delay to mean anything
+ */
+const uint64_t ER_MAX_UPLINK_US = 10000000;
+
+/*!
+ * Histograms of every stage, recorded into the histograms of a parent as well so that sessions feed the
+ * server-wide ones. Safe to record from the websocket and main loop threads at once.
+ */
+class Er_latency {
+public:
+    explicit Er_latency(Er_latency *parent = nullptr) : er_parent(parent) {}
+
+    void record(Er_stage stage, uint64_t us);
+    const Er_histogram &histogram(Er_stage stage) const { return er_histograms[stage]; }
+
+    /*! histograms of all the sessions of the server */
+    static Er_latency &global();
+
+private:
+    Er_latency *er_parent;
+    std::array<Er_histogram, ER_STAGE_COUNT> er_histograms;
+};
+
+/*! frames kept by Er_sent_frames, more than the frames in flight of any session */
+const uint32_t ER_SENT_FRAMES = 64;
+
+/*!
+ * When the last frames of a session were sent and when the oldest input they include was received, written
+ * by the main loop and read by the websocket thread once the client acknowledges a frame.
+ */
+class Er_sent_frames {
+public:
+    /*! input_us is 0 for frames without new input */
+    void on_sent(uint32_t frame_id, uint64_t sent_us, uint64_t input_us);
+    /*! false if the frame is unknown or was overwritten by a more recent one */
+    bool find(uint32_t frame_id, uint64_t &sent_us, uint64_t &input_us) const;
+
+private:
+    struct Entry {
+        std::atomic<uint32_t> frame_id{0};
+        std::atomic<uint64_t> sent_us{0};
+        std::atomic<uint64_t> input_us{0};
+    };
+    std::array<Entry, ER_SENT_FRAMES> er_entries;
+};
+
+#endif //ERATOSTHENE_STREAM_LATENCY_H
@@ -0,0 +1,63 @@
+#include "server.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+Vertices debug_vertices = {
+        {{-0.5f, -0.5f, 0.0f}, {1.0f, 0.0f, 0.0f}},
+        {{0.5f, -0.5f, 0.0f}, {0.0f, 1.0f, 0.0f}},
+        {{0.5f, 0.5f, 0.0f}, {0.0f, 0.0f, 1.0f}},
+        {{-0.5f, 0.5f, 0.0f}, {1.0f, 1.0f, 1.0f}},
+
+        {{-0.5f, -0.5f, -0.5f}, {1.0f, 0.0f, 0.0f}},
+        {{0.5f, -0.5f, -0.5f}, {0.0f, 1.0f, 0.0f}},
+        {{0.5f, 0.5f, -0.5f}, {0.0f, 0.0f, 1.0f}},
+        {{-0.5f, 0.5f, -0.5f}, {1.0f, 1.0f, 1.0f}},
+
+        {{-0.6f, -0.6f, -0.6f}, {0.0f, 0.0f, 1.0f}},
+        {{0.6f, 0.6f, 0.6f}, {0.0f, 1.0f, 0.0f}},
+
+        {{0.7f, 0.7f, 0.7f}, {1.0f, 1.0f, 1.0f}},
+};
+
+Indices debug_triangles = {
+        0, 1, 2, 2, 3, 0,
+        4, 5, 6, 6, 7, 4,
+};
+
+Indices debug_lines = {
+        8, 9,
+};
+
+Indices debug_points = {
+        10,
+};
+
+Indices empty = {};
+
+int main(int argc, char **argv) {
+    trace_install();
+    if (argc == 1) {
+        setup_server(debug_vertices, debug_triangles, debug_lines, debug_points);
+    } else if (argc >= 2 && argc <= 5) {
+        std::string path(argv[1]);
+        auto v = load_ply_data(path);
+        std::vector<uint32_t> points(v.size());
+        std::generate(points.begin(), points.end(), [n = 0] () mutable { return n++; });
+
+        if (argc == 2)
+            setup_server(v, empty, empty, points);
+        else if (argc == 3)
+            setup_server(v, empty, empty, points, atoi(argv[2]));
+        else if (argc == 4)
+            setup_server(v, empty, empty, points, atoi(argv[2]), atoi(argv[3]));
+        else
+            setup_server(v, empty, empty, points, atoi(argv[2]), atoi(argv[3]), std::max(atoi(argv[4]), 0));
+    } else {
+        printf("Program usage:\n\t > eratosthene-stream [\"path/to/plyfile\" [port [metrics port [warm engines]]]]\n");
+        printf("If no ply file is given as an argument, the application will run with debug data to display on the application.\n");
+        exit(-1);
+    }
+}
@@ -0,0 +1,39 @@
+#include "memory.h"
+
+const char *memory_category_name(Er_memory_category category) {
+    static const char *names[ER_MEMORY_CATEGORY_COUNT] = {"geometry", "attachments", "readback", "uniforms", "staging"};
+    return names[category];
+}
+
+const char *host_category_name(Er_host_category category) {
+    static const char *names[ER_HOST_CATEGORY_COUNT] = {"scene", "buffers", "cache"};
+    return names[category];
+}
+
+void Er_memory_accounting::add_device(Er_memory_category category, uint32_t heap, int64_t size) {
+    er_device[category].fetch_add(size, std::memory_order_relaxed);
+    er_heaps[heap].fetch_add(size, std::memory_order_relaxed);
+    if (er_parent != nullptr) er_parent->add_device(category, heap, size);
+}
+
+void Er_memory_accounting::add_host(Er_host_category category, int64_t size) {
+    er_host[category].fetch_add(size, std::memory_order_relaxed);
+    if (er_parent != nullptr) er_parent->add_host(category, size);
+}
+
+int64_t Er_memory_accounting::device_total() const {
+    int64_t total = 0;
+    for (auto &bytes : er_device) total += bytes.load(std::memory_order_relaxed);
+    return total;
+}
+
+int64_t Er_memory_accounting::host_total() const {
+    int64_t total = 0;
+    for (auto &bytes : er_host) total += bytes.load(std::memory_order_relaxed);
+    return total;
+}
+
+Er_memory_accounting &Er_memory_accounting::global() {
+    static Er_memory_accounting accounting;
+    return accounting;
+}
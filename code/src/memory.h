@@ -0,0 +1,79 @@
+#ifndef ERATOSTHENE_STREAM_MEMORY_H
+#define ERATOSTHENE_STREAM_MEMORY_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+#include "utils.h"
+
+/*! what the device memory allocated by the engines is used for */
+enum Er_memory_category {
+    /*! vertex and index buffers of the scene */
+    ER_MEMORY_GEOMETRY,
+    ER_MEMORY_ATTACHMENTS,
+    /*! color and depth readback buffers, imported host memory included */
+    ER_MEMORY_READBACK,
+    ER_MEMORY_UNIFORMS,
+    /*! upload buffers, only alive while the scene is copied to the device */
+    ER_MEMORY_STAGING,
+    ER_MEMORY_CATEGORY_COUNT
+};
+
+/*! what the host memory held by the sessions is used for */
+enum Er_host_category {
+    /*! copy of the scene kept by each engine */
+    ER_HOST_SCENE,
+    /*! pooled message buffers of the sessions */
+    ER_HOST_BUFFERS,
+    /*! payload buffers of the frame cache shared by the sessions, bounded by its size */
+    ER_HOST_CACHE,
+    ER_HOST_CATEGORY_COUNT
+};
+
+const char *memory_category_name(Er_memory_category category);
+const char *host_category_name(Er_host_category category);
+
+/*!
+ * Bytes of device memory by category and by heap, and of host memory by category, for an engine or a session.
+ * Like Er_latency, changes are forwarded to a parent so that the server-wide accounting stays up to date, and
+ * counters are relaxed atomics that the metrics endpoint reads without any lock.
+ */
+class Er_memory_accounting {
+public:
+    explicit Er_memory_accounting(Er_memory_accounting *parent = nullptr) : er_parent(parent) {}
+
+    /*! size is negative for memory freed */
+    void add_device(Er_memory_category category, uint32_t heap, int64_t size);
+    void add_host(Er_host_category category, int64_t size);
+
+    int64_t device_bytes(Er_memory_category category) const { return er_device[category].load(std::memory_order_relaxed); }
+    int64_t heap_bytes(uint32_t heap) const { return er_heaps[heap].load(std::memory_order_relaxed); }
+    int64_t host_bytes(Er_host_category category) const { return er_host[category].load(std::memory_order_relaxed); }
+    int64_t device_total() const;
+    int64_t host_total() const;
+
+    /*! memory of all the engines and sessions of the server */
+    static Er_memory_accounting &global();
+
+private:
+    Er_memory_accounting *er_parent;
+    std::array<std::atomic<int64_t>, ER_MEMORY_CATEGORY_COUNT> er_device{};
+    std::array<std::atomic<int64_t>, VK_MAX_MEMORY_HEAPS> er_heaps{};
+    std::array<std::atomic<int64_t>, ER_HOST_CATEGORY_COUNT> er_host{};
+};
+
+/*!
+ * A memory heap of the device: its size, and how much of it the process may use and uses according to
+ * VK_EXT_memory_budget. Without the extension budget is the heap size and usage what the engines allocated.
+ */
+struct Er_heap_budget {
+    VkDeviceSize size = 0;
+    VkDeviceSize budget = 0;
+    VkDeviceSize usage = 0;
+    bool device_local = false;
+    /*! budget and usage come from the driver */
+    bool from_driver = false;
+};
+
+#endif //ERATOSTHENE_STREAM_MEMORY_H
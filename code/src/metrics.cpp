@@ -0,0 +1,196 @@
+#include "metrics.h"
+#include "engine.h"
+#include "memory.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+// upper bounds of the exported latency buckets in microseconds, exported in seconds; each is counted from the
+// histogram buckets below it, so that samples within ~6% under a bound may fall in the next one
+const uint64_t LATENCY_BOUNDS_US[] = {
+        100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000,
+};
+
+Er_metrics &Er_metrics::global() {
+    static Er_metrics metrics;
+    return metrics;
+}
+
+static void write_metric(std::ostringstream &out, const char *name, const char *type, const char *help, int64_t value) {
+    out << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n" << name << " " << value << "\n";
+}
+
+/*! a duration counted in microseconds, exported in seconds */
+static void write_seconds(std::ostringstream &out, const char *name, const char *type, const char *help, int64_t us) {
+    out << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n" << name << " " << us / 1e6 << "\n";
+}
+
+std::string format_metrics(const Er_metrics &metrics, const Er_latency &latency) {
+    auto load = [](const auto &counter) { return (int64_t) counter.load(std::memory_order_relaxed); };
+    std::ostringstream out;
+    // sums in seconds keep their microseconds
+    out.precision(15);
+    write_metric(out, "er_sessions", "gauge", "Sessions rendering their own view.", load(metrics.sessions));
+    write_metric(out, "er_spectators", "gauge", "Spectators of a shared view.", load(metrics.spectators));
+    write_metric(out, "er_sessions_total", "counter", "Sessions opened.", load(metrics.sessions_total));
+    write_metric(out, "er_frames_rendered_total", "counter", "Frames drawn by the engines, speculated ones included.",
+                 load(metrics.frames_rendered));
+    write_metric(out, "er_frames_encoded_total", "counter", "Frames encoded, speculated ones included.",
+                 load(metrics.frames_encoded));
+    write_metric(out, "er_frames_sent_total", "counter", "Frames sent to clients, spectators included.",
+                 load(metrics.frames_sent));
+    write_metric(out, "er_frames_dropped_total", "counter", "Frames of a shared view lagging spectators skipped.",
+                 load(metrics.frames_dropped));
+    write_metric(out, "er_bytes_sent_total", "counter", "Bytes of the frames sent to clients.", load(metrics.bytes_sent));
+    write_metric(out, "er_stalls_total", "counter", "Camera changes held back by a lagging client.", load(metrics.stalls));
+    const char *tier_metrics[][2] = {
+            {"er_tier_frames_total", "Frames sent by the sessions, by refinement tier."},
+            {"er_tier_bytes_total", "Bytes of the frames sent by the sessions, by refinement tier."},
+    };
+    for (int metric = 0; metric < 2; ++metric) {
+        out << "# HELP " << tier_metrics[metric][0] << " " << tier_metrics[metric][1] << "\n# TYPE "
+            << tier_metrics[metric][0] << " counter\n";
+        for (int tier = 0; tier < ER_TIER_COUNT; ++tier) {
+            out << tier_metrics[metric][0] << "{tier=\"" << tier_name(static_cast<Er_tier>(tier)) << "\"} "
+                << load(metric == 0 ? metrics.tier_frames[tier] : metrics.tier_bytes[tier]) << "\n";
+        }
+    }
+    write_metric(out, "er_cache_hits_total", "counter", "Frames taken from the shared frame cache.", load(metrics.cache_hits));
+    write_metric(out, "er_cache_misses_total", "counter", "Frame cache lookups that rendered the frame.",
+                 load(metrics.cache_misses));
+    write_metric(out, "er_cache_bytes", "gauge", "Memory held by the shared frame cache.", load(metrics.cache_bytes));
+    write_seconds(out, "er_cache_saved_seconds_total", "counter",
+                  "Rendering and encoding time the frame cache hits did not spend.", load(metrics.cache_saved_us));
+    write_metric(out, "er_speculation_hits_total", "counter", "Frames taken from the poses rendered ahead.",
+                 load(metrics.speculation_hits));
+    write_metric(out, "er_speculation_misses_total", "counter", "Camera changes none of the poses rendered ahead matched.",
+                 load(metrics.speculation_misses));
+    write_metric(out, "er_speculation_wasted_total", "counter", "Frames rendered ahead and thrown away unused.",
+                 load(metrics.speculation_wasted));
+    write_metric(out, "er_rate_controllers", "gauge", "Sessions whose jpeg quality is picked by the rate controller.",
+                 load(metrics.rate_controllers));
+    write_metric(out, "er_rate_quality_sum", "gauge", "Current quality of the rate controlled sessions, summed.",
+                 load(metrics.rate_quality));
+    write_metric(out, "er_rate_estimates", "gauge", "Rate controlled sessions with bandwidth and rtt estimates.",
+                 load(metrics.rate_estimates));
+    write_metric(out, "er_rate_bandwidth_bits_per_second_sum", "gauge",
+                 "Bandwidth estimated for the sessions with estimates, summed.", load(metrics.rate_bandwidth_bps));
+    write_seconds(out, "er_rate_rtt_seconds_sum", "gauge",
+                  "Round trip time estimated for the sessions with estimates, summed.", load(metrics.rate_rtt_us));
+    write_metric(out, "er_rate_quality_up_total", "counter", "Rate controller decisions raising the quality.",
+                 load(metrics.rate_quality_up));
+    write_metric(out, "er_rate_quality_down_total", "counter", "Rate controller decisions lowering the quality.",
+                 load(metrics.rate_quality_down));
+    write_metric(out, "er_rate_congestion_drops_total", "counter", "Quality cuts on a socket backlog over two frames.",
+                 load(metrics.rate_congestion_drops));
+    write_metric(out, "er_rate_idle_boosts_total", "counter", "Frames re-sent at the idle quality once the camera stopped.",
+                 load(metrics.rate_idle_boosts));
+    write_metric(out, "er_encoder_queue_depth", "gauge", "Bands waiting for a jpeg worker.", load(metrics.encoder_queue));
+    write_metric(out, "er_engines", "gauge", "Rendering engines alive, each with its own device.", load(metrics.engines));
+    write_metric(out, "er_engines_idle", "gauge", "Engines of closed sessions kept for the next ones.",
+                 load(metrics.engines_idle));
+    write_metric(out, "er_vulkan_objects", "gauge", "Vulkan objects and memory allocations owned by the engines.",
+                 vk_object_count());
+    write_metric(out, "er_engines_reused_total", "counter", "Sessions given the engine of a closed one.",
+                 load(metrics.engines_reused));
+    write_metric(out, "er_engines_cold_total", "counter", "Sessions that waited for their engine to be created.",
+                 load(metrics.engines_cold));
+    write_metric(out, "er_first_frames_late_total", "counter", "Sessions whose first frame missed the 50 ms target.",
+                 load(metrics.first_frames_late));
+    write_metric(out, "er_gpu_vertices_total", "counter", "Vertices assembled by the render passes.",
+                 load(metrics.gpu_vertices));
+    write_metric(out, "er_gpu_vertex_invocations_total", "counter", "Vertex shader invocations of the render passes.",
+                 load(metrics.gpu_vertex_invocations));
+    write_metric(out, "er_gpu_clipping_primitives_total", "counter", "Primitives out of clipping in the render passes.",
+                 load(metrics.gpu_clipping_primitives));
+
+    const Er_memory_accounting &memory = Er_memory_accounting::global();
+    out << "# HELP er_device_memory_bytes Device memory allocated by the engines.\n"
+        << "# TYPE er_device_memory_bytes gauge\n";
+    for (int category = 0; category < ER_MEMORY_CATEGORY_COUNT; ++category) {
+        out << "er_device_memory_bytes{category=\"" << memory_category_name(static_cast<Er_memory_category>(category))
+            << "\"} " << memory.device_bytes(static_cast<Er_memory_category>(category)) << "\n";
+    }
+    out << "# HELP er_host_memory_bytes Host memory held by the engines and sessions.\n"
+        << "# TYPE er_host_memory_bytes gauge\n";
+    for (int category = 0; category < ER_HOST_CATEGORY_COUNT; ++category) {
+        out << "er_host_memory_bytes{category=\"" << host_category_name(static_cast<Er_host_category>(category))
+            << "\"} " << memory.host_bytes(static_cast<Er_host_category>(category)) << "\n";
+    }
+    std::vector<Er_heap_budget> heaps = Er_vk_engine::heap_budgets();
+    const char *heap_metrics[][2] = {
+            {"er_heap_allocated_bytes", "Device memory allocated by the engines in each heap."},
+            {"er_heap_size_bytes", "Size of each memory heap of the device."},
+            {"er_heap_budget_bytes", "Memory of each heap the process may use, the heap size without VK_EXT_memory_budget."},
+            {"er_heap_usage_bytes", "Memory of each heap used by the process, what the engines allocated without VK_EXT_memory_budget."},
+    };
+    for (int metric = 0; metric < 4; ++metric) {
+        if (heaps.empty()) break;
+        out << "# HELP " << heap_metrics[metric][0] << " " << heap_metrics[metric][1] << "\n# TYPE "
+            << heap_metrics[metric][0] << " gauge\n";
+        for (uint32_t heap = 0; heap < heaps.size(); ++heap) {
+            int64_t values[] = {memory.heap_bytes(heap), (int64_t) heaps[heap].size, (int64_t) heaps[heap].budget,
+                                (int64_t) heaps[heap].usage};
+            out << heap_metrics[metric][0] << "{heap=\"" << heap << "\",device_local=\""
+                << (heaps[heap].device_local ? "true" : "false") << "\"} " << values[metric] << "\n";
+        }
+    }
+
+    out << "# HELP er_frame_stage_seconds Time frames spent in each stage, from input to client display.\n"
+        << "# TYPE er_frame_stage_seconds histogram\n";
+    for (int stage = 0; stage < ER_STAGE_COUNT; ++stage) {
+        auto &histogram = latency.histogram(static_cast<Er_stage>(stage));
+        const char *name = stage_name(static_cast<Er_stage>(stage));
+        // the total is read first so that buckets, read afterwards, never exceed it
+        uint64_t count = histogram.count();
+        for (uint64_t bound : LATENCY_BOUNDS_US) {
+            out << "er_frame_stage_seconds_bucket{stage=\"" << name << "\",le=\"" << bound / 1e6 << "\"} "
+                << std::min(histogram.count_below(bound), count) << "\n";
+        }
+        out << "er_frame_stage_seconds_bucket{stage=\"" << name << "\",le=\"+Inf\"} " << count << "\n"
+            << "er_frame_stage_seconds_sum{stage=\"" << name << "\"} " << histogram.sum() / 1e6 << "\n"
+            << "er_frame_stage_seconds_count{stage=\"" << name << "\"} " << count << "\n";
+    }
+    return out.str();
+}
+
+Er_metrics_server::Er_metrics_server(int port, const std::string &address) : er_server(port, address) {
+    er_server.setOnConnectionCallback([](ix::HttpRequestPtr request, std::shared_ptr<ix::ConnectionState>) {
+        // the timeline of the trace spans, see trace.h
+        if (request->uri == "/trace/start" || request->uri == "/trace/stop") {
+            request->uri == "/trace/start" ? trace_start() : trace_stop();
+            return std::make_shared<ix::HttpResponse>(200, "OK", ix::HttpErrorCode::Ok, ix::WebSocketHttpHeaders(),
+                                                      er_trace_enabled ? "tracing\n" : "not tracing\n");
+        }
+        if (request->uri == "/trace") {
+            ix::WebSocketHttpHeaders headers;
+            headers["Content-Type"] = "application/json";
+            return std::make_shared<ix::HttpResponse>(200, "OK", ix::HttpErrorCode::Ok, headers, trace_dump());
+        }
+        if (request->uri != "/metrics") {
+            return std::make_shared<ix::HttpResponse>(404, "Not Found", ix::HttpErrorCode::Ok,
+                                                      ix::WebSocketHttpHeaders(), "not found\n");
+        }
+        ix::WebSocketHttpHeaders headers;
+        headers["Content-Type"] = "text/plain; version=0.0.4";
+        return std::make_shared<ix::HttpResponse>(200, "OK", ix::HttpErrorCode::Ok, headers,
+                                                  format_metrics(Er_metrics::global(), Er_latency::global()));
+    });
+}
+
+Er_metrics_server::~Er_metrics_server() {
+    if (er_started) er_server.stop();
+}
+
+bool Er_metrics_server::start() {
+    auto res = er_server.listen();
+    if (!res.first) {
+        std::cerr << "Metrics endpoint not available: " << res.second << std::endl;
+        return false;
+    }
+    er_server.start();
+    er_started = true;
+    return true;
+}
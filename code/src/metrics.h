@@ -0,0 +1,105 @@
+#ifndef ERATOSTHENE_STREAM_METRICS_H
+#define ERATOSTHENE_STREAM_METRICS_H
+
+#include <array>
+#include <atomic>
+#include <string>
+#include <cstdint>
+
+#include <ixwebsocket/IXHttpServer.h>
+
+#include "latency.h"
+#include "refinement.h"
+
+/*! port of the metrics endpoint, 0 disables it */
+const int METRICS_PORT = 9090;
+
+/*!
+ * Counters of the whole server, updated by the session threads with relaxed atomic operations and read by
+ * the metrics endpoint without any lock. Rates (frames or bytes per second) are left to the scraper.
+ */
+struct Er_metrics {
+    /*! sessions rendering their own view, and spectators of a shared one */
+    std::atomic<int64_t> sessions{0};
+    std::atomic<int64_t> spectators{0};
+    std::atomic<uint64_t> sessions_total{0};
+
+    std::atomic<uint64_t> frames_rendered{0};
+    std::atomic<uint64_t> frames_encoded{0};
+    std::atomic<uint64_t> frames_sent{0};
+    /*! frames of a shared view a lagging spectator never received */
+    std::atomic<uint64_t> frames_dropped{0};
+    std::atomic<uint64_t> bytes_sent{0};
+    /*! camera changes held back because a client lagged behind */
+    std::atomic<uint64_t> stalls{0};
+    /*! frames sent by the sessions and their bytes, by refinement tier */
+    std::array<std::atomic<uint64_t>, ER_TIER_COUNT> tier_frames{};
+    std::array<std::atomic<uint64_t>, ER_TIER_COUNT> tier_bytes{};
+
+    std::atomic<uint64_t> cache_hits{0};
+    std::atomic<uint64_t> cache_misses{0};
+    /*! capacity of the frame cache buffers, what FRAME_CACHE_BYTES caps */
+    std::atomic<int64_t> cache_bytes{0};
+    /*! render, readback and encode time the cache hits did not spend */
+    std::atomic<uint64_t> cache_saved_us{0};
+    /*! camera changes served by a speculated frame, or not though poses were speculated, and frames unused */
+    std::atomic<uint64_t> speculation_hits{0};
+    std::atomic<uint64_t> speculation_misses{0};
+    std::atomic<uint64_t> speculation_wasted{0};
+
+    /*!
+     * sessions whose quality the rate controller picks, and the sum of their current quality; those with
+     * bandwidth and rtt estimates, from acknowledgments, and the sum of the estimates: sums are divided by the
+     * counts for averages
+     */
+    std::atomic<int64_t> rate_controllers{0};
+    std::atomic<int64_t> rate_quality{0};
+    std::atomic<int64_t> rate_estimates{0};
+    std::atomic<int64_t> rate_bandwidth_bps{0};
+    std::atomic<int64_t> rate_rtt_us{0};
+    std::atomic<uint64_t> rate_quality_up{0};
+    std::atomic<uint64_t> rate_quality_down{0};
+    std::atomic<uint64_t> rate_congestion_drops{0};
+    std::atomic<uint64_t> rate_idle_boosts{0};
+
+    /*! bands waiting for a jpeg worker, across the band encoders of all the sessions */
+    std::atomic<int64_t> encoder_queue{0};
+
+    /*! engines alive, idle ones in the engine pool included */
+    std::atomic<int64_t> engines{0};
+    std::atomic<int64_t> engines_idle{0};
+    std::atomic<uint64_t> engines_reused{0};
+    /*! sessions that found no idle engine and waited for theirs to be created */
+    std::atomic<uint64_t> engines_cold{0};
+    /*! sessions whose first frame took longer than ER_FIRST_FRAME_TARGET_US */
+    std::atomic<uint64_t> first_frames_late{0};
+
+    std::atomic<uint64_t> gpu_vertices{0};
+    std::atomic<uint64_t> gpu_vertex_invocations{0};
+    std::atomic<uint64_t> gpu_clipping_primitives{0};
+
+    static Er_metrics &global();
+};
+
+/*! the counters and the latency histograms in the Prometheus text exposition format */
+std::string format_metrics(const Er_metrics &metrics, const Er_latency &latency);
+
+/*!
+ * Serves format_metrics of the global counters and histograms on /metrics, from the threads of its own
+ * http server so that scrapes never run on a session thread. Also serves the trace spans on /trace, and
+ * starts or stops recording them on /trace/start and /trace/stop.
+ */
+class Er_metrics_server {
+public:
+    Er_metrics_server(int port, const std::string &address);
+    ~Er_metrics_server();
+
+    /*! false if the port could not be bound, the server then stays stopped */
+    bool start();
+
+private:
+    ix::HttpServer er_server;
+    bool er_started = false;
+};
+
+#endif //ERATOSTHENE_STREAM_METRICS_H
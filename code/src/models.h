@@ -13,6 +13,8 @@
 #include <optional>
 #include <vector>
 
+#include "handles.h"
+
 struct Vertex {
     /*! position of the vertex */
     glm::vec3 pos;
@@ -69,15 +71,15 @@ struct UniformBufferObject {
  * A collection of what composes an image in vulkan
  */
 struct Attachment {
-    VkImage img;
-    VkDeviceMemory mem;
-    VkImageView view;
+    Er_vk_memory mem;
+    Er_vk_image img;
+    Er_vk_image_view view;
 };
 
 
 struct BufferWrap {
-    VkBuffer buf;
-    VkDeviceMemory mem;
+    Er_vk_memory mem;
+    Er_vk_buffer buf;
 };
 
 #endif //ERATOSTHENE_STREAM_MODELS_H
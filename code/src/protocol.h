@@ -0,0 +1,173 @@
+#ifndef ERATOSTHENE_STREAM_PROTOCOL_H
+#define ERATOSTHENE_STREAM_PROTOCOL_H
+
+#include <cstdint>
+#include <chrono>
+#include <string>
+
+#include "compression.h"
+#include "refinement.h"
+
+/*! version of the binary streaming protocol, sent in every frame header */
+const uint8_t ER_PROTOCOL_VERSION = 1;
+
+/*!
+ * Codec used to encode the payload that follows a frame header.
+ */
+enum Er_codec : uint8_t {
+    ER_CODEC_JPEG = 0,
+    /*! VP8 bitstream, decoded by the client with WebCodecs (only in builds with ER_WITH_VPX) */
+    ER_CODEC_VP8 = 1,
+    /*! list of jpeg encoded rectangles to draw over the previous frame, see Er_tile_entry */
+    ER_CODEC_TILES = 2,
+    /*! depth map of the frame with the same id, see Er_depth_entry */
+    ER_CODEC_DEPTH = 3,
+    /*! lossless image, for the refined frames of jpeg sessions that asked for it */
+    ER_CODEC_PNG = 4,
+};
+
+/*! the payload can be decoded without any previous frame */
+const uint8_t ER_FRAME_FLAG_KEY = 1 << 0;
+/*! the payload is a raw deflate stream (RFC 1951) to inflate before decoding */
+const uint8_t ER_FRAME_FLAG_DEFLATE = 1 << 1;
+
+/*!
+ * Fixed-size header prepended to every binary frame message sent to the client; the encoded
+ * payload starts right after it. Fields are little endian (the server only targets x86/ARM Linux).
+ * The header carries its own size so that clients can skip fields added by newer servers.
+ */
+#pragma pack(push, 1)
+struct Er_frame_header {
+    uint8_t version = ER_PROTOCOL_VERSION;
+    uint8_t codec = ER_CODEC_JPEG;
+    uint8_t size = sizeof(Er_frame_header);
+    uint8_t flags = 0;
+    /*! monotonically increasing id of the frame within a session */
+    uint32_t frame_id = 0;
+    /*! time at which the payload finished encoding, in microseconds since the unix epoch */
+    uint64_t timestamp = 0;
+    uint16_t width = 0;
+    uint16_t height = 0;
+    /*! highest sequence number of the client inputs the frame includes, see Er_camera_input */
+    uint32_t input_sequence = 0;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(Er_frame_header) == 24, "frame header layout must match the web client");
+
+/*! edge of the square tiles the frame is split into in tile mode, a multiple of the 16 pixels jpeg mcu */
+const int ER_TILE_SIZE = 64;
+
+/*!
+ * A ER_CODEC_TILES payload is a uint16 count of rectangles, then for each rectangle this entry directly
+ * followed by its jpeg image. Coordinates are in pixels of the full frame.
+ */
+#pragma pack(push, 1)
+struct Er_tile_entry {
+    uint16_t x = 0;
+    uint16_t y = 0;
+    uint16_t width = 0;
+    uint16_t height = 0;
+    /*! size of the jpeg image following the entry */
+    uint32_t size = 0;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(Er_tile_entry) == 12, "tile entry layout must match the web client");
+
+/*!
+ * A ER_CODEC_DEPTH payload is this entry followed by the depth map of the frame with the same frame_id,
+ * downsampled to width x height: the high bytes of the 16 bits depths, then their low bytes (byte planes
+ * deflate better than interleaved values). Depths are window depths between 0 and 1 scaled to 65535,
+ * 65535 being the background. Matrices are column-major, as in the vertex shader, so that clients can
+ * unproject the map and draw it from another pose until the frame of that pose arrives.
+ */
+#pragma pack(push, 1)
+struct Er_depth_entry {
+    uint16_t width = 0;
+    uint16_t height = 0;
+    /*! camera pose of the frame: rotate x, y, z, translate x, y, z and zoom */
+    float pose[7] = {};
+    float model[16] = {};
+    float view[16] = {};
+    float projection[16] = {};
+};
+#pragma pack(pop)
+
+static_assert(sizeof(Er_depth_entry) == 224, "depth entry layout must match the web client");
+
+/*! types of the messages sent by the clients */
+enum Er_input_type : uint8_t {
+    /*! camera move relative to the current pose, see Er_camera_input */
+    ER_INPUT_DELTA = 0,
+    /*! absolute camera pose, see Er_camera_input */
+    ER_INPUT_POSE = 1,
+    /*! a frame was displayed, see Er_ack_input */
+    ER_INPUT_ACK = 2,
+};
+
+/*!
+ * Binary client messages start with this header, then the fields of their type. As for frames the
+ * header carries the message size so that messages from newer clients can still be decoded.
+ */
+#pragma pack(push, 1)
+struct Er_input_header {
+    uint8_t version = ER_PROTOCOL_VERSION;
+    uint8_t type = ER_INPUT_DELTA;
+    uint8_t size = 0;
+    uint8_t flags = 0;
+};
+
+struct Er_camera_input {
+    Er_input_header header;
+    /*! increasing number of the input within a session */
+    uint32_t sequence = 0;
+    /*! client time at which the input happened, in microseconds since the unix epoch */
+    uint64_t timestamp = 0;
+    float rotate[3] = {0.f, 0.f, 0.f};
+    float translate_camera[3] = {0.f, 0.f, 0.f};
+    float zoom = 0.f;
+};
+
+struct Er_ack_input {
+    Er_input_header header;
+    uint32_t frame_id = 0;
+    /*! time the client spent decoding and drawing the frame */
+    uint32_t hold_us = 0;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(Er_camera_input) == 44, "camera input layout must match the web client");
+static_assert(sizeof(Er_ack_input) == 12, "ack layout must match the web client");
+
+/*!
+ * Options a client requests when opening its websocket, through the query string of the url
+ * (e.g. "/stream?encoding=base64").
+ */
+struct Er_client_options {
+    /*! send frames as binary messages, otherwise as base64 text messages for older clients */
+    bool binary = true;
+    /*! codec the client would like to receive, "codec=vp8" or "codec=tiles" in the url (binary mode only) */
+    Er_codec codec = ER_CODEC_JPEG;
+    /*! "view=name": control the camera of a view shared with spectators */
+    std::string view;
+    /*! "watch=name": spectate the view with the given name instead of rendering one */
+    std::string watch;
+    /*! "speculate=1": render the likely next camera poses while waiting for input (jpeg only) */
+    bool speculate = false;
+    /*! "depth=1": send a depth map after each frame for client-side reprojection (binary mode only) */
+    bool depth = false;
+    /*! "bands=1": jpeg frames are encoded band by band during the readback and sent as ER_CODEC_TILES */
+    bool bands = false;
+    /*! detail of the frames while moving and once the camera settled, see parse_refinement_option */
+    Er_refinement_config refinement;
+    /*! what is compressed and how, see parse_deflate_option */
+    Er_deflate_config deflate;
+};
+
+inline uint64_t timestamp_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+#endif //ERATOSTHENE_STREAM_PROTOCOL_H
@@ -0,0 +1,120 @@
+#include "rate_control.h"
+#include "metrics.h"
+
+#include <algorithm>
+
+// weight of a new sample in the moving averages
+const double EWMA_WEIGHT = 0.125;
+// the minimum rtt is forgotten regularly so that it follows route changes
+const uint64_t MIN_RTT_WINDOW_US = 10000000;
+
+Er_rate_controller::Er_rate_controller(Er_rate_config config) : er_config(config) {
+    er_stats.quality = config.initial_quality;
+}
+
+Er_rate_controller::~Er_rate_controller() {
+    export_metrics(0, 0, 0);
+}
+
+void Er_rate_controller::export_metrics(int quality, double bandwidth_bps, double rtt_us) {
+    Er_metrics &metrics = Er_metrics::global();
+    if ((quality > 0) != (er_exported_quality > 0)) {
+        metrics.rate_controllers.fetch_add(quality > 0 ? 1 : -1, std::memory_order_relaxed);
+    }
+    metrics.rate_quality.fetch_add(quality - er_exported_quality, std::memory_order_relaxed);
+    er_exported_quality = quality;
+
+    int64_t bandwidth = (int64_t) bandwidth_bps, rtt = (int64_t) rtt_us;
+    if ((bandwidth > 0) != (er_exported_bandwidth_bps > 0)) {
+        metrics.rate_estimates.fetch_add(bandwidth > 0 ? 1 : -1, std::memory_order_relaxed);
+    }
+    metrics.rate_bandwidth_bps.fetch_add(bandwidth - er_exported_bandwidth_bps, std::memory_order_relaxed);
+    metrics.rate_rtt_us.fetch_add(rtt - er_exported_rtt_us, std::memory_order_relaxed);
+    er_exported_bandwidth_bps = bandwidth;
+    er_exported_rtt_us = rtt;
+}
+
+void Er_rate_controller::on_frame_sent(uint32_t frameId, size_t bytes, int quality, uint64_t now_us, float size_share) {
+    std::lock_guard<std::mutex> lock(er_mutex);
+    er_in_flight[frameId % er_in_flight.size()] = {frameId, now_us, bytes};
+    er_last_bytes = bytes;
+    er_last_quality = quality;
+    er_last_share = std::clamp(size_share, 0.01f, 1.f);
+}
+
+void Er_rate_controller::on_ack(uint32_t frameId, uint64_t hold_us, uint64_t now_us) {
+    std::lock_guard<std::mutex> lock(er_mutex);
+    auto &frame = er_in_flight[frameId % er_in_flight.size()];
+    // too old, the slot was reused by a newer frame
+    if (frame.frame_id != frameId || frame.sent_us == 0 || now_us < frame.sent_us + hold_us) return;
+    er_stats.acks++;
+
+    double rtt = now_us - frame.sent_us - hold_us;
+    er_stats.rtt_us = er_stats.rtt_us == 0 ? rtt : er_stats.rtt_us + EWMA_WEIGHT * (rtt - er_stats.rtt_us);
+    if (er_stats.min_rtt_us == 0 || rtt < er_stats.min_rtt_us || now_us - er_min_rtt_since > MIN_RTT_WINDOW_US) {
+        er_stats.min_rtt_us = rtt;
+        er_min_rtt_since = now_us;
+    }
+
+    // what exceeds the minimum rtt is the time the frame spent being transmitted
+    double transfer_us = std::max(rtt - er_stats.min_rtt_us, 1000.0);
+    double bandwidth = frame.bytes * 8 * 1e6 / transfer_us;
+    er_stats.bandwidth_bps = er_stats.bandwidth_bps == 0 ? bandwidth
+            : er_stats.bandwidth_bps + EWMA_WEIGHT * (bandwidth - er_stats.bandwidth_bps);
+    frame.sent_us = 0;
+    // the quality is only exported once picked, by next_quality
+    export_metrics(er_exported_quality, er_stats.bandwidth_bps, er_stats.rtt_us);
+}
+
+int Er_rate_controller::next_quality(size_t backlog_bytes, bool idle, int max_quality) {
+    std::lock_guard<std::mutex> lock(er_mutex);
+    // adapts from the quality frames are actually sent at, which the last one was if it was not a refinement
+    int quality = std::min(er_stats.quality, max_quality);
+    er_stats.backlog_bytes = backlog_bytes;
+
+    if (er_stats.bandwidth_bps > 0) {
+        er_stats.target_bytes = er_stats.bandwidth_bps / 8 * er_config.bandwidth_share / er_config.target_fps;
+    }
+
+    if (er_stats.target_bytes > 0 && backlog_bytes > 2 * er_stats.target_bytes) {
+        // frames pile up in the socket: back off hard
+        quality = quality * 7 / 10;
+        er_stats.congestion_drops++;
+        Er_metrics::global().rate_congestion_drops.fetch_add(1, std::memory_order_relaxed);
+    } else if (er_stats.target_bytes > 0 && er_last_bytes > 0 && er_last_quality == quality) {
+        // jpeg size grows roughly linearly with quality in the useful range, and with the pixels of the frame:
+        // a reduced frame is held to the share of the target its size is
+        double ratio = (double) er_last_bytes / (er_stats.target_bytes * er_last_share);
+        if (ratio > 1.1) {
+            quality -= std::max(1, (int) ((ratio - 1) * quality / 2));
+        } else if (ratio < 0.7) {
+            quality += 2;
+        }
+    }
+    quality = std::clamp(quality, er_config.min_quality, std::max(er_config.min_quality,
+                                                                  std::min(er_config.max_quality, max_quality)));
+    Er_metrics &metrics = Er_metrics::global();
+    if (quality > er_stats.quality) {
+        er_stats.quality_up++;
+        metrics.rate_quality_up.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (quality < er_stats.quality) {
+        er_stats.quality_down++;
+        metrics.rate_quality_down.fetch_add(1, std::memory_order_relaxed);
+    }
+    er_stats.quality = quality;
+    export_metrics(quality, er_stats.bandwidth_bps, er_stats.rtt_us);
+
+    // the motion-time quality is kept for when the camera moves again
+    if (idle && backlog_bytes == 0 && er_config.idle_quality > quality) {
+        er_stats.idle_boosts++;
+        metrics.rate_idle_boosts.fetch_add(1, std::memory_order_relaxed);
+        return er_config.idle_quality;
+    }
+    return quality;
+}
+
+Er_rate_stats Er_rate_controller::stats() {
+    std::lock_guard<std::mutex> lock(er_mutex);
+    return er_stats;
+}
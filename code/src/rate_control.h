@@ -0,0 +1,93 @@
+#ifndef ERATOSTHENE_STREAM_RATE_CONTROL_H
+#define ERATOSTHENE_STREAM_RATE_CONTROL_H
+
+#include <array>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+struct Er_rate_config {
+    int min_quality = 10;
+    int max_quality = 90;
+    int initial_quality = 30;
+    /*! quality of the frame re-sent once the camera stopped moving, see Er_refinement_config for when */
+    int idle_quality = 90;
+    float target_fps = 60.f;
+    /*! share of the estimated bandwidth the stream may use */
+    float bandwidth_share = 0.8f;
+};
+
+/*!
+ * Decisions and estimates of a rate controller, copied out for metrics and logs.
+ */
+struct Er_rate_stats {
+    int quality = 0;
+    double bandwidth_bps = 0;
+    double rtt_us = 0;
+    double min_rtt_us = 0;
+    size_t target_bytes = 0;
+    size_t backlog_bytes = 0;
+    uint64_t acks = 0;
+    uint64_t quality_up = 0;
+    uint64_t quality_down = 0;
+    uint64_t congestion_drops = 0;
+    uint64_t idle_boosts = 0;
+};
+
+/*!
+ * Per-session jpeg quality controller. Client acknowledgments give the round trip time and, from the
+ * time each frame took to be delivered, an estimate of the available bandwidth; the socket send backlog
+ * tells when the stream already overshoots it. Quality is then picked so that a frame fits the bandwidth
+ * share allotted to one frame at the target frame rate, and raised to idle_quality once the camera stops.
+ *
+ * on_ack is called from the websocket thread, the other methods from the session main loop. Decisions and
+ * estimates are also added to the server metrics, see Er_metrics.
+ */
+class Er_rate_controller {
+public:
+    explicit Er_rate_controller(Er_rate_config config = Er_rate_config());
+    /*! takes its quality and estimates back out of the server metrics */
+    ~Er_rate_controller();
+    Er_rate_controller(const Er_rate_controller &) = delete;
+    Er_rate_controller &operator=(const Er_rate_controller &) = delete;
+
+    /*! size_share is the share of the pixels of a full frame the frame has, when rendered reduced */
+    void on_frame_sent(uint32_t frameId, size_t bytes, int quality, uint64_t now_us, float size_share = 1.f);
+    /*! hold_us is the time the client spent decoding and displaying the frame before acknowledging it */
+    void on_ack(uint32_t frameId, uint64_t hold_us, uint64_t now_us);
+
+    /*!
+     * Quality of the next frame, given the bytes waiting in the socket and whether the camera is idle.
+     * To be called once per rendered frame, as each call adapts the quality. max_quality caps the quality
+     * picked, e.g. while the camera moves, and frames sent at the capped quality keep adapting it.
+     */
+    int next_quality(size_t backlog_bytes, bool idle, int max_quality = 100);
+
+    const Er_rate_config &config() const { return er_config; }
+    Er_rate_stats stats();
+
+private:
+    struct In_flight {
+        uint32_t frame_id = 0;
+        uint64_t sent_us = 0;
+        size_t bytes = 0;
+    };
+
+    Er_rate_config er_config;
+    std::mutex er_mutex;
+    std::array<In_flight, 64> er_in_flight;
+    size_t er_last_bytes = 0;
+    int er_last_quality = 0;
+    float er_last_share = 1.f;
+    uint64_t er_min_rtt_since = 0;
+    Er_rate_stats er_stats;
+    /*! quality and estimates currently added to the server metrics, 0 while not added */
+    int er_exported_quality = 0;
+    int64_t er_exported_bandwidth_bps = 0;
+    int64_t er_exported_rtt_us = 0;
+
+    /*! replaces the quality and estimates added to the server metrics by the current ones */
+    void export_metrics(int quality, double bandwidth_bps, double rtt_us);
+};
+
+#endif //ERATOSTHENE_STREAM_RATE_CONTROL_H
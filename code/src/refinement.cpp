@@ -0,0 +1,82 @@
+#include "refinement.h"
+#include "metrics.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+const char *tier_name(Er_tier tier) {
+    const char *names[] = {"motion", "refined"};
+    return tier < ER_TIER_COUNT ? names[tier] : "unknown";
+}
+
+bool parse_refinement_option(const std::string &param, Er_refinement_config &config) {
+    size_t separator = param.find('=');
+    if (separator == std::string::npos) return false;
+    std::string key = param.substr(0, separator);
+    const char *value = param.c_str() + separator + 1;
+    if (key == "refine") {
+        config.enabled = strcmp(value, "0") != 0;
+        config.lossless = strcmp(value, "lossless") == 0;
+    } else if (key == "refine_idle") {
+        config.idle_us = std::max(0L, strtol(value, nullptr, 10)) * 1000;
+    } else if (key == "motion_points") {
+        config.motion_points = std::min(1.f, std::max(0.01f, strtof(value, nullptr)));
+    } else if (key == "motion_scale") {
+        // WIDTH and HEIGHT stay multiples of the 16 pixels jpeg mcu
+        long scale = strtol(value, nullptr, 10);
+        config.motion_scale = scale >= 4 ? 4 : scale >= 2 ? 2 : 1;
+    } else if (key == "motion_quality") {
+        config.motion_quality = std::min(100, std::max(1, (int) strtol(value, nullptr, 10)));
+    } else if (key == "accumulate") {
+        config.accumulate_points = (uint32_t) std::min(4294967295L, std::max(0L, strtol(value, nullptr, 10)));
+    } else {
+        return false;
+    }
+    return true;
+}
+
+Er_draw_options Er_refinement::draw_options(Er_tier tier, size_t points, bool scalable) const {
+    Er_draw_options options;
+    if (!er_config.enabled || tier == ER_TIER_REFINED) return options;
+    options.point_count = (uint32_t) std::max(1.0, (double) er_config.motion_points * points);
+    if (scalable) options.scale = er_config.motion_scale;
+    return options;
+}
+
+int Er_refinement::quality(Er_tier tier, int rate_quality) const {
+    if (!er_config.enabled) return rate_quality;
+    return tier == ER_TIER_REFINED ? er_config.refined_quality : std::min(rate_quality, er_config.motion_quality);
+}
+
+int Er_refinement::quality_cap(Er_tier tier) const {
+    return er_config.enabled && tier == ER_TIER_MOTION ? er_config.motion_quality : 100;
+}
+
+bool Er_refinement::accumulates(size_t points) const {
+    return er_config.enabled && er_config.accumulate_points > 0 && points > er_config.accumulate_points;
+}
+
+Er_draw_options Er_refinement::accumulation_step(uint32_t accumulated) const {
+    Er_draw_options options;
+    // the shuffled indices make each range a random subset of the points, disjoint from the previous ones
+    options.first_point = accumulated;
+    options.point_count = er_config.accumulate_points;
+    options.accumulate = accumulated > 0;
+    return options;
+}
+
+void Er_refinement::on_accumulation_step(bool complete) {
+    er_accumulation.steps++;
+    if (complete) er_accumulation.completed++;
+}
+
+void Er_refinement::on_frame_sent(Er_tier tier, size_t bytes, uint64_t render_us, uint32_t points) {
+    Er_tier_stats &stats = er_stats[tier];
+    stats.frames++;
+    stats.bytes += bytes;
+    stats.render_us += render_us;
+    stats.points += points;
+    Er_metrics::global().tier_frames[tier].fetch_add(1, std::memory_order_relaxed);
+    Er_metrics::global().tier_bytes[tier].fetch_add(bytes, std::memory_order_relaxed);
+}
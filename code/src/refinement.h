@@ -0,0 +1,111 @@
+#ifndef ERATOSTHENE_STREAM_REFINEMENT_H
+#define ERATOSTHENE_STREAM_REFINEMENT_H
+
+#include <array>
+#include <string>
+#include <cstdint>
+
+#include "engine.h"
+
+/*! detail levels a session renders its frames at */
+enum Er_tier : uint8_t {
+    /*! the camera is moving: fewer points, smaller image and capped quality so that frames keep up */
+    ER_TIER_MOTION,
+    /*! the camera settled: a single frame with every point, full size and the refined quality */
+    ER_TIER_REFINED,
+    ER_TIER_COUNT,
+};
+
+const char *tier_name(Er_tier tier);
+
+/*!
+ * Two-tier rendering policy of a session, set by the client through the url, see parse_refinement_option.
+ */
+struct Er_refinement_config {
+    /*!
+     * otherwise every frame has full detail and only the jpeg quality goes up when the camera settles;
+     * off unless the client asks for it with refine=1, since motion frames come at a fraction of the size
+     */
+    bool enabled = false;
+    /*! share of the points drawn while moving */
+    float motion_points = 0.25f;
+    /*! divides the width and height of the frames while moving, jpeg only since other codecs keep a fixed size */
+    int motion_scale = 2;
+    /*! cap on the quality picked by the rate controller while moving */
+    int motion_quality = 50;
+    /*! time without camera change after which the refined frame is sent */
+    uint64_t idle_us = 300000;
+    int refined_quality = 95;
+    /*! the refined frame is a lossless png (jpeg sessions only) */
+    bool lossless = false;
+    /*!
+     * Points drawn per frame when refining, 0 to draw them all at once. Larger clouds are refined over several
+     * frames, each drawing the next points over the previous one, so that a refinement never holds the gpu
+     * longer than drawing this many points; the client gets each improving frame.
+     */
+    uint32_t accumulate_points = 0;
+};
+
+/*!
+ * Reads one "key=value" url parameter into config, returns false if it is not a refinement parameter:
+ * refine=0|1|lossless, refine_idle=<ms>, motion_points=<share>, motion_scale=<1|2|4>, motion_quality=<1-100>,
+ * accumulate=<points per frame>.
+ */
+bool parse_refinement_option(const std::string &param, Er_refinement_config &config);
+
+struct Er_tier_stats {
+    uint64_t frames = 0;
+    uint64_t bytes = 0;
+    /*! render, readback and encode time of the frames that were not cached */
+    uint64_t render_us = 0;
+    uint64_t points = 0;
+};
+
+struct Er_accumulation_stats {
+    /*! frames drawing a range of points over the previous one */
+    uint64_t steps = 0;
+    /*! refinements that drew every point, or that a camera move interrupted */
+    uint64_t completed = 0;
+    uint64_t interrupted = 0;
+};
+
+/*!
+ * Picks the draw options and quality of each tier and accounts for the frames sent in each of them.
+ * Not thread safe: belongs to the thread running its session.
+ */
+class Er_refinement {
+public:
+    explicit Er_refinement(Er_refinement_config config = Er_refinement_config()) : er_config(config) {}
+
+    /*!
+     * Draw options of a frame of the tier, for a scene of the given number of points; scalable tells
+     * whether the encoder of the frame accepts images smaller than WIDTH x HEIGHT.
+     */
+    Er_draw_options draw_options(Er_tier tier, size_t points, bool scalable) const;
+    /*! quality of a frame of the tier, from the one the rate controller picked */
+    int quality(Er_tier tier, int rate_quality) const;
+    /*! highest quality the rate controller may pick for a frame of the tier */
+    int quality_cap(Er_tier tier) const;
+
+    /*! whether refined frames of a scene of the given number of points are drawn over several frames */
+    bool accumulates(size_t points) const;
+    /*! draw options of the refinement frame drawing the points after the first accumulated ones */
+    Er_draw_options accumulation_step(uint32_t accumulated) const;
+
+    void on_frame_sent(Er_tier tier, size_t bytes, uint64_t render_us, uint32_t points);
+    /*! an accumulation frame was sent, complete once it drew the last points */
+    void on_accumulation_step(bool complete);
+    void on_accumulation_interrupted() { er_accumulation.interrupted++; }
+
+    const Er_refinement_config &config() const { return er_config; }
+    void set_config(const Er_refinement_config &config) { er_config = config; }
+    const Er_tier_stats &stats(Er_tier tier) const { return er_stats[tier]; }
+    const Er_accumulation_stats &accumulation_stats() const { return er_accumulation; }
+
+private:
+    Er_refinement_config er_config;
+    std::array<Er_tier_stats, ER_TIER_COUNT> er_stats;
+    Er_accumulation_stats er_accumulation;
+};
+
+#endif //ERATOSTHENE_STREAM_REFINEMENT_H
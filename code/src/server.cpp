@@ -1,70 +1,19 @@
 #include "server.h"
+#include "input.h"
+#include "trace.h"
 
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include <stb/stb_image_write.h>
-#include <base64/base64.h>
 
+#include <algorithm>
+#include <cassert>
+#include <cstring>
 #include <vector>
 #include <thread>
 #include <regex>
 
 #include <unistd.h>
 
-#include <nlohmann/json.hpp>
 #include <happly/happly.h>
 
-Vertices debug_vertices = {
-        {{-0.5f, -0.5f, 0.0f}, {1.0f, 0.0f, 0.0f}},
-        {{0.5f, -0.5f, 0.0f}, {0.0f, 1.0f, 0.0f}},
-        {{0.5f, 0.5f, 0.0f}, {0.0f, 0.0f, 1.0f}},
-        {{-0.5f, 0.5f, 0.0f}, {1.0f, 1.0f, 1.0f}},
-
-        {{-0.5f, -0.5f, -0.5f}, {1.0f, 0.0f, 0.0f}},
-        {{0.5f, -0.5f, -0.5f}, {0.0f, 1.0f, 0.0f}},
-        {{0.5f, 0.5f, -0.5f}, {0.0f, 0.0f, 1.0f}},
-        {{-0.5f, 0.5f, -0.5f}, {1.0f, 1.0f, 1.0f}},
-
-        {{-0.6f, -0.6f, -0.6f}, {0.0f, 0.0f, 1.0f}},
-        {{0.6f, 0.6f, 0.6f}, {0.0f, 1.0f, 0.0f}},
-
-        {{0.7f, 0.7f, 0.7f}, {1.0f, 1.0f, 1.0f}},
-};
-
-Indices debug_triangles = {
-        0, 1, 2, 2, 3, 0,
-        4, 5, 6, 6, 7, 4,
-};
-
-Indices debug_lines = {
-        8, 9,
-};
-
-Indices debug_points = {
-        10,
-};
-
-Indices empty = {};
-
-int main(int argc, char **argv) {
-    if (argc == 1) {
-        setup_server(debug_vertices, debug_triangles, debug_lines, debug_points);
-    } else if (argc == 2 || argc == 3) {
-        std::string path(argv[1]);
-        auto v = load_ply_data(path);
-        std::vector<uint32_t> points(v.size());
-        std::generate(points.begin(), points.end(), [n = 0] () mutable { return n++; });
-
-        if (argc == 2)
-            setup_server(v, empty, empty, points);
-        else
-            setup_server(v, empty, empty, points, atoi(argv[2]));
-    } else {
-        printf("Program usage:\n\t > eratosthene-stream [\"path/to/plyfile\"]\n");
-        printf("If no ply file is given as an argument, the application will run with debug data to display on the application.\n");
-        exit(-1);
-    }
-}
-
 /* -------------- Helper methods -------------- */
 
 void split(const std::string& s, char c, std::vector<std::string>& v) {
@@ -83,6 +32,7 @@ void split(const std::string& s, char c, std::vector<std::string>& v) {
 }
 
 Vertices load_ply_data(std::string path) {
+    ER_TRACE_SPAN("load_ply_data");
     std::cout << "Loading ply scene..." << std::endl;
     std::vector<Vertex> vertices;
 
@@ -103,57 +53,138 @@ Vertices load_ply_data(std::string path) {
     return vertices;
 }
 
-void encode_callback(void *context, void *data, int size) {
-    auto image = reinterpret_cast<std::vector<uint8_t>*>(context);
-    auto encoded = reinterpret_cast<uint8_t*>(data);
-    for (int i = 0; i < size; ++i) {
-        image->push_back(encoded[i]);
+Er_client_options parse_client_options(const std::string &uri) {
+    Er_client_options options;
+    auto query = uri.find('?');
+    if (query == std::string::npos) return options;
+
+    std::vector<std::string> params;
+    split(uri.substr(query + 1) + "&", '&', params);
+    for (auto &param : params) {
+        if (param == "encoding=base64") options.binary = false;
+        if (param == "codec=vp8") options.codec = ER_CODEC_VP8;
+        if (param == "codec=tiles") options.codec = ER_CODEC_TILES;
+        if (param.rfind("view=", 0) == 0) options.view = param.substr(5);
+        if (param.rfind("watch=", 0) == 0) options.watch = param.substr(6);
+        if (param == "speculate=1") options.speculate = true;
+        if (param == "depth=1") options.depth = true;
+        if (param == "bands=1") options.bands = true;
+        parse_refinement_option(param, options.refinement);
+        parse_deflate_option(param, options.deflate);
     }
+    // inter-frame and delta codecs need the binary protocol and a build able to encode them
+    if (!options.binary || !encoder_available(options.codec)) {
+        if (options.codec != ER_CODEC_JPEG) {
+            std::cerr << "Requested codec is not available, falling back to jpeg" << std::endl;
+        }
+        options.codec = ER_CODEC_JPEG;
+    }
+    // png frames need the binary header, and delta codecs cannot mix them with their own frames
+    if (!options.binary || options.codec != ER_CODEC_JPEG) {
+        options.refinement.lossless = false;
+        options.bands = false;
+    }
+    return options;
 }
 
 /* ---------- End of helper methods ----------- */
 
 /* ----------- Broadcasting methods ----------- */
 
-void setup_server(Vertices v, Indices t, Indices l, Indices p, int server_port) {
-    // @TODO: enable websocket deflate per message
+void setup_server(Vertices v, Indices t, Indices l, Indices p, int server_port, int metrics_port, size_t warm_engines) {
     ix::WebSocketServer er_server_ws(server_port, STREAM_ADDRESS);
+    // messages are compressed selectively by the sessions, see Er_deflater
+    er_server_ws.disablePerMessageDeflate();
     std::cout << "Listening on " << server_port << std::endl;
+    // scrapes are answered by the threads of the metrics server, reading the counters without locks
+    Er_metrics_server metrics(metrics_port, STREAM_ADDRESS);
+    if (metrics_port != 0 && metrics.start()) std::cout << "Metrics on " << metrics_port << "/metrics" << std::endl;
+    auto cache = std::make_shared<Er_frame_cache>(FRAME_CACHE_BYTES);
+    uint64_t scene = scene_id(v, t, l, p);
+    // engines are created ahead of the clients and those of closed sessions reused, off the accept path
+    auto engines = std::make_shared<Er_engine_pool>(v, t, l, p, warm_engines);
     // server main loop to allow connections
     er_server_ws.setOnConnectionCallback(
-            [&er_server_ws, v, t, l, p](std::shared_ptr<ix::WebSocket> webSocket,
+            [&er_server_ws, cache, scene, engines](std::shared_ptr<ix::WebSocket> webSocket,
                       std::shared_ptr<ix::ConnectionState> connectionState) {
                 // @TODO @FUTURE limit the number of concurrent connections depending on GPU hardware
 
-                // create a private engine for this new connection
-                auto engine = std::make_shared<Er_vk_engine>(v, t, l, p);
+                auto session = std::make_shared<Er_session>();
+                session->connected_us = monotonic_us();
+                session->id = ++Er_metrics::global().sessions_total;
+                session->cache = cache;
+                session->scene_id = scene;
+                session->engines = engines;
 
                 // client renderer in a new thread
-                std::thread t(main_loop, webSocket, connectionState, engine);
-                t.detach();
+                std::thread thread(main_loop, webSocket, connectionState, session);
+                thread.detach();
 
                 // handle client messages (commands to transform the view)
-                webSocket->setOnMessageCallback([connectionState, engine](const ix::WebSocketMessagePtr &msg) {
-                    if (!connectionState->isTerminated() && msg->type == ix::WebSocketMessageType::Message) {
-                        try {
-                        // parse json
-                            auto j = nlohmann::json::parse(msg.get()->str.data());
-                            // @TODO check that json is transform-consistent
-
-                            // create transform of the scene to pass to the engine for further frames redraw
-                            Er_transform new_transform = engine->get_transform();
-
-                            new_transform.rotate_x += (float) j["rotate_x"];
-                            new_transform.rotate_y += (float) j["rotate_y"];
-                            new_transform.rotate_z += (float) j["rotate_z"];
-                            new_transform.translate_camera_x += (float) j["translate_camera_x"];
-                            new_transform.translate_camera_y += (float) j["translate_camera_y"];
-                            new_transform.translate_camera_z += (float) j["translate_camera_z"];
-                            new_transform.zoom += (float) j["zoom"];
-                            engine->set_transform(new_transform);
-                        } catch (std::exception &e) {
-                            std::cerr << "Got a malformed json object :" << std::endl << msg.get()->str << std::endl;
+                webSocket->setOnMessageCallback([connectionState, session](const ix::WebSocketMessagePtr &msg) {
+                    trace_set_session(session->id);
+                    if (msg->type == ix::WebSocketMessageType::Open) {
+                        auto options = parse_client_options(msg->openInfo.uri);
+                        session->binary = options.binary;
+                        if (!options.watch.empty()) {
+                            // spectators only send the frames of the controller of the view
+                            session->view = join_view_group(options.watch);
+                            session->spectator = true;
+                            session->view->spectators++;
+                        } else {
+                            session->encoder = create_encoder(options.codec, WIDTH, HEIGHT);
+                            session->deflater = std::make_unique<Er_deflater>(options.deflate);
+                            session->buffers = std::make_unique<Er_buffer_pool>(2, Er_vk_engine::er_imagedata_size / 8);
+                            session->refinement.set_config(options.refinement);
+                            if (options.refinement.lossless) session->lossless_encoder = create_encoder(ER_CODEC_PNG, WIDTH, HEIGHT);
+                            if (options.bands) session->band_encoder = std::make_unique<Er_band_encoder>(default_band_threads());
+                            // cached and speculated frames come without the depth of their pose
+                            session->depth = options.depth && options.binary;
+                            session->speculate = options.speculate && options.codec == ER_CODEC_JPEG && !session->depth;
+                            if (!options.view.empty()) {
+                                auto group = join_view_group(options.view);
+                                if (group->claim_controller()) {
+                                    session->view = group;
+                                } else {
+                                    std::cerr << "View " << options.view << " already has a controller, rendering a private view" << std::endl;
+                                }
+                            }
+                        }
+                        session->open = true;
+                    } else if (!connectionState->isTerminated() && msg->type == ix::WebSocketMessageType::Message) {
+                        Er_input input;
+                        if (!decode_input(msg->str.data(), msg->str.size(), msg->binary, input)) {
+                            std::cerr << "Got a malformed client message of " << msg->str.size() << " bytes" << std::endl;
+                            return;
+                        }
+                        uint64_t now_us = monotonic_us();
+                        if (input.type == ER_INPUT_ACK) {
+                            session->rate.on_ack(input.frame_id, input.hold_us, now_us);
+                            // acks may arrive out of order, the window only moves forward, up to the last frame sent
+                            uint32_t acked = session->acked_frame_id;
+                            while (input.frame_id > acked && input.frame_id <= session->frame_id
+                                   && !session->acked_frame_id.compare_exchange_weak(acked, input.frame_id)) {}
+                            session->acked_us = now_us;
+                            // closes the stages of the frame, which arrive with the client ack
+                            uint64_t sent_us, input_us;
+                            if (session->sent_frames.find(input.frame_id, sent_us, input_us)) {
+                                session->latency.record(ER_STAGE_DISPLAY, now_us - sent_us);
+                                session->latency.record(ER_STAGE_CLIENT, input.hold_us);
+                                if (input_us != 0) session->latency.record(ER_STAGE_INPUT_TO_DISPLAY, now_us - input_us);
+                            }
+                            return;
                         }
+
+                        if (session->spectator) return;
+                        if (input.timestamp != 0) {
+                            uint64_t received_us = timestamp_us();
+                            if (received_us >= input.timestamp && received_us - input.timestamp < ER_MAX_UPLINK_US) {
+                                session->latency.record(ER_STAGE_UPLINK, received_us - input.timestamp);
+                            }
+                        }
+                        // the main loop applies all the inputs received since its last frame at once
+                        std::lock_guard<std::mutex> lock(session->input_mutex);
+                        coalesce_input(session->pending_input, input, now_us);
                     }
                 });
             }
@@ -172,41 +203,519 @@ void setup_server(Vertices v, Indices t, Indices l, Indices p, int server_port)
     er_server_ws.wait();
 }
 
+/*!
+ * Whether the session may send another frame: the socket backlog must stay bounded and, for clients
+ * acknowledging frames, at most ER_MAX_FRAMES_IN_FLIGHT frames may wait for their acknowledgment.
+ */
+static bool window_open(Er_session &session, size_t backlog_bytes, uint64_t last_sent_us, uint64_t now_us) {
+    if (backlog_bytes > ER_MAX_BACKLOG_BYTES) return false;
+    if (!session.binary || !session.frame_window) return true;
+    if (session.frame_id - session.acked_frame_id < ER_MAX_FRAMES_IN_FLIGHT) return true;
+    if (now_us - std::max(last_sent_us, session.acked_us.load()) < ER_ACK_TIMEOUT_US) return false;
+
+    if (session.acked_frame_id == 0) {
+        std::cout << "Client does not acknowledge frames, only the socket backlog is bounded" << std::endl;
+        session.frame_window = false;
+    } else {
+        // the frames or their acks were lost: the next frame must not depend on them
+        session.acked_frame_id = session.frame_id.load();
+        if (session.spectator) {
+            session.view->request_key_frame();
+        } else {
+            session.encoder->request_key_frame();
+        }
+    }
+    return true;
+}
+
+/*!
+ * Main loop of a spectator: sends the newest frame of the watched view whenever its own window allows it,
+ * the view being rendered and encoded once by the controller session.
+ */
+static void spectator_loop(std::shared_ptr<ix::WebSocket> webSocket,
+                           std::shared_ptr<ix::ConnectionState> connectionState,
+                           std::shared_ptr<Er_session> session) {
+    auto view = session->view;
+    uint64_t last_sent_us = 0;
+    // controller of the view whose frames the spectator sends, none yet
+    uint32_t controller = 0;
+
+    while (!connectionState->isTerminated()) {
+        uint64_t now_us = monotonic_us();
+        bool binary;
+        uint32_t frame_id;
+        uint32_t previous_controller = controller;
+        Er_buffer message;
+        if (window_open(*session, webSocket->bufferedAmount(), last_sent_us, now_us)) {
+            message = view->newest(session->frame_id, controller, binary, frame_id);
+        }
+        if (message == nullptr) {
+            usleep(1000);
+            continue;
+        }
+        // frames are encoded once, for the controller: a spectator must have asked for the same encoding
+        if (binary != session->binary) {
+            release_buffer(message);
+            std::cerr << "Spectator of view " << view->name() << " asked for " << (session->binary ? "binary" : "base64")
+                      << " frames but the controller streams " << (binary ? "binary" : "base64") << " ones" << std::endl;
+            webSocket->close(ER_CLOSE_ENCODING_MISMATCH, "spectators must use the encoding of the controller");
+            break;
+        }
+        if (controller != previous_controller) {
+            // a new controller numbers its frames from 1: the window starts over at its first frame sent
+            session->frame_id = frame_id - 1;
+            session->acked_frame_id = frame_id - 1;
+            session->acked_us = now_us;
+        }
+        if (frame_id > session->frame_id + 1) {
+            session->frames_skipped += frame_id - session->frame_id - 1;
+            Er_metrics::global().frames_dropped.fetch_add(frame_id - session->frame_id - 1, std::memory_order_relaxed);
+        }
+        session->frame_id = frame_id;
+        if (binary) {
+            webSocket->sendBinary(*message);
+        } else {
+            webSocket->sendText(*message);
+        }
+        size_t size = message->size();
+        // the controller may reuse the buffer from here on
+        release_buffer(message);
+        session->frames_sent++;
+        session->bytes_sent += size;
+        Er_metrics::global().frames_sent.fetch_add(1, std::memory_order_relaxed);
+        Er_metrics::global().bytes_sent.fetch_add(size, std::memory_order_relaxed);
+        last_sent_us = now_us;
+    }
+    view->spectators--;
+    Er_metrics::global().spectators--;
+    std::cout << "Spectator of view " << view->name() << " closed after " << session->frames_sent << " frames, "
+              << session->frames_skipped << " skipped while lagging" << std::endl;
+}
+
+/*!
+ * Sends the depth map of the frame just sent with the given header, returns the size of the message.
+ */
+static size_t send_depth(ix::WebSocket &webSocket, Er_session &session, const Er_frame_header &frame,
+                         const Er_transform &camera) {
+    Er_buffer message = session.buffers->acquire();
+    Er_frame_header header = frame;
+    header.codec = ER_CODEC_DEPTH;
+    header.flags = ER_FRAME_FLAG_KEY;
+    message->append(reinterpret_cast<char*>(&header), sizeof(header));
+    session.depth_stream.encode(*session.engine, camera, *message);
+    if (session.deflater->deflate_message(*message, sizeof(header), ER_MESSAGE_DEPTH)) {
+        header.flags |= ER_FRAME_FLAG_DEFLATE;
+    }
+    header.timestamp = timestamp_us();
+    memcpy(&(*message)[0], &header, sizeof(header));
+    webSocket.sendBinary(*message);
+    return message->size();
+}
+
 void main_loop(std::shared_ptr<ix::WebSocket> webSocket,
                std::shared_ptr<ix::ConnectionState> connectionState,
-               std::shared_ptr<Er_vk_engine> engine) {
-    Er_transform last_transform = {.rotate_z =  0.0f};
-    engine->set_transform(last_transform);
+               std::shared_ptr<Er_session> session) {
+    // wait for the handshake so the first frame is not lost and the client options are known
+    while (!session->open) {
+        if (connectionState->isTerminated()) return;
+        usleep(1000);
+    }
+    Er_metrics &metrics = Er_metrics::global();
+    trace_set_session(session->id);
+    if (session->spectator) {
+        metrics.spectators++;
+        spectator_loop(webSocket, connectionState, session);
+        return;
+    }
+    metrics.sessions++;
+    // taken by the session thread: the websocket threads never wait for an engine, even a cold one
+    session->engine = session->engines->acquire(&session->warm_engine);
+    auto engine = session->engine;
+    Er_transform camera = {.rotate_z =  0.0f};
+    Er_transform last_transform = camera;
+    engine->set_transform(camera);
+    // highest input sequence number included in the camera, and reception of the oldest input not yet rendered
+    uint32_t input_sequence = 0;
+    uint64_t unrendered_input_us = 0;
     bool drew_once = false;
+    // the last frame was re-sent at idle quality since the camera stopped
+    bool refined = false;
+    int last_quality = 0;
+    // the last frame was drawn with fewer points or at a smaller size
+    bool last_reduced = false;
+    // points drawn so far by the accumulation refining the current camera
+    uint32_t accumulated = 0;
+    uint64_t last_change_us = monotonic_us();
+    uint64_t last_sent_us = 0;
+    uint64_t stall_start_us = 0;
+    Er_transform speculated_pose;
+    size_t buffer_bytes = 0;
 
     while (!connectionState->isTerminated()) {
+        Er_pending_input input;
+        {
+            std::lock_guard<std::mutex> lock(session->input_mutex);
+            std::swap(input, session->pending_input);
+        }
+        if (input.count > 0) {
+            Er_transform previous = camera;
+            apply_input(input, camera);
+            // deltas that are finite one by one may still add up to an infinity
+            if (!transform_finite(camera)) camera = previous;
+            session->speculator.observe(previous, camera);
+            input_sequence = std::max(input_sequence, input.sequence);
+            session->inputs_received += input.count;
+            if (unrendered_input_us == 0) unrendered_input_us = input.received_us;
+        }
+        uint64_t now_us = monotonic_us();
+        if (input.count > 0) session->latency.record(ER_STAGE_INPUT, now_us - input.received_us);
+        bool changed = camera != last_transform || !drew_once;
+        bool accumulating = accumulated > 0 && accumulated < engine->point_count();
+        if (changed) {
+            last_change_us = now_us;
+            refined = false;
+            // any move restarts the refinement from the new camera
+            if (accumulating) session->refinement.on_accumulation_interrupted();
+            accumulating = false;
+            accumulated = 0;
+        }
+        // once the camera rests and the socket drained, the frame is sent again at a higher quality
+        bool caught_up = webSocket->bufferedAmount() == 0
+                && (!session->binary || !session->frame_window || session->acked_frame_id == session->frame_id);
+        bool idle = !changed && !refined && caught_up && now_us - last_change_us > session->refinement.config().idle_us;
+        // the next points of an accumulation are drawn once the client received the previous frame
+        bool accumulate_step = accumulating && caught_up;
+        // while the client lags behind, camera changes are coalesced: once the window opens
+        // again only the newest state is rendered
+        if (changed && !window_open(*session, webSocket->bufferedAmount(), last_sent_us, now_us)) {
+            if (stall_start_us == 0) {
+                stall_start_us = now_us;
+                session->stalls++;
+                metrics.stalls.fetch_add(1, std::memory_order_relaxed);
+            }
+            usleep(1000);
+            continue;
+        }
+        if (stall_start_us != 0) {
+            session->stall_us += now_us - stall_start_us;
+            stall_start_us = 0;
+        }
+        int quality = 0;
+        Er_tier tier = idle || accumulate_step ? ER_TIER_REFINED : ER_TIER_MOTION;
+        Er_encoder *encoder = session->encoder.get();
+        if (accumulate_step) {
+            quality = last_quality;
+            if (session->lossless_encoder) encoder = session->lossless_encoder.get();
+        }
+        if (changed || idle) {
+            int rate_quality = session->rate.next_quality(webSocket->bufferedAmount(), idle,
+                                                          session->refinement.quality_cap(tier));
+            quality = session->refinement.quality(tier, rate_quality);
+            if (idle) {
+                refined = true;
+                if (tier == ER_TIER_REFINED && session->lossless_encoder) {
+                    encoder = session->lossless_encoder.get();
+                } else if (!last_reduced && quality <= last_quality) {
+                    continue;
+                }
+                // tiles did not change, only their quality does
+                session->encoder->request_key_frame();
+            }
+        }
         // only draw new image if it has been modified since last draw
-        if (engine->get_transform() != last_transform || !drew_once) {
+        if (changed || idle || accumulate_step) {
+            ER_TRACE_SPAN("frame");
+            uint64_t frame_start_us = monotonic_us();
+            // payload ready to be sent, rendered and encoded or taken from a cache
+            uint64_t encoded_us = 0;
             drew_once = true;
-            last_transform = engine->get_transform();
-            // prepare memory for image
-            VkSubresourceLayout layout;
-            char* imagedata = (char*) malloc(Er_vk_engine::er_imagedata_size);
-
-            // render the image and output it to memory
-            engine->draw_frame(imagedata, layout);
-
-            // encode image for web
-            std::vector<uint8_t> encodedData;
-            stbi_write_jpg_to_func(encode_callback, reinterpret_cast<void*>(&encodedData), WIDTH, HEIGHT, 4, imagedata,  30);
-//            stbi_write_bmp_to_func(encode_callback, reinterpret_cast<void*>(&encodedData), WIDTH, HEIGHT, 4, imagedata);
-            auto b64 = base64_encode(encodedData.data(), encodedData.size());
-            auto result = b64.data();
+            last_transform = camera;
+            last_quality = quality;
+            size_t points = engine->point_count();
+            Er_draw_options draw = session->refinement.draw_options(tier, points, encoder->codec() == ER_CODEC_JPEG);
+            // refinements of large clouds draw the next range of points over the previous frame
+            bool accumulation = tier == ER_TIER_REFINED && session->refinement.accumulates(points);
+            if (accumulation) draw = session->refinement.accumulation_step(accumulated);
+            bool partial = accumulation && draw.first_point + std::min<size_t>(draw.point_count, points) < points;
+            // only the frame completing a refinement is lossless
+            Er_codec key_codec = encoder->codec();
+            if (partial) encoder = session->encoder.get();
+            Er_codec codec = encoder->codec();
+            // jpeg frames encoded band by band during their readback are sent as full-width tiles
+            bool banded = session->band_encoder && codec == ER_CODEC_JPEG;
+            if (banded) {
+                codec = ER_CODEC_TILES;
+                if (key_codec == ER_CODEC_JPEG) key_codec = ER_CODEC_TILES;
+            }
+            int width = WIDTH / draw.scale, height = HEIGHT / draw.scale;
+            last_reduced = partial || (!accumulation && !(draw == Er_draw_options()));
+            uint64_t render_us = 0;
+            // encode image for web straight into a pooled buffer, right behind the binary frame header
+            Er_buffer message = session->buffers->acquire();
+            Er_frame_header header;
+            message->append(reinterpret_cast<char*>(&header), sizeof(header));
+
+            // frames of independent images seen before are reused as they are, from any session: an accumulation
+            // looks up the frame it would complete with before drawing its first points
+            Er_frame_key key(session->scene_id, width, height, key_codec, quality, camera,
+                             accumulation ? UINT32_MAX : draw.point_count);
+            bool cached = false;
+            if (changed && session->speculate) {
+                // the speculated frame keeps the quality it was encoded with, and has full detail
+                Er_buffer speculated = session->speculator.take(camera, quality);
+                if (speculated != nullptr) {
+                    message->append(*speculated);
+                    cached = true;
+                    last_quality = quality;
+                    codec = session->encoder->codec();
+                    width = WIDTH;
+                    height = HEIGHT;
+                    last_reduced = false;
+                }
+            }
+            if (!cached && (key_codec == ER_CODEC_JPEG || key_codec == ER_CODEC_PNG || banded) && !session->depth
+                    && (!accumulation || accumulated == 0)) {
+                cached = session->cache->find(key, *message);
+                (cached ? metrics.cache_hits : metrics.cache_misses).fetch_add(1, std::memory_order_relaxed);
+                if (cached) codec = key_codec;
+                if (cached && accumulation) {
+                    accumulated = points;
+                    last_reduced = false;
+                }
+            }
+            if (cached) {
+                header.flags = ER_FRAME_FLAG_KEY;
+                encoded_us = monotonic_us();
+            } else {
+                auto render_start = std::chrono::steady_clock::now();
+                engine->set_transform(camera);
+                // render the image, it stays readable in the engine readback buffer until the next draw
+                const char *imagedata = banded ? engine->render_frame(draw) : engine->draw_frame(draw);
+
+                // a spectator joined or lagged behind a delta codec
+                if (session->view && session->view->take_key_frame_request()) {
+                    session->encoder->request_key_frame();
+                }
+                auto encode_start = std::chrono::steady_clock::now();
+                if (banded) {
+                    header.flags = session->band_encoder->encode(*engine, imagedata, quality, *message);
+                } else {
+                    encoder->set_quality(quality);
+                    header.flags = encoder->encode(imagedata, width, height, *message);
+                }
+                auto encode_end = std::chrono::steady_clock::now();
+                encoded_us = monotonic_us();
+                session->encode_us += std::chrono::duration_cast<std::chrono::microseconds>(encode_end - encode_start).count();
+                const Er_frame_timing &timing = engine->last_frame_timing();
+                session->latency.record(ER_STAGE_SUBMIT, timing.submitted_us - std::min(frame_start_us, timing.submitted_us));
+                session->latency.record(ER_STAGE_GPU, timing.done_us - timing.submitted_us);
+                if (timing.render_us > 0) session->latency.record(ER_STAGE_GPU_RENDER, (uint64_t) timing.render_us);
+                if (timing.copy_us > 0) session->latency.record(ER_STAGE_GPU_COPY, (uint64_t) timing.copy_us);
+                metrics.frames_rendered.fetch_add(1, std::memory_order_relaxed);
+                metrics.frames_encoded.fetch_add(1, std::memory_order_relaxed);
+                metrics.gpu_vertices.fetch_add(timing.vertices, std::memory_order_relaxed);
+                metrics.gpu_vertex_invocations.fetch_add(timing.vertex_invocations, std::memory_order_relaxed);
+                metrics.gpu_clipping_primitives.fetch_add(timing.clipping_primitives, std::memory_order_relaxed);
+                session->latency.record(ER_STAGE_ENCODE, encoded_us - std::min(timing.done_us, encoded_us));
+                render_us = std::chrono::duration_cast<std::chrono::microseconds>(encode_end - render_start).count();
+                if ((codec == ER_CODEC_JPEG || codec == ER_CODEC_PNG || banded) && !partial) {
+                    // copied before the message is deflated, into a buffer the cache reuses once evicted
+                    Er_buffer payload = session->cache->acquire(message->size() - sizeof(header));
+                    payload->append(*message, sizeof(header), std::string::npos);
+                    session->cache->insert(key, std::move(payload), render_us);
+                }
+                if (accumulation) {
+                    accumulated = std::min<size_t>(draw.first_point + std::min<size_t>(draw.point_count, points), points);
+                    session->refinement.on_accumulation_step(!partial);
+                }
+            }
 
             // send image data to client
-            webSocket->send(result);
-
-            // cleanup
-            free(imagedata);
+            header.frame_id = ++session->frame_id;
+            Er_buffer sent = message;
+            if (session->binary) {
+                ER_TRACE_SPAN("send");
+                header.codec = codec;
+                header.timestamp = timestamp_us();
+                header.width = width;
+                header.height = height;
+                header.input_sequence = input_sequence;
+                if (session->deflater->deflate_message(*message, sizeof(header), message_type(codec))) {
+                    header.flags |= ER_FRAME_FLAG_DEFLATE;
+                }
+                memcpy(&(*message)[0], &header, sizeof(header));
+                webSocket->sendBinary(*message);
+            } else {
+                ER_TRACE_SPAN("send");
+                Er_buffer text = session->buffers->acquire();
+                base64_encode_into(reinterpret_cast<unsigned char*>(&(*message)[sizeof(header)]), message->size() - sizeof(header), *text);
+                uint64_t base64_us = monotonic_us();
+                session->latency.record(ER_STAGE_BASE64, base64_us - encoded_us);
+                encoded_us = base64_us;
+                session->deflater->deflate_message(*text, 0, ER_MESSAGE_BASE64);
+                webSocket->sendText(*text);
+                sent = text;
+            }
+            session->latency.record(ER_STAGE_SEND, monotonic_us() - encoded_us);
+            // spectators send the very same buffer, never touched again until the pool gets it back
+            if (session->view) {
+                session->view->publish(sent, session->binary, session->frame_id, header.flags & ER_FRAME_FLAG_KEY);
+            }
+            // the depth of a new pose follows its frame, refinements keep the pose the client already has
+            size_t depth_bytes = 0;
+            if (session->depth && changed) {
+                depth_bytes = send_depth(*webSocket, *session, header, camera);
+                session->depth_stream.on_sent(depth_bytes, message->size());
+            }
+            session->frames_sent++;
+            session->bytes_sent += message->size();
+            if (session->frames_sent == 1) {
+                uint64_t first_frame_us = monotonic_us() - session->connected_us;
+                session->latency.record(ER_STAGE_FIRST_FRAME, first_frame_us);
+                if (first_frame_us > ER_FIRST_FRAME_TARGET_US) {
+                    metrics.first_frames_late.fetch_add(1, std::memory_order_relaxed);
+                    std::cerr << "First frame of session " << session->id << " sent after " << first_frame_us / 1000
+                              << " ms with a " << (session->warm_engine ? "warm" : "cold") << " engine" << std::endl;
+                }
+            }
+            metrics.frames_sent.fetch_add(1, std::memory_order_relaxed);
+            metrics.bytes_sent.fetch_add(message->size() + depth_bytes, std::memory_order_relaxed);
+            last_sent_us = monotonic_us();
+            session->sent_frames.on_sent(session->frame_id, last_sent_us, unrendered_input_us);
+            if (unrendered_input_us != 0) {
+                session->latency.record(ER_STAGE_INPUT_TO_SENT, last_sent_us - unrendered_input_us);
+                session->input_latency_us += last_sent_us - unrendered_input_us;
+                session->frames_with_input++;
+                unrendered_input_us = 0;
+            }
+            session->rate.on_frame_sent(session->frame_id, message->size() + depth_bytes, quality, last_sent_us,
+                                        (float) (width * height) / (WIDTH * HEIGHT));
+            session->refinement.on_frame_sent(tier, message->size(), render_us,
+                                              std::min<size_t>(draw.point_count, engine->point_count()));
+            // buffers only grow, and rarely once the pool is warm
+            size_t capacity = session->buffers->capacity();
+            if (capacity != buffer_bytes) {
+                session->memory.add_host(ER_HOST_BUFFERS, (int64_t) capacity - (int64_t) buffer_bytes);
+                buffer_bytes = capacity;
+            }
+        } else if (session->speculate && !accumulating && session->speculator.next_pose(camera, speculated_pose)) {
+            ER_TRACE_SPAN("speculate");
+            // speculated frames are drawn in the attachments an accumulation draws over
+            // nothing to send: render a likely next pose, a single one per iteration so that inputs come first
+            engine->set_transform(speculated_pose);
+            const char *imagedata = engine->draw_frame();
+            Er_buffer payload = session->speculator.acquire();
+            session->encoder->set_quality(last_quality);
+            session->encoder->encode(imagedata, WIDTH, HEIGHT, *payload);
+            session->speculator.store(speculated_pose, payload, last_quality);
+            metrics.frames_rendered.fetch_add(1, std::memory_order_relaxed);
+            metrics.frames_encoded.fetch_add(1, std::memory_order_relaxed);
+        } else if (session->deflater->deflate_sample()) {
+            // a message kept for the compression stats was measured instead of waiting
         } else {
             usleep(1000);
         }
     }
+    metrics.sessions--;
+    session->memory.add_host(ER_HOST_BUFFERS, -(int64_t) buffer_bytes);
+    if (session->view) {
+        session->view->release_controller();
+        std::cout << "Controller of view " << session->view->name() << " left " << session->view->spectators
+                  << " spectators" << std::endl;
+    }
+    std::cout << "Session closed after " << session->frames_sent << " frames, "
+              << session->buffers->allocations() << " buffer allocations";
+    if (session->frames_sent > 0) {
+        const char *codec_names[] = {"jpeg", "vp8", "tiles"};
+        std::cout << ", " << codec_names[session->encoder->codec()] << " average of "
+                  << session->bytes_sent / session->frames_sent << " bytes and "
+                  << session->encode_us / session->frames_sent << " us of encoding per frame";
+        Er_rate_stats rate = session->rate.stats();
+        std::cout << ", quality " << rate.quality << " (" << rate.quality_up << " up, " << rate.quality_down
+                  << " down, " << rate.congestion_drops << " congestion drops, " << rate.idle_boosts
+                  << " idle refinements), " << (uint64_t) rate.bandwidth_bps / 1000 << " kbps and "
+                  << (uint64_t) rate.rtt_us / 1000 << " ms rtt estimated, " << session->stalls
+                  << " stalls on a slow client for " << session->stall_us / 1000 << " ms";
+    }
+    if (session->frames_with_input > 0) {
+        std::cout << ", " << session->inputs_received << " inputs coalesced into " << session->frames_with_input
+                  << " frames, " << session->input_latency_us / session->frames_with_input / 1000.f
+                  << " ms from input to frame sent";
+    }
+    std::cout << std::endl;
+    for (int tier = 0; tier < ER_TIER_COUNT; ++tier) {
+        auto &stats = session->refinement.stats(static_cast<Er_tier>(tier));
+        if (stats.frames == 0) continue;
+        std::cout << "  " << tier_name(static_cast<Er_tier>(tier)) << " tier: " << stats.frames << " frames, average of "
+                  << stats.bytes / stats.frames << " bytes, " << stats.points / stats.frames << " points and "
+                  << stats.render_us / stats.frames << " us of rendering and encoding" << std::endl;
+    }
+    if (session->band_encoder && session->band_encoder->stats().frames > 0) {
+        auto &bands = session->band_encoder->stats();
+        std::cout << "  bands: " << bands.frames << " frames, " << bands.readback_encode_us / bands.frames
+                  << " us from rendered to encoded of which " << bands.wait_us / bands.frames
+                  << " us waiting for the readback" << std::endl;
+    }
+    for (int stage = 0; stage < ER_STAGE_COUNT; ++stage) {
+        auto &histogram = session->latency.histogram(static_cast<Er_stage>(stage));
+        if (histogram.count() == 0) continue;
+        std::cout << "  " << stage_name(static_cast<Er_stage>(stage)) << " latency: " << histogram.count()
+                  << " frames, p50 " << histogram.percentile(0.5) << ", p90 " << histogram.percentile(0.9)
+                  << ", p99 " << histogram.percentile(0.99) << " and max " << histogram.max() << " us" << std::endl;
+    }
+    auto &accumulation = session->refinement.accumulation_stats();
+    if (accumulation.steps > 0) {
+        std::cout << "  accumulation: " << accumulation.steps << " frames, " << accumulation.completed
+                  << " refinements completed and " << accumulation.interrupted << " interrupted by camera moves" << std::endl;
+    }
+    auto &gpu = engine->gpu_stats();
+    if (gpu.frames > 0) {
+        std::cout << "  gpu: " << gpu.frames << " submissions, " << gpu.render_us / gpu.frames << " us rendering, "
+                  << gpu.copy_us / gpu.frames << " us copying, " << gpu.submit_to_done_us / gpu.frames
+                  << " us from submission to readback" << std::endl;
+        if (gpu.vertices > 0) {
+            std::cout << "  pipeline: " << gpu.vertices / gpu.frames << " vertices, " << gpu.vertex_invocations / gpu.frames
+                      << " vertex shader invocations and " << gpu.clipping_primitives / gpu.frames
+                      << " primitives out of clipping per frame" << std::endl;
+        }
+    }
+    std::cout << "  engine: " << (session->warm_engine ? "warm" : "cold") << std::endl;
+    auto &memory = engine->memory();
+    std::cout << "  device memory: " << memory.device_total() / 1024 << " KiB";
+    for (int category = 0; category < ER_MEMORY_CATEGORY_COUNT; ++category) {
+        std::cout << (category == 0 ? " (" : ", ") << memory.device_bytes(static_cast<Er_memory_category>(category)) / 1024
+                  << " KiB " << memory_category_name(static_cast<Er_memory_category>(category));
+    }
+    std::cout << "), " << buffer_bytes / 1024 << " KiB of message buffers" << std::endl;
+    if (session->depth && session->depth_stream.stats().maps > 0) {
+        auto &depth = session->depth_stream.stats();
+        std::cout << "  depth: " << depth.maps << " maps, " << 100 * depth.depth_bytes / std::max<uint64_t>(depth.color_bytes, 1)
+                  << "% of the color bytes, downsampled by " << session->depth_stream.factor() << " ("
+                  << depth.factor_up << " up, " << depth.factor_down << " down), "
+                  << depth.read_us / depth.maps << " us of readback per map" << std::endl;
+    }
+    if (session->speculate) {
+        auto &speculation = session->speculator.stats();
+        std::cout << "  speculation: " << speculation.speculated << " frames rendered ahead, " << speculation.hits
+                  << " hits and " << speculation.misses << " misses on camera moves, " << speculation.wasted
+                  << " frames wasted" << std::endl;
+    }
+    Er_frame_cache_stats cache = session->cache->stats();
+    std::cout << "  frame cache: " << cache.hits << " hits, " << cache.misses << " misses, " << cache.entries
+              << " frames in " << cache.bytes / 1024 << " KB, " << cache.evictions << " evictions, "
+              << cache.saved_us / 1000 << " ms of rendering and encoding saved, " << cache.allocations
+              << " buffer allocations" << std::endl;
+    for (int type = 0; type < ER_MESSAGE_TYPE_COUNT; ++type) {
+        auto &stats = session->deflater->stats(static_cast<Er_message_type>(type));
+        if (stats.input_bytes == 0) continue;
+        std::cout << "  deflate " << message_type_name(static_cast<Er_message_type>(type)) << ": "
+                  << stats.compressed << " of " << stats.messages << " messages compressed, " << stats.sampled
+                  << " sampled, " << 100 * stats.output_bytes / stats.input_bytes << "% of the size for "
+                  << stats.cpu_us * 1000000 / stats.input_bytes << " us of cpu per MB" << std::endl;
+    }
+    // only the main loop uses the engine, which is either kept for the next session or destroyed here
+    session->engine.reset();
+    session->engines->release(std::move(engine));
 }
 
 /* -------- End of broadcasting methods ------- */
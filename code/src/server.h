@@ -5,16 +5,23 @@
 #include <ixwebsocket/IXWebSocketServer.h>
 
 #include "engine.h"
+#include "session.h"
+#include "metrics.h"
 
-const char* STREAM_ADDRESS = "127.0.0.1";
+const char *const STREAM_ADDRESS = "127.0.0.1";
 const int STREAM_PORT = 8080;
+/*! websocket close code of a spectator asking for another encoding than the one of the controller */
+const uint16_t ER_CLOSE_ENCODING_MISMATCH = 4000;
+/*! memory of the encoded frames cache shared by all the sessions */
+const size_t FRAME_CACHE_BYTES = 64 * 1024 * 1024;
 
-void setup_server(Vertices v, Indices t, Indices l, Indices p, int server_port = STREAM_PORT);
+void setup_server(Vertices v, Indices t, Indices l, Indices p, int server_port = STREAM_PORT,
+                  int metrics_port = METRICS_PORT, size_t warm_engines = ER_WARM_ENGINES);
 void close_server();
 Vertices load_ply_data(std::string path);
 
 void main_loop(std::shared_ptr<ix::WebSocket> webSocket,
         std::shared_ptr<ix::ConnectionState> connectionState,
-        std::shared_ptr<Er_vk_engine> engine);
+        std::shared_ptr<Er_session> session);
 
 #endif //ERATOSTHENE_STREAM_SERVER_H
@@ -0,0 +1,124 @@
+#ifndef ERATOSTHENE_STREAM_SESSION_H
+#define ERATOSTHENE_STREAM_SESSION_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#include "engine.h"
+#include "protocol.h"
+#include "buffer_pool.h"
+#include "encoder.h"
+#include "rate_control.h"
+#include "compression.h"
+#include "input.h"
+#include "view_group.h"
+#include "frame_cache.h"
+#include "speculation.h"
+#include "depth.h"
+#include "refinement.h"
+#include "banding.h"
+#include "latency.h"
+#include "memory.h"
+#include "engine_pool.h"
+
+/*! frames sent but not yet acknowledged by the client after which rendering pauses */
+const uint32_t ER_MAX_FRAMES_IN_FLIGHT = 2;
+/*! bytes waiting in the socket after which rendering pauses, whether the client acknowledges frames or not */
+const size_t ER_MAX_BACKLOG_BYTES = 4 * 1024 * 1024;
+/*! delay after which unacknowledged frames are assumed lost, so that a lost ack cannot stall the stream */
+const uint64_t ER_ACK_TIMEOUT_US = 1000000;
+
+/*!
+ * State of a single client connection, shared between the websocket callback thread
+ * and the thread running the session main loop.
+ */
+struct Er_session {
+    /*! number of the session within the server, from 1 */
+    uint32_t id = 0;
+
+    /*! private rendering engine of this client, taken from the engine pool with the encoder, spectators have none */
+    std::shared_ptr<Er_vk_engine> engine;
+    /*! engines of the server, the engine goes back to it when the session closes */
+    std::shared_ptr<Er_engine_pool> engines;
+    /*! the engine was warm when the session took it */
+    bool warm_engine = false;
+    /*! connection of the client, for the time to its first frame */
+    uint64_t connected_us = 0;
+
+    /*! encoded frames shared by all the sessions of the server, and the scene they show */
+    std::shared_ptr<Er_frame_cache> cache;
+    uint64_t scene_id = 0;
+
+    /*! view shared with other clients, either controlled or watched by this session */
+    std::shared_ptr<Er_view_group> view;
+    bool spectator = false;
+    /*! frames of the view a spectator did not receive because it was lagging */
+    uint64_t frames_skipped = 0;
+
+    /*! set once the websocket handshake is done and the client options are known */
+    std::atomic<bool> open{false};
+    std::atomic<bool> binary{true};
+
+    /*! created by the websocket thread before the session is marked open, then only used by the main loop */
+    std::unique_ptr<Er_encoder> encoder;
+    /*! encodes the refined frames of jpeg sessions that asked for lossless ones, null otherwise */
+    std::unique_ptr<Er_encoder> lossless_encoder;
+    /*! encodes the jpeg frames of sessions that asked for bands during their readback, null otherwise */
+    std::unique_ptr<Er_band_encoder> band_encoder;
+
+    /*! reduced detail while the camera moves, full detail once it settles, only touched by the main loop */
+    Er_refinement refinement;
+
+    /*!
+     * id of the last frame sent, written by the main loop and read by the websocket thread, which ignores acks
+     * of frames not sent yet: for spectators, those of the previous controller of the view
+     */
+    std::atomic<uint32_t> frame_id{0};
+    uint64_t frames_sent = 0;
+    uint64_t bytes_sent = 0;
+    uint64_t encode_us = 0;
+
+    /*! newest frame displayed by the client, and when its acknowledgment was received */
+    std::atomic<uint32_t> acked_frame_id{0};
+    std::atomic<uint64_t> acked_us{0};
+    /*! cleared for clients that never acknowledge frames, only touched by the main loop */
+    bool frame_window = true;
+    uint64_t stalls = 0;
+    uint64_t stall_us = 0;
+
+    /*! camera inputs not yet taken by the main loop, merged by the websocket thread */
+    std::mutex input_mutex;
+    Er_pending_input pending_input;
+
+    /*! latency between the reception of inputs and the sending of the first frame including them */
+    uint64_t input_latency_us = 0;
+    uint64_t inputs_received = 0;
+    uint64_t frames_with_input = 0;
+
+    /*! time spent in each stage of the frames, also recorded in the server-wide histograms */
+    Er_latency latency{&Er_latency::global()};
+    Er_sent_frames sent_frames;
+
+    /*! picks the quality of each frame from the client acknowledgments */
+    Er_rate_controller rate;
+
+    /*! renders ahead while the client is idle if enabled, only touched by the main loop */
+    bool speculate = false;
+    Er_speculator speculator;
+
+    /*! sends the depth map of each new frame if enabled, only touched by the main loop */
+    bool depth = false;
+    Er_depth_stream depth_stream;
+
+    /*!
+     * compresses the messages worth it, and reusable buffers receiving the encoded frames: created with the
+     * encoder, spectators send the messages of the controller as they are and have neither
+     */
+    std::unique_ptr<Er_deflater> deflater;
+    std::unique_ptr<Er_buffer_pool> buffers;
+    /*! host memory of the session, the capacity of its buffers as of the last frame sent */
+    Er_memory_accounting memory{&Er_memory_accounting::global()};
+};
+
+#endif //ERATOSTHENE_STREAM_SESSION_H
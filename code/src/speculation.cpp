@@ -0,0 +1,88 @@
+#include "speculation.h"
+#include "metrics.h"
+
+#include <cmath>
+
+// the web client moves the camera by this much per key press
+const float DEFAULT_STEP = 0.5f;
+// at most this many poses are rendered ahead for a camera
+const size_t MAX_SPECULATIONS = 4;
+// poses closer than this are considered the same, as in the frame cache
+const float POSE_TOLERANCE = 1e-4f;
+
+static Er_transform add(const Er_transform &a, const Er_transform &b) {
+    return {a.rotate_x + b.rotate_x, a.rotate_y + b.rotate_y, a.rotate_z + b.rotate_z,
+            a.translate_camera_x + b.translate_camera_x, a.translate_camera_y + b.translate_camera_y,
+            a.translate_camera_z + b.translate_camera_z, a.zoom + b.zoom};
+}
+
+static Er_transform subtract(const Er_transform &a, const Er_transform &b) {
+    return add(a, {-b.rotate_x, -b.rotate_y, -b.rotate_z, -b.translate_camera_x, -b.translate_camera_y,
+                   -b.translate_camera_z, -b.zoom});
+}
+
+static bool same_pose(const Er_transform &a, const Er_transform &b) {
+    Er_transform d = subtract(a, b);
+    for (float value : {d.rotate_x, d.rotate_y, d.rotate_z, d.translate_camera_x, d.translate_camera_y,
+                        d.translate_camera_z, d.zoom}) {
+        if (std::fabs(value) > POSE_TOLERANCE) return false;
+    }
+    return true;
+}
+
+Er_speculator::Er_speculator() : er_buffers(MAX_SPECULATIONS, 0) {
+    // arrow keys: rotation around z and zoom
+    er_steps = {{.rotate_z = DEFAULT_STEP}, {.rotate_z = -DEFAULT_STEP}, {.zoom = DEFAULT_STEP}, {.zoom = -DEFAULT_STEP}};
+}
+
+void Er_speculator::observe(const Er_transform &from, const Er_transform &to) {
+    Er_transform step = subtract(to, from);
+    if (same_pose(step, Er_transform())) return;
+    // held keys repeat the same step, then users come back: the step and its opposite come first
+    Er_transform opposite = subtract(Er_transform(), step);
+    for (auto it = er_steps.begin(); it != er_steps.end();) {
+        it = same_pose(*it, step) || same_pose(*it, opposite) ? er_steps.erase(it) : it + 1;
+    }
+    er_steps.insert(er_steps.begin(), {step, opposite});
+    if (er_steps.size() > MAX_SPECULATIONS) er_steps.resize(MAX_SPECULATIONS);
+}
+
+bool Er_speculator::next_pose(const Er_transform &camera, Er_transform &pose) {
+    if (er_next_step >= er_steps.size()) return false;
+    pose = add(camera, er_steps[er_next_step++]);
+    return true;
+}
+
+Er_buffer Er_speculator::acquire() {
+    return er_buffers.acquire();
+}
+
+void Er_speculator::store(const Er_transform &pose, Er_buffer payload, int quality) {
+    er_speculations.push_back({pose, std::move(payload), quality});
+    er_stats.speculated++;
+}
+
+Er_buffer Er_speculator::take(const Er_transform &camera, int &quality) {
+    Er_metrics &metrics = Er_metrics::global();
+    Er_buffer payload = nullptr;
+    for (auto &speculation : er_speculations) {
+        if (payload == nullptr && same_pose(speculation.pose, camera)) {
+            payload = speculation.payload;
+            quality = speculation.quality;
+        } else {
+            er_stats.wasted++;
+            metrics.speculation_wasted.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    // only count moves the speculation had a chance to anticipate
+    if (payload != nullptr) {
+        er_stats.hits++;
+        metrics.speculation_hits.fetch_add(1, std::memory_order_relaxed);
+    } else if (!er_speculations.empty()) {
+        er_stats.misses++;
+        metrics.speculation_misses.fetch_add(1, std::memory_order_relaxed);
+    }
+    er_speculations.clear();
+    er_next_step = 0;
+    return payload;
+}
@@ -0,0 +1,63 @@
+#ifndef ERATOSTHENE_STREAM_SPECULATION_H
+#define ERATOSTHENE_STREAM_SPECULATION_H
+
+#include <vector>
+#include <cstdint>
+
+#include "engine.h"
+#include "buffer_pool.h"
+
+struct Er_speculation_stats {
+    /*! frames rendered ahead of the inputs */
+    uint64_t speculated = 0;
+    /*! camera changes served by a speculated frame, or not */
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    /*! speculated frames thrown away unused */
+    uint64_t wasted = 0;
+};
+
+/*!
+ * Guesses the next camera poses of a session from the steps its client made so far (the keyboard moves
+ * the camera by fixed steps) so that the main loop can render them while it would otherwise wait for
+ * input. Speculated frames live until the camera moves; the one matching the new camera is sent at once,
+ * the others are dropped. Not thread safe: belongs to the thread running its session.
+ */
+class Er_speculator {
+public:
+    Er_speculator();
+
+    /*! learns from each camera move made by the client */
+    void observe(const Er_transform &from, const Er_transform &to);
+
+    /*! next pose worth rendering around the camera, false once all of them were rendered */
+    bool next_pose(const Er_transform &camera, Er_transform &pose);
+
+    /*! a buffer to encode the frame of the pose returned by next_pose into */
+    Er_buffer acquire();
+    void store(const Er_transform &pose, Er_buffer payload, int quality);
+
+    /*!
+     * The camera moved: returns the frame speculated for it (and its quality) or nullptr,
+     * and cancels every other speculation.
+     */
+    Er_buffer take(const Er_transform &camera, int &quality);
+
+    const Er_speculation_stats &stats() const { return er_stats; }
+
+private:
+    struct Speculation {
+        Er_transform pose;
+        Er_buffer payload;
+        int quality;
+    };
+
+    /*! camera moves by decreasing likelihood */
+    std::vector<Er_transform> er_steps;
+    size_t er_next_step = 0;
+    std::vector<Speculation> er_speculations;
+    Er_buffer_pool er_buffers;
+    Er_speculation_stats er_stats;
+};
+
+#endif //ERATOSTHENE_STREAM_SPECULATION_H
@@ -0,0 +1,169 @@
+#include "tiles.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+const uint64_t HASH_PRIME = 0x9E3779B185EBCA87ULL;
+const uint32_t HASH_PRIME32 = 0x9E3779B1U;
+
+/* ---------------- Tile hashing ---------------- */
+
+#if defined(__SSE2__)
+// xxh3-like accumulation of 16 bytes into two 64 bit lanes, the key varies with the position in the row
+static inline __m128i hash_accumulate(__m128i acc, __m128i data, __m128i key) {
+    __m128i dataKey = _mm_xor_si128(data, key);
+    __m128i dataKeyLo = _mm_shuffle_epi32(dataKey, _MM_SHUFFLE(0, 3, 0, 1));
+    __m128i product = _mm_mul_epu32(dataKey, dataKeyLo);
+    __m128i dataSwap = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+    return _mm_add_epi64(product, _mm_add_epi64(acc, dataSwap));
+}
+
+uint64_t hash_tile(const uint8_t *rgba, size_t stride, int width, int height) {
+    const size_t rowBytes = width * 4;
+    const __m128i firstKey = _mm_set_epi32(0x7c01812c, 0xf721ad1c, 0xded46de9, 0x839097b7);
+    const __m128i keyStep = _mm_set1_epi32(0x6b43a9b5);
+    const __m128i prime = _mm_set1_epi32(HASH_PRIME32);
+    __m128i acc = _mm_set_epi64x(height, width);
+
+    for (int y = 0; y < height; ++y) {
+        const uint8_t *row = rgba + y * stride;
+        __m128i key = firstKey;
+        size_t i = 0;
+        for (; i + 16 <= rowBytes; i += 16) {
+            acc = hash_accumulate(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i)), key);
+            key = _mm_add_epi32(key, keyStep);
+        }
+        if (i < rowBytes) {
+            alignas(16) uint8_t tail[16] = {};
+            memcpy(tail, row + i, rowBytes - i);
+            acc = hash_accumulate(acc, _mm_load_si128(reinterpret_cast<const __m128i*>(tail)), key);
+        }
+        // scramble between rows so that the hash depends on their order
+        acc = _mm_xor_si128(acc, _mm_srli_epi64(acc, 47));
+        __m128i lo = _mm_mul_epu32(acc, prime);
+        __m128i hi = _mm_mul_epu32(_mm_srli_epi64(acc, 32), prime);
+        acc = _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+    }
+
+    alignas(16) uint64_t lanes[2];
+    _mm_store_si128(reinterpret_cast<__m128i*>(lanes), acc);
+    uint64_t hash = lanes[0] ^ (lanes[1] * HASH_PRIME);
+    return hash ^ (hash >> 32);
+}
+#else
+uint64_t hash_tile(const uint8_t *rgba, size_t stride, int width, int height) {
+    const size_t rowBytes = width * 4;
+    uint64_t hash = (uint64_t) width * HASH_PRIME ^ height;
+    for (int y = 0; y < height; ++y) {
+        const uint8_t *row = rgba + y * stride;
+        size_t i = 0;
+        for (; i + 8 <= rowBytes; i += 8) {
+            uint64_t word;
+            memcpy(&word, row + i, 8);
+            hash = (hash ^ word) * HASH_PRIME;
+        }
+        for (; i < rowBytes; ++i) {
+            hash = (hash ^ row[i]) * HASH_PRIME;
+        }
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+#endif
+
+/* ------------ End of tile hashing ------------- */
+
+
+/* ---------------- Tile encoding ---------------- */
+
+uint8_t Er_tile_encoder::encode(const char *rgba, int width, int height, std::string &output) {
+    ER_TRACE_SPAN("tile_encode");
+    if (width != er_width || height != er_height) {
+        er_width = width;
+        er_height = height;
+        er_columns = (width + ER_TILE_SIZE - 1) / ER_TILE_SIZE;
+        er_rows = (height + ER_TILE_SIZE - 1) / ER_TILE_SIZE;
+        er_client_hashes.assign(er_columns * er_rows, 0);
+        er_hashes.assign(er_columns * er_rows, 0);
+        er_changed.assign(er_columns * er_rows, true);
+        er_scratch.resize((size_t) width * ER_TILE_SIZE * 4);
+        er_key_frame = true;
+    }
+
+    const size_t stride = (size_t) width * 4;
+    int changed = 0;
+    for (int row = 0; row < er_rows; ++row) {
+        for (int col = 0; col < er_columns; ++col) {
+            int x = col * ER_TILE_SIZE, y = row * ER_TILE_SIZE;
+            int index = row * er_columns + col;
+            er_hashes[index] = hash_tile(reinterpret_cast<const uint8_t*>(rgba) + y * stride + x * 4, stride,
+                                         std::min(ER_TILE_SIZE, width - x), std::min(ER_TILE_SIZE, height - y));
+            er_changed[index] = er_key_frame || er_hashes[index] != er_client_hashes[index];
+            changed += er_changed[index];
+        }
+    }
+
+    size_t countOffset = output.size();
+    uint16_t count = 0;
+    output.append(sizeof(count), '\0');
+
+    // past half of the tiles, the per-image jpeg headers cost more than re-sending the unchanged tiles
+    bool full = er_key_frame || changed * 2 > er_columns * er_rows;
+    if (full) {
+        encode_rect(rgba, 0, 0, width, height, output);
+        count = 1;
+        er_tiles_encoded += er_columns * er_rows;
+    } else {
+        for (int row = 0; row < er_rows; ++row) {
+            int col = 0;
+            while (col < er_columns) {
+                if (!er_changed[row * er_columns + col]) {
+                    col++;
+                    continue;
+                }
+                int first = col;
+                while (col < er_columns && er_changed[row * er_columns + col]) col++;
+                int x = first * ER_TILE_SIZE, y = row * ER_TILE_SIZE;
+                encode_rect(rgba, x, y, std::min((col - first) * ER_TILE_SIZE, width - x),
+                            std::min(ER_TILE_SIZE, height - y), output);
+                count++;
+                er_tiles_encoded += col - first;
+            }
+        }
+    }
+    memcpy(&output[countOffset], &count, sizeof(count));
+
+    er_client_hashes.swap(er_hashes);
+    er_key_frame = false;
+    return full ? ER_FRAME_FLAG_KEY : 0;
+}
+
+void Er_tile_encoder::encode_rect(const char *rgba, int x, int y, int width, int height, std::string &output) {
+    const size_t stride = (size_t) er_width * 4;
+    const char *pixels = rgba + y * stride + x * 4;
+    // full rows are already contiguous, narrower rectangles are packed into the scratch buffer
+    if (width != er_width) {
+        for (int row = 0; row < height; ++row) {
+            memcpy(&er_scratch[row * width * 4], pixels + row * stride, width * 4);
+        }
+        pixels = er_scratch.data();
+    }
+
+    Er_tile_entry entry;
+    entry.x = x;
+    entry.y = y;
+    entry.width = width;
+    entry.height = height;
+    size_t entryOffset = output.size();
+    output.append(reinterpret_cast<char*>(&entry), sizeof(entry));
+    er_jpeg.encode(pixels, width, height, output);
+    entry.size = output.size() - entryOffset - sizeof(entry);
+    memcpy(&output[entryOffset], &entry, sizeof(entry));
+}
+
+/* ------------ End of tile encoding ------------ */
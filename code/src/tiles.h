@@ -0,0 +1,47 @@
+#ifndef ERATOSTHENE_STREAM_TILES_H
+#define ERATOSTHENE_STREAM_TILES_H
+
+#include <vector>
+
+#include "encoder.h"
+
+/*!
+ * Hashes a rectangle of an RGBA image whose rows are stride bytes apart. Meant to detect changed
+ * tiles between two frames, not to resist collisions crafted on purpose.
+ */
+uint64_t hash_tile(const uint8_t *rgba, size_t stride, int width, int height);
+
+/*!
+ * Delta encoder: the frame is split into ER_TILE_SIZE tiles, and only the tiles whose hash differs
+ * from what the client currently displays are jpeg encoded and sent, merged into horizontal runs.
+ * When most of the frame changed, a single rectangle covering the whole frame is sent instead.
+ */
+class Er_tile_encoder : public Er_encoder {
+public:
+    explicit Er_tile_encoder(int quality) : er_jpeg(quality) {}
+    Er_codec codec() const override { return ER_CODEC_TILES; }
+    uint8_t encode(const char *rgba, int width, int height, std::string &output) override;
+    void request_key_frame() override { er_key_frame = true; }
+    void set_quality(int quality) override { er_jpeg.set_quality(quality); }
+
+    uint64_t tiles_encoded() const { return er_tiles_encoded; }
+
+private:
+    Er_jpeg_encoder er_jpeg;
+    int er_width = 0;
+    int er_height = 0;
+    int er_columns = 0;
+    int er_rows = 0;
+    /*! hashes of the tiles as displayed by the client, and of the frame being encoded */
+    std::vector<uint64_t> er_client_hashes;
+    std::vector<uint64_t> er_hashes;
+    std::vector<bool> er_changed;
+    /*! contiguous copy of a run of tiles, the jpeg encoder cannot read strided images */
+    std::vector<char> er_scratch;
+    bool er_key_frame = true;
+    uint64_t er_tiles_encoded = 0;
+
+    void encode_rect(const char *rgba, int x, int y, int width, int height, std::string &output);
+};
+
+#endif //ERATOSTHENE_STREAM_TILES_H
@@ -0,0 +1,155 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+#include "utils.h"
+
+std::atomic<bool> er_trace_enabled{false};
+
+struct Er_trace_event {
+    const char *name;
+    uint64_t start_us;
+    uint32_t duration_us;
+    uint32_t session;
+};
+
+/*! ring of the spans of a thread, written by that thread only and handed to a new thread once it exits */
+struct Er_trace_buffer {
+    uint32_t tid = 0;
+    bool in_use = false;
+    std::atomic<uint64_t> head{0};
+    Er_trace_event events[ER_TRACE_EVENTS];
+};
+
+// guards the list and the ownership of the buffers, never taken by a span once its thread has a buffer
+static std::mutex buffers_mutex;
+static std::vector<Er_trace_buffer *> buffers;
+static uint32_t next_tid = 1;
+
+struct Er_trace_owner {
+    Er_trace_buffer *buffer = nullptr;
+    ~Er_trace_owner() {
+        if (buffer == nullptr) return;
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        buffer->in_use = false;
+    }
+};
+
+static thread_local Er_trace_owner owner;
+static thread_local uint32_t session_id = 0;
+
+static std::atomic<bool> dump_requested{false};
+
+static Er_trace_buffer &thread_buffer() {
+    if (owner.buffer == nullptr) {
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        for (auto buffer : buffers) {
+            if (!buffer->in_use) {
+                owner.buffer = buffer;
+                break;
+            }
+        }
+        if (owner.buffer == nullptr) {
+            owner.buffer = new Er_trace_buffer();
+            buffers.push_back(owner.buffer);
+        }
+        // the spans of the previous thread are dropped, dumps run under the same lock
+        owner.buffer->in_use = true;
+        owner.buffer->tid = next_tid++;
+        owner.buffer->head.store(0, std::memory_order_relaxed);
+    }
+    return *owner.buffer;
+}
+
+static void on_signal(int) {
+    dump_requested = true;
+}
+
+static void write_dump() {
+    static int dumps = 0;
+    std::string path = "eratosthene-trace-" + std::to_string(getpid()) + "-" + std::to_string(dumps++) + ".json";
+    std::ofstream file(path);
+    file << trace_dump();
+    std::cout << "Trace written to " << path << std::endl;
+}
+
+void trace_start() {
+    er_trace_enabled = true;
+}
+
+void trace_stop() {
+    er_trace_enabled = false;
+}
+
+void trace_set_session(uint32_t session) {
+    session_id = session;
+}
+
+void Er_trace_span::begin(const char *name) {
+    er_name = name;
+    er_start_us = monotonic_us();
+}
+
+void Er_trace_span::end() {
+    Er_trace_buffer &buffer = thread_buffer();
+    uint64_t head = buffer.head.load(std::memory_order_relaxed);
+    buffer.events[head % ER_TRACE_EVENTS] = {er_name, er_start_us, (uint32_t) (monotonic_us() - er_start_us), session_id};
+    buffer.head.store(head + 1, std::memory_order_release);
+}
+
+std::string trace_dump() {
+    std::ostringstream out;
+    int pid = getpid();
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    std::vector<Er_trace_event> events;
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    for (auto buffer : buffers) {
+        uint64_t head = buffer->head.load(std::memory_order_acquire);
+        uint64_t begin = head > ER_TRACE_EVENTS ? head - ER_TRACE_EVENTS : 0;
+        events.clear();
+        for (uint64_t i = begin; i < head; ++i) events.push_back(buffer->events[i % ER_TRACE_EVENTS]);
+        // spans written during the copy may have overwritten the oldest ones: the slot of the span being
+        // written, at index head, is the one of index head - ER_TRACE_EVENTS. The fence keeps the copy above
+        // from being reordered after this load, which an acquire load alone does not prevent
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t written = buffer->head.load(std::memory_order_relaxed);
+        uint64_t valid = written >= ER_TRACE_EVENTS ? written - ER_TRACE_EVENTS + 1 : 0;
+
+        out << (first ? "" : ",") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":"
+            << buffer->tid << ",\"args\":{\"name\":\"thread " << buffer->tid << "\"}}";
+        first = false;
+        for (uint64_t i = std::max(begin, valid); i < head; ++i) {
+            const Er_trace_event &event = events[i - begin];
+            out << ",{\"name\":\"" << event.name << "\",\"cat\":\"er\",\"ph\":\"X\",\"ts\":" << event.start_us
+                << ",\"dur\":" << event.duration_us << ",\"pid\":" << pid << ",\"tid\":" << buffer->tid
+                << ",\"args\":{\"session\":" << event.session << "}}";
+        }
+    }
+    out << "]}";
+    return out.str();
+}
+
+void trace_install() {
+    if (getenv("ER_TRACE") != nullptr) {
+        trace_start();
+        std::cout << "Tracing enabled, send SIGUSR1 to write the trace" << std::endl;
+    }
+    signal(SIGUSR1, on_signal);
+    // files are not written from the signal handler
+    std::thread([] {
+        while (true) {
+            if (dump_requested.exchange(false)) write_dump();
+            usleep(100000);
+        }
+    }).detach();
+}
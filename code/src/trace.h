@@ -0,0 +1,63 @@
+#ifndef ERATOSTHENE_STREAM_TRACE_H
+#define ERATOSTHENE_STREAM_TRACE_H
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+
+/*! spans kept per thread, the oldest ones are overwritten */
+const uint32_t ER_TRACE_EVENTS = 16384;
+
+/*
+ * Opt-in timeline of the hot functions, exported in the Chrome trace event format (chrome://tracing, Perfetto).
+ * Spans are written by their thread into its own ring buffer without any lock; a dump copies the rings while
+ * they are being written and drops the spans overwritten meanwhile. Builds without ER_WITH_TRACING compile
+ * the spans out, otherwise a disabled span costs one relaxed load and a branch.
+ */
+
+extern std::atomic<bool> er_trace_enabled;
+
+/*! starts recording, a dump then holds the spans recorded since (and before any previous stop) */
+void trace_start();
+void trace_stop();
+/*! id of the session the spans of the calling thread belong to, 0 for none */
+void trace_set_session(uint32_t session);
+/*! the spans of all the threads as a Chrome trace JSON document */
+std::string trace_dump();
+/*!
+ * Starts recording if the ER_TRACE environment variable is set, and writes a dump to
+ * eratosthene-trace-<pid>-<n>.json in the working directory on each SIGUSR1.
+ */
+void trace_install();
+
+/*!
+ * Records the time spent in its scope under name, which must outlive the process (a string literal).
+ */
+class Er_trace_span {
+public:
+    explicit Er_trace_span(const char *name) {
+        if (er_trace_enabled.load(std::memory_order_relaxed)) begin(name);
+    }
+    ~Er_trace_span() {
+        if (er_name != nullptr) end();
+    }
+    Er_trace_span(const Er_trace_span &) = delete;
+    Er_trace_span &operator=(const Er_trace_span &) = delete;
+
+private:
+    const char *er_name = nullptr;
+    uint64_t er_start_us = 0;
+
+    void begin(const char *name);
+    void end();
+};
+
+#define ER_TRACE_CONCAT_(a, b) a##b
+#define ER_TRACE_CONCAT(a, b) ER_TRACE_CONCAT_(a, b)
+#ifdef ER_WITH_TRACING
+#define ER_TRACE_SPAN(name) Er_trace_span ER_TRACE_CONCAT(er_trace_span_, __LINE__)(name)
+#else
+#define ER_TRACE_SPAN(name) do {} while (0)
+#endif
+
+#endif //ERATOSTHENE_STREAM_TRACE_H
@@ -2,6 +2,8 @@
 
 #include <cstring>
 
+#include "trace.h"
+
 VkResult create_debug(VkInstance &instance, const VkDebugUtilsMessengerCreateInfoEXT* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkDebugUtilsMessengerEXT* pDebugMessenger) {
     auto func = (PFN_vkCreateDebugUtilsMessengerEXT) vkGetInstanceProcAddr(instance, "vkCreateDebugUtilsMessengerEXT");
     if (func != nullptr) {
@@ -18,6 +20,13 @@ void destroy_debug(VkInstance &instance, VkDebugUtilsMessengerEXT &debugMessenge
     }
 }
 
+void destroy_debug_report(VkInstance instance, VkDebugReportCallbackEXT callback, const VkAllocationCallbacks *pAllocator) {
+    auto func = (PFN_vkDestroyDebugReportCallbackEXT) vkGetInstanceProcAddr(instance, "vkDestroyDebugReportCallbackEXT");
+    if (func != nullptr) {
+        func(instance, callback, pAllocator);
+    }
+}
+
 bool check_validation_layers_support(const std::vector<const char *> &layers) {
     uint32_t layerCount;
     vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
@@ -38,6 +47,24 @@ bool check_validation_layers_support(const std::vector<const char *> &layers) {
     return true;
 }
 
+bool check_extension_support(VkPhysicalDevice device, const char *extension) {
+    uint32_t extensionCount = 0;
+    std::vector<VkExtensionProperties> availableExtensions;
+    if (device == VK_NULL_HANDLE) {
+        vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+        availableExtensions.resize(extensionCount);
+        vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, availableExtensions.data());
+    } else {
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+        availableExtensions.resize(extensionCount);
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+    }
+    for (const auto &properties : availableExtensions) {
+        if (strcmp(extension, properties.extensionName) == 0) return true;
+    }
+    return false;
+}
+
 std::vector<char> readFile(const std::string& filename) {
     std::ifstream file(filename, std::ios::ate | std::ios::binary);
 
@@ -63,4 +90,30 @@ void encode_image(const char* data, size_t size, unsigned char *output) {
     output[0] = 0x42; output[1] = 0x4D;
     memcpy(&total_size, &output[2], 4);
 
-}
\ No newline at end of file
+}
+
+void base64_encode_into(const unsigned char *data, size_t size, std::string &output) {
+    ER_TRACE_SPAN("base64");
+    static const char chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    // resize once and write in place, so that a buffer with enough capacity is never reallocated
+    size_t offset = output.size();
+    output.resize(offset + 4 * ((size + 2) / 3));
+    char *out = &output[offset];
+
+    size_t i = 0;
+    for (; i + 2 < size; i += 3) {
+        uint32_t triple = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+        *out++ = chars[(triple >> 18) & 0x3F];
+        *out++ = chars[(triple >> 12) & 0x3F];
+        *out++ = chars[(triple >> 6) & 0x3F];
+        *out++ = chars[triple & 0x3F];
+    }
+    if (i < size) {
+        uint32_t triple = data[i] << 16;
+        if (i + 1 < size) triple |= data[i + 1] << 8;
+        *out++ = chars[(triple >> 18) & 0x3F];
+        *out++ = chars[(triple >> 12) & 0x3F];
+        *out++ = i + 1 < size ? chars[(triple >> 6) & 0x3F] : '=';
+        *out++ = '=';
+    }
+}
@@ -8,6 +8,7 @@
 #include <stdexcept>
 #include <fstream>
 #include <iostream>
+#include <chrono>
 
 typedef uint32_t uint32;
 
@@ -19,8 +20,19 @@ typedef uint32_t uint32;
 
 VkResult create_debug(VkInstance &instance, const VkDebugUtilsMessengerCreateInfoEXT* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkDebugUtilsMessengerEXT* pDebugMessenger);
 void destroy_debug(VkInstance &instance, VkDebugUtilsMessengerEXT &debugMessenger, const VkAllocationCallbacks* pAllocator);
+/*! vkDestroyDebugReportCallbackEXT, loaded from the instance */
+void destroy_debug_report(VkInstance instance, VkDebugReportCallbackEXT callback, const VkAllocationCallbacks *pAllocator);
 bool check_validation_layers_support(const std::vector<const char *> &layers);
+/*! whether the instance (device is null) or the device supports the extension */
+bool check_extension_support(VkPhysicalDevice device, const char *extension);
 std::vector<char> readFile(const std::string& filename);
+
+/*! microseconds on a monotonic clock, for durations only */
+inline uint64_t monotonic_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 void encode_image(const char* imagedata, size_t datasize, unsigned char* output);
+void base64_encode_into(const unsigned char *data, size_t size, std::string &output);
 
 #endif //ERATOSTHENE_STREAM_UTILS_H
@@ -0,0 +1,63 @@
+#include "view_group.h"
+
+#include <map>
+
+bool Er_view_group::claim_controller() {
+    std::lock_guard<std::mutex> lock(er_mutex);
+    if (er_controlled) return false;
+    er_controlled = true;
+    er_controller++;
+    // frames of a previous controller cannot be followed by the new ones
+    er_message = nullptr;
+    return true;
+}
+
+void Er_view_group::release_controller() {
+    std::lock_guard<std::mutex> lock(er_mutex);
+    er_controlled = false;
+}
+
+void Er_view_group::publish(Er_buffer message, bool binary, uint32_t frameId, bool key_frame) {
+    std::lock_guard<std::mutex> lock(er_mutex);
+    er_message = std::move(message);
+    er_binary = binary;
+    er_frame_id = frameId;
+    er_key_frame = key_frame;
+    frames_published++;
+}
+
+Er_buffer Er_view_group::newest(uint32_t lastFrameId, uint32_t &controller, bool &binary, uint32_t &frameId) {
+    std::lock_guard<std::mutex> lock(er_mutex);
+    bool same_controller = controller == er_controller;
+    if (er_message == nullptr || (same_controller && er_frame_id == lastFrameId)) return nullptr;
+    // every jpeg frame is a key frame, delta frames can only follow the frame they were encoded against
+    if ((!same_controller || er_frame_id != lastFrameId + 1) && !er_key_frame) {
+        er_key_frame_requested = true;
+        return nullptr;
+    }
+    controller = er_controller;
+    binary = er_binary;
+    frameId = er_frame_id;
+    // under the lock the controller replaces the message with, so it sees the hold before reusing it
+    hold_buffer(er_message);
+    return er_message;
+}
+
+/* ---------------- Registry ---------------- */
+
+static std::mutex er_groups_mutex;
+static std::map<std::string, std::weak_ptr<Er_view_group>> er_groups;
+
+std::shared_ptr<Er_view_group> join_view_group(const std::string &name) {
+    std::lock_guard<std::mutex> lock(er_groups_mutex);
+    auto group = er_groups[name].lock();
+    if (group == nullptr) {
+        group = std::make_shared<Er_view_group>(name);
+        er_groups[name] = group;
+    }
+    // forget the groups nobody uses anymore
+    for (auto it = er_groups.begin(); it != er_groups.end();) {
+        it = it->second.expired() ? er_groups.erase(it) : std::next(it);
+    }
+    return group;
+}
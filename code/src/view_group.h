@@ -0,0 +1,60 @@
+#ifndef ERATOSTHENE_STREAM_VIEW_GROUP_H
+#define ERATOSTHENE_STREAM_VIEW_GROUP_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "buffer_pool.h"
+
+/*!
+ * A view shared by a controller session and any number of spectator sessions. The controller renders
+ * and encodes each frame once and publishes the encoded message; every spectator sends the newest
+ * published message at its own pace, by reference, so that slow spectators only skip frames.
+ */
+class Er_view_group {
+public:
+    explicit Er_view_group(std::string name) : er_name(std::move(name)) {}
+
+    const std::string &name() const { return er_name; }
+
+    /*! makes the calling session the controller, returns false if the view already has one */
+    bool claim_controller();
+    void release_controller();
+
+    /*! the message must not be modified afterwards, spectators send it as is */
+    void publish(Er_buffer message, bool binary, uint32_t frameId, bool key_frame);
+
+    /*!
+     * Newest message published after frame lastFrameId of the given controller, or nullptr. Spectators that
+     * skipped frames, or whose controller changed, only get key frames, and ask the controller for one.
+     * controller is set to the one that published the message: each controller that claims the view numbers
+     * its frames from 1. The message is held for the spectator, which calls release_buffer once it sent it.
+     */
+    Er_buffer newest(uint32_t lastFrameId, uint32_t &controller, bool &binary, uint32_t &frameId);
+
+    /*! set by spectators that need a key frame, taken by the controller before encoding */
+    void request_key_frame() { er_key_frame_requested = true; }
+    bool take_key_frame_request() { return er_key_frame_requested.exchange(false); }
+
+    std::atomic<uint32_t> spectators{0};
+    std::atomic<uint64_t> frames_published{0};
+
+private:
+    std::string er_name;
+    std::mutex er_mutex;
+    bool er_controlled = false;
+    /*! controllers that claimed the view so far, the current one being the last */
+    uint32_t er_controller = 0;
+    Er_buffer er_message;
+    bool er_binary = true;
+    bool er_key_frame = false;
+    uint32_t er_frame_id = 0;
+    std::atomic<bool> er_key_frame_requested{false};
+};
+
+/*! the group with the given name, created on first use and kept while some session uses it */
+std::shared_ptr<Er_view_group> join_view_group(const std::string &name);
+
+#endif //ERATOSTHENE_STREAM_VIEW_GROUP_H
@@ -0,0 +1,239 @@
+#include "server.h"
+#include "engine_pool.h"
+#include "handles.h"
+#include "memory.h"
+
+#include <ixwebsocket/IXWebSocket.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+/*
+ * Soak test of the engine lifetime: takes and gives back engines, or connects and disconnects whole sessions,
+ * for many iterations and checks that the device memory, the host memory and the vulkan objects accounted
+ * globally are back to what they were once the engines settle. What the accounting does not see (threads,
+ * zlib streams, socket buffers, driver allocations) is checked on the resident memory of the process and, with
+ * VK_EXT_memory_budget, the heap usage the driver reports: neither may keep growing over the second half of the
+ * iterations, once the allocators and the frame cache warmed up. Exits with 1 on a leak.
+ * Run from the code directory, where the engines find their shaders.
+ */
+
+const int CHURN_POOL_ITERATIONS = 2000;
+const int CHURN_SESSION_ITERATIONS = 5000;
+const int CHURN_PORT = 8090;
+/*! how long the warm engines and the closed sessions may take to settle */
+const auto CHURN_SETTLE_TIMEOUT = std::chrono::seconds(60);
+/*! growth of the resident memory and of the driver heap usage over the second half taken for allocator noise */
+const int64_t CHURN_RSS_SLACK = 8 * 1024 * 1024;
+const int64_t CHURN_DRIVER_SLACK = 8 * 1024 * 1024;
+
+struct Er_churn_totals {
+    int64_t device_bytes;
+    int64_t host_bytes;
+    int64_t vk_objects;
+    /*! resident memory of the process, and heap usage reported by the driver (-1 without VK_EXT_memory_budget) */
+    int64_t rss_bytes;
+    int64_t driver_bytes;
+
+    /*! the accounted totals only, which must be back exactly */
+    bool operator==(const Er_churn_totals &other) const {
+        return device_bytes == other.device_bytes && host_bytes == other.host_bytes && vk_objects == other.vk_objects;
+    }
+};
+
+static int64_t resident_bytes() {
+    long pages = 0, resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm == nullptr) return -1;
+    if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) resident = -1;
+    fclose(statm);
+    return resident < 0 ? -1 : (int64_t) resident * sysconf(_SC_PAGESIZE);
+}
+
+static int64_t driver_usage() {
+    int64_t usage = 0;
+    for (auto &heap : Er_vk_engine::heap_budgets()) {
+        if (!heap.from_driver) return -1;
+        usage += (int64_t) heap.usage;
+    }
+    return usage;
+}
+
+/*! the frame cache lives as long as the server and fills up with the poses of the sessions, up to its size */
+static Er_churn_totals totals() {
+    const Er_memory_accounting &memory = Er_memory_accounting::global();
+    return {memory.device_total(), memory.host_total() - memory.host_bytes(ER_HOST_CACHE), vk_object_count(),
+            resident_bytes(), driver_usage()};
+}
+
+static void print_totals(const char *label, const Er_churn_totals &t) {
+    printf("%-9s %14lld device bytes %14lld host bytes %8lld vulkan objects %14lld resident bytes "
+           "%14lld driver bytes\n", label, (long long) t.device_bytes, (long long) t.host_bytes, (long long) t.vk_objects,
+           (long long) t.rss_bytes, (long long) t.driver_bytes);
+}
+
+static bool wait_for(const std::function<bool()> &settled) {
+    auto deadline = std::chrono::steady_clock::now() + CHURN_SETTLE_TIMEOUT;
+    while (!settled()) {
+        if (std::chrono::steady_clock::now() > deadline) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return true;
+}
+
+/*!
+ * Compares the accounted totals once back to the baseline or after the timeout, and the growth of the resident
+ * and driver memory since half, the totals once settled halfway through the iterations. Prints all three.
+ */
+static int check_baseline(const Er_churn_totals &baseline, const Er_churn_totals &half,
+                          const std::function<bool()> &settled) {
+    bool back = wait_for([&] { return settled() && totals() == baseline; });
+    Er_churn_totals after = totals();
+    print_totals("baseline", baseline);
+    print_totals("half", half);
+    print_totals("after", after);
+    int leaks = 0;
+    if (!back) {
+        printf("LEAK: the accounted totals did not return to the baseline\n");
+        leaks++;
+    }
+    if (after.rss_bytes - half.rss_bytes > CHURN_RSS_SLACK) {
+        printf("LEAK: the resident memory grew by %lld bytes over the second half\n",
+               (long long) (after.rss_bytes - half.rss_bytes));
+        leaks++;
+    }
+    if (half.driver_bytes >= 0 && after.driver_bytes - half.driver_bytes > CHURN_DRIVER_SLACK) {
+        printf("LEAK: the driver heap usage grew by %lld bytes over the second half\n",
+               (long long) (after.driver_bytes - half.driver_bytes));
+        leaks++;
+    }
+    if (half.driver_bytes < 0) printf("No VK_EXT_memory_budget: the driver heap usage is not checked\n");
+    if (leaks > 0) return 1;
+    printf("OK\n");
+    return 0;
+}
+
+/*! a cube of points, enough for every frame to read back and encode a full image */
+static std::vector<Vertex> point_cube(int side) {
+    std::vector<Vertex> vertices;
+    for (int x = 0; x < side; ++x) {
+        for (int y = 0; y < side; ++y) {
+            for (int z = 0; z < side; ++z) {
+                glm::vec3 color((float) x / side, (float) y / side, (float) z / side);
+                vertices.push_back(Vertex{color - glm::vec3(0.5f), color});
+            }
+        }
+    }
+    return vertices;
+}
+
+/*!
+ * Acquires, draws with and releases engines: mostly one at a time, taken warm, and every tenth iteration
+ * more than the pool keeps, so that cold engines are created and the extra ones destroyed on release.
+ */
+static int churn_pool(Vertices &v, Indices &t, Indices &l, Indices &p, int iterations) {
+    Er_engine_pool pool(v, t, l, p, ER_WARM_ENGINES);
+    auto warm = [&pool] { return pool.stats().idle == ER_WARM_ENGINES; };
+    if (!wait_for(warm)) {
+        printf("The pool never got its %zu warm engines\n", ER_WARM_ENGINES);
+        return 1;
+    }
+    Er_churn_totals baseline = totals();
+    Er_churn_totals half = baseline;
+
+    for (int i = 0; i < iterations; ++i) {
+        if (i == iterations / 2) {
+            wait_for(warm);
+            half = totals();
+        }
+        size_t count = i % 10 == 0 ? ER_WARM_ENGINES + 2 : 1;
+        std::vector<std::shared_ptr<Er_vk_engine>> engines;
+        for (size_t n = 0; n < count; ++n) engines.push_back(pool.acquire());
+        for (auto &engine : engines) {
+            engine->set_transform({.rotate_y = (float) i});
+            engine->draw_frame();
+        }
+        for (auto &engine : engines) pool.release(std::move(engine));
+    }
+
+    Er_engine_pool_stats stats = pool.stats();
+    printf("%d iterations: %llu engines created, %llu reused, %llu cold, %llu destroyed\n", iterations,
+           (unsigned long long) stats.created, (unsigned long long) stats.reused, (unsigned long long) stats.cold,
+           (unsigned long long) stats.destroyed);
+    return check_baseline(baseline, half, warm);
+}
+
+/*! connects a client with the given query, waits for its first frame and disconnects it */
+static bool run_session(int port, const std::string &query) {
+    std::atomic<bool> framed{false};
+    ix::WebSocket client;
+    client.setUrl("ws://" + std::string(STREAM_ADDRESS) + ":" + std::to_string(port) + "/stream" + query);
+    client.disableAutomaticReconnection();
+    client.setOnMessageCallback([&framed](const ix::WebSocketMessagePtr &msg) {
+        if (msg->type == ix::WebSocketMessageType::Message) framed = true;
+    });
+    client.start();
+    bool ok = wait_for([&framed] { return framed.load(); });
+    client.stop();
+    return ok;
+}
+
+/*!
+ * Runs a server in this process and opens and closes sessions against it with various options, the way
+ * clients come and go, then waits for the sessions to end and their engines to return to the pool.
+ */
+static int churn_sessions(Vertices &v, Indices &t, Indices &l, Indices &p, int iterations) {
+    std::thread server(setup_server, v, t, l, p, CHURN_PORT, 0, ER_WARM_ENGINES);
+    server.detach();
+    const char *queries[] = {"", "?encoding=base64", "?codec=tiles", "?speculate=1", "?bands=1", "?depth=1"};
+    Er_metrics &metrics = Er_metrics::global();
+    auto idle = [&metrics] {
+        return metrics.sessions == 0 && metrics.engines_idle == (int64_t) ER_WARM_ENGINES
+               && metrics.engines == (int64_t) ER_WARM_ENGINES;
+    };
+
+    // the first session also creates what lives as long as the server: the instance, the frame cache
+    if (!run_session(CHURN_PORT, "") || !wait_for(idle)) {
+        printf("The server never sent a frame or never settled\n");
+        return 1;
+    }
+    Er_churn_totals baseline = totals();
+    Er_churn_totals half = baseline;
+
+    int failed = 0;
+    for (int i = 0; i < iterations; ++i) {
+        if (i == iterations / 2) {
+            wait_for(idle);
+            half = totals();
+        }
+        if (!run_session(CHURN_PORT, queries[i % (sizeof(queries) / sizeof(queries[0]))])) failed++;
+    }
+    printf("%d sessions, %d without a frame\n", iterations, failed);
+    // the process exits with the server still listening
+    return check_baseline(baseline, half, idle) != 0 || failed != 0 ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+    std::string mode = argc >= 2 ? argv[1] : "";
+    if ((mode != "pool" && mode != "session") || argc > 3) {
+        printf("Program usage:\n\t > eratosthene-churn pool|session [iterations]\n");
+        exit(-1);
+    }
+    Vertices v = point_cube(32);
+    std::vector<uint32_t> points(v.size());
+    for (uint32_t n = 0; n < points.size(); ++n) points[n] = n;
+    Indices empty;
+
+    if (mode == "pool") {
+        return churn_pool(v, empty, empty, points, argc == 3 ? atoi(argv[2]) : CHURN_POOL_ITERATIONS);
+    }
+    return churn_sessions(v, empty, empty, points, argc == 3 ? atoi(argv[2]) : CHURN_SESSION_ITERATIONS);
+}
@@ -0,0 +1,224 @@
+#include "server.h"
+#include "encoder.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb/stb_image.h>
+
+#ifdef ER_WITH_VPX
+#include <vpx/vpx_decoder.h>
+#include <vpx/vp8dx.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+/*
+ * Renders a scripted camera path over a scene and encodes every frame with each codec of the build, paced
+ * at FPS as a client moving the view continuously would be served, then prints what each codec sends and
+ * the luma PSNR of what the client displays against what was rendered. The VP8 bitrate can be set, so that
+ * the codecs are compared in bytes at the same PSNR.
+ * Run from the code directory, where the engine finds its shaders.
+ */
+
+/*! PSNR given to frames decoded without any error */
+const double LOSSLESS_PSNR = 99.;
+
+/*!
+ * Decodes the payloads of a codec as the web client does, drawing tiles over the previous frame, and keeps
+ * the luma plane of the last frame displayed.
+ */
+class Er_bench_decoder {
+public:
+    Er_bench_decoder(Er_codec codec, int width, int height);
+    ~Er_bench_decoder();
+    Er_bench_decoder(const Er_bench_decoder &) = delete;
+    Er_bench_decoder &operator=(const Er_bench_decoder &) = delete;
+
+    void decode(const std::string &payload);
+    const std::vector<uint8_t> &luma() const { return er_luma; }
+
+private:
+    Er_codec er_codec;
+    int er_width, er_height;
+    /*! the image displayed, for the image codecs */
+    std::vector<uint8_t> er_rgba;
+    std::vector<uint8_t> er_luma;
+    std::vector<uint8_t> er_chroma;
+#ifdef ER_WITH_VPX
+    vpx_codec_ctx_t er_vpx;
+#endif
+
+    void draw_jpeg(const char *data, size_t size, int x, int y);
+};
+
+Er_bench_decoder::Er_bench_decoder(Er_codec codec, int width, int height) :
+        er_codec(codec), er_width(width), er_height(height), er_rgba((size_t) width * height * 4),
+        er_luma((size_t) width * height), er_chroma((size_t) ((width + 1) / 2) * ((height + 1) / 2) * 2) {
+#ifdef ER_WITH_VPX
+    if (codec == ER_CODEC_VP8) {
+        TEST_ASSERT(vpx_codec_dec_init(&er_vpx, vpx_codec_vp8_dx(), nullptr, 0) == VPX_CODEC_OK,
+                    "error while initializing the vp8 decoder");
+    }
+#endif
+}
+
+Er_bench_decoder::~Er_bench_decoder() {
+#ifdef ER_WITH_VPX
+    if (er_codec == ER_CODEC_VP8) vpx_codec_destroy(&er_vpx);
+#endif
+}
+
+void Er_bench_decoder::draw_jpeg(const char *data, size_t size, int x, int y) {
+    int width, height, channels;
+    stbi_uc *pixels = stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(data), (int) size, &width, &height,
+                                            &channels, 4);
+    TEST_ASSERT(pixels != nullptr, "error while decoding a jpeg image");
+    for (int row = 0; row < height && y + row < er_height; ++row) {
+        memcpy(&er_rgba[((size_t) (y + row) * er_width + x) * 4], pixels + (size_t) row * width * 4,
+               (size_t) std::min(width, er_width - x) * 4);
+    }
+    stbi_image_free(pixels);
+}
+
+void Er_bench_decoder::decode(const std::string &payload) {
+#ifdef ER_WITH_VPX
+    if (er_codec == ER_CODEC_VP8) {
+        TEST_ASSERT(vpx_codec_decode(&er_vpx, reinterpret_cast<const uint8_t*>(payload.data()),
+                                     (unsigned int) payload.size(), nullptr, 0) == VPX_CODEC_OK,
+                    "error while decoding a vp8 frame");
+        vpx_codec_iter_t iter = nullptr;
+        while (vpx_image_t *image = vpx_codec_get_frame(&er_vpx, &iter)) {
+            for (int row = 0; row < er_height; ++row) {
+                memcpy(&er_luma[(size_t) row * er_width], image->planes[VPX_PLANE_Y] + row * image->stride[VPX_PLANE_Y],
+                       er_width);
+            }
+        }
+        return;
+    }
+#endif
+    if (er_codec == ER_CODEC_TILES) {
+        uint16_t count;
+        memcpy(&count, payload.data(), sizeof(count));
+        size_t offset = sizeof(count);
+        for (uint16_t n = 0; n < count; ++n) {
+            Er_tile_entry entry;
+            memcpy(&entry, payload.data() + offset, sizeof(entry));
+            offset += sizeof(entry);
+            draw_jpeg(payload.data() + offset, entry.size, entry.x, entry.y);
+            offset += entry.size;
+        }
+    } else {
+        draw_jpeg(payload.data(), payload.size(), 0, 0);
+    }
+    uint8_t *u = er_chroma.data(), *v = u + er_chroma.size() / 2;
+    rgba_to_i420(er_rgba.data(), er_width, er_height, er_luma.data(), er_width, u, (er_width + 1) / 2, v,
+                 (er_width + 1) / 2);
+}
+
+static double psnr(const std::vector<uint8_t> &reference, const std::vector<uint8_t> &decoded) {
+    uint64_t squared_error = 0;
+    for (size_t i = 0; i < reference.size(); ++i) {
+        int error = (int) reference[i] - (int) decoded[i];
+        squared_error += error * error;
+    }
+    if (squared_error == 0) return LOSSLESS_PSNR;
+    return 10. * std::log10(255. * 255. * reference.size() / squared_error);
+}
+
+struct Er_codec_result {
+    const char *name;
+    std::unique_ptr<Er_encoder> encoder;
+    std::unique_ptr<Er_bench_decoder> decoder;
+    std::string payload;
+    uint64_t bytes = 0;
+    uint64_t max_bytes = 0;
+    uint64_t encode_us = 0;
+    uint64_t key_frames = 0;
+    double psnr = 0.;
+    double min_psnr = LOSSLESS_PSNR;
+};
+
+/*! orbits the scene, then zooms in and out while panning: every frame differs from the previous one */
+static Er_transform camera_path(int frame, int frames) {
+    Er_transform transform;
+    float t = (float) frame / (float) frames;
+    transform.rotate_y = 180.f * std::min(t * 2.f, 1.f);
+    if (t > 0.5f) {
+        float s = (t - 0.5f) * 2.f;
+        transform.zoom = 5.f * (s < 0.5f ? s : 1.f - s);
+        transform.translate_camera_x = 0.5f * s;
+    }
+    return transform;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2 || argc > 4) {
+        printf("Program usage:\n\t > eratosthene-codec-bench \"path/to/plyfile\" [frames] [vp8 kbit/s]\n");
+        exit(-1);
+    }
+    int frames = argc >= 3 ? std::max(atoi(argv[2]), 1) : 600;
+    auto v = load_ply_data(argv[1]);
+    std::vector<uint32_t> points(v.size());
+    std::generate(points.begin(), points.end(), [n = 0] () mutable { return n++; });
+    Indices empty;
+    Er_vk_engine engine(v, empty, empty, points);
+    int width = engine.frame_width(), height = engine.frame_height();
+
+    std::vector<Er_codec_result> results;
+    results.push_back({"jpeg", create_encoder(ER_CODEC_JPEG, width, height)});
+    results.push_back({"tiles", create_encoder(ER_CODEC_TILES, width, height)});
+#ifdef ER_WITH_VPX
+    results.push_back({"vp8", argc == 4 ? std::make_unique<Er_vp8_encoder>(width, height, std::max(atoi(argv[3]), 1))
+                                        : create_encoder(ER_CODEC_VP8, width, height)});
+#endif
+    for (auto &result : results) {
+        result.decoder = std::make_unique<Er_bench_decoder>(result.encoder->codec(), width, height);
+    }
+    // luma of the rendered frames, as the decoders compute it
+    std::vector<uint8_t> reference((size_t) width * height);
+    std::vector<uint8_t> chroma((size_t) ((width + 1) / 2) * ((height + 1) / 2) * 2);
+
+    // the vp8 rate control budgets frames by their timestamps, which must be those of a live stream
+    auto period = std::chrono::microseconds((int64_t) (1e6 / FPS));
+    auto next = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < frames; frame++) {
+        std::this_thread::sleep_until(next);
+        next += period;
+        engine.set_transform(camera_path(frame, frames));
+        const char *rgba = engine.draw_frame();
+        rgba_to_i420(reinterpret_cast<const uint8_t*>(rgba), width, height, reference.data(), width, chroma.data(),
+                     (width + 1) / 2, chroma.data() + chroma.size() / 2, (width + 1) / 2);
+        for (auto &result : results) {
+            result.payload.clear();
+            uint64_t start_us = monotonic_us();
+            uint8_t flags = result.encoder->encode(rgba, width, height, result.payload);
+            result.encode_us += monotonic_us() - start_us;
+            result.bytes += result.payload.size();
+            result.max_bytes = std::max<uint64_t>(result.max_bytes, result.payload.size());
+            if (flags & ER_FRAME_FLAG_KEY) result.key_frames++;
+            // decoded outside of the timed encode
+            result.decoder->decode(result.payload);
+            double frame_psnr = psnr(reference, result.decoder->luma());
+            result.psnr += frame_psnr;
+            result.min_psnr = std::min(result.min_psnr, frame_psnr);
+        }
+    }
+
+    double seconds = frames / FPS;
+    printf("%d frames of %dx%d at %.0f fps\n", frames, width, height, FPS);
+    printf("%-6s %14s %14s %12s %12s %10s %10s %10s\n", "codec", "bytes/frame", "max bytes", "kbit/s", "encode ms",
+           "key", "psnr dB", "min dB");
+    for (auto &result : results) {
+        printf("%-6s %14.0f %14llu %12.0f %12.2f %10llu %10.2f %10.2f\n", result.name, (double) result.bytes / frames,
+               (unsigned long long) result.max_bytes, result.bytes * 8. / 1000. / seconds,
+               result.encode_us / 1000. / frames, (unsigned long long) result.key_frames, result.psnr / frames,
+               result.min_psnr);
+    }
+    return 0;
+}
@@ -1,8 +1,48 @@
+let inflate_supported = function() {
+    try {
+        new DecompressionStream("deflate-raw");
+        return true;
+    } catch (error) {
+        return false;
+    }
+}
+
 let connect = function() {
     document.getElementById("connectButton").disabled = true;
     let port = document.getElementById("portInput").value;
-    let address = "ws://127.0.0.1:" + port.toString() + "/stream";
+    let base64 = document.getElementById("base64Input").checked;
+    let codec = document.getElementById("codecInput").value;
+    if (codec === "vp8" && !window.VideoDecoder) {
+        console.log("WebCodecs is not supported by this browser, falling back to jpeg");
+        codec = "jpeg";
+    }
+    let address = "ws://127.0.0.1:" + port.toString() + "/stream" + (base64 ? "?encoding=base64" : "?codec=" + codec);
+    if (document.getElementById("speculateInput").checked) {
+        address += "&speculate=1";
+    }
+    // depth maps let the client reproject the last frame while waiting for the next one
+    let depth = document.getElementById("depthInput").checked && !base64;
+    if (depth) {
+        address += "&depth=1";
+    }
+    // jpeg frames encoded in bands while the server reads them back, received as full-width tiles
+    if (codec === "jpeg" && document.getElementById("bandsInput").checked) {
+        address += "&bands=1";
+    }
+    // reduced frames while moving, then a full detail (or lossless) frame once the camera settles
+    address += "&refine=" + document.getElementById("refineInput").value;
+    // compressed payloads are raw deflate streams, which DecompressionStream inflates since Chrome 103,
+    // Firefox 113 and Safari 16.4: older browsers ask the server not to compress anything
+    if (!inflate_supported()) {
+        address += "&deflate=0";
+    }
+    // shared views are rendered once for their controller and all their spectators
+    let view = document.getElementById("viewInput").value;
+    if (view !== "") {
+        address += (document.getElementById("spectatorInput").checked ? "&watch=" : "&view=") + encodeURIComponent(view);
+    }
     let socket = new WebSocket(address);
+    socket.binaryType = "arraybuffer";
     // if (socket.CLOSED) {
     //     document.getElementById("connectButton").disabled = false;
     // }
@@ -15,7 +55,6 @@ let connect = function() {
 
     socket.onopen = function(event) {
         console.log(event);
-        var s = this;
         console.log("Connection opened");
 
         this.onclose = function(event) {
@@ -23,10 +62,11 @@ let connect = function() {
         }
 
         this.onmessage = function(event) {
-            console.log("Message received");
-            // @FUTURE probably retrieve the base64 image alongside other information (FPS, latency, ...) inside a json
-            update_image(event.data);
-            // this.close();
+            if (typeof event.data === "string") {
+                update_image_base64(event.data);
+            } else {
+                update_image(event.data, performance.now());
+            }
         }
         document.addEventListener("keydown", function onPress(event) {
             let transform = {
@@ -47,10 +87,14 @@ let connect = function() {
                     transform.zoom = +factor; break;
                 case "ArrowDown":
                     transform.zoom = -factor; break;
+                case "Home":
+                    // absolute pose: back to the initial camera
+                    send_input(transform, INPUT_POSE);
+                    reproject();
+                    return;
             }
-            console.log("Sending object :");
-            console.log(transform);
-            s.send(JSON.stringify(transform));
+            send_input(transform, INPUT_DELTA);
+            reproject();
         });
     }
 
@@ -58,9 +102,264 @@ let connect = function() {
         document.getElementById("connectButton").disabled = false;
     }
 
-    let update_image = function(image_data) {
-        let image_elem = document.getElementById("frame");
-        image_elem.src = "data:image/jpg;base64," + image_data;
+    let canvas = document.getElementById("frame");
+    let context = canvas.getContext("2d");
+    let last_frame_id = 0;
+    let CODEC_JPEG = 0, CODEC_VP8 = 1, CODEC_TILES = 2, CODEC_DEPTH = 3, CODEC_PNG = 4;
+    let FLAG_KEY = 1, FLAG_DEFLATE = 2;
+    let decoder = null;
+    let tiles_drawn = Promise.resolve();
+    // frames handed to the video decoder, by chunk timestamp, until they are displayed
+    let pending_video = new Map();
+    // frames are handed to the decoders in order, even when some payloads need to be inflated first
+    let payloads_ready = Promise.resolve();
+
+    // tells the server a frame was displayed, with the time it spent on the client so that
+    // the server can tell the network round trip apart and adapt the stream to the bandwidth;
+    // binary frames only, base64 text frames carry no frame id to acknowledge
+    let acknowledge = function(header, received) {
+        measure_input_latency(header.input_sequence);
+        if (reprojection !== null) {
+            reprojection.frame_displayed(header.frame_id);
+            // the server caught up with every input, its frame replaces the reprojection
+            if (header.input_sequence >= input_sequence) overlay.style.visibility = "hidden";
+        }
+        if (socket.readyState !== WebSocket.OPEN) return;
+        let frame_id = header.frame_id;
+        let hold = performance.now() - received;
+        let view = new DataView(new ArrayBuffer(ACK_INPUT_SIZE));
+        write_input_header(view, INPUT_ACK, ACK_INPUT_SIZE);
+        view.setUint32(4, frame_id, true);
+        view.setUint32(8, Math.round(hold * 1000), true);
+        socket.send(view.buffer);
+    }
+
+    // client messages: binary (see Er_input_header in protocol.h), json for legacy base64 sessions
+    let PROTOCOL_VERSION = 1;
+    let INPUT_DELTA = 0, INPUT_POSE = 1, INPUT_ACK = 2;
+    let CAMERA_INPUT_SIZE = 44, ACK_INPUT_SIZE = 12;
+    let input_sequence = 0;
+    // send time of the inputs not displayed yet, by sequence number
+    let inputs_sent = new Map();
+    let latency_total = 0, latency_count = 0;
+
+    // a frame includes every input up to its input sequence: their latency is input to display
+    let measure_input_latency = function(sequence) {
+        let now = performance.now();
+        inputs_sent.forEach(function(sent, input) {
+            if (input > sequence) return;
+            latency_total += now - sent;
+            latency_count++;
+            inputs_sent.delete(input);
+        });
+        if (latency_count > 0) {
+            document.getElementById("latencyOutput").textContent =
+                "input to display: " + (latency_total / latency_count).toFixed(1) + " ms";
+        }
+    }
+
+    let write_input_header = function(view, type, size) {
+        view.setUint8(0, PROTOCOL_VERSION);
+        view.setUint8(1, type);
+        view.setUint8(2, size);
+        view.setUint8(3, 0);
+    }
+
+    let send_input = function(transform, type) {
+        let sequence = ++input_sequence;
+        // only frames with a header tell which inputs they include
+        if (!base64) inputs_sent.set(sequence, performance.now());
+        if (reprojection !== null) camera_inputs.push({sequence : sequence, type : type, transform : transform});
+        // microseconds since the unix epoch, as the frame timestamps
+        let timestamp = Math.round((performance.timeOrigin + performance.now()) * 1000);
+        if (base64) {
+            socket.send(JSON.stringify(Object.assign({type : type === INPUT_POSE ? "pose" : "delta", seq : sequence, timestamp : timestamp}, transform)));
+            return;
+        }
+        let view = new DataView(new ArrayBuffer(CAMERA_INPUT_SIZE));
+        write_input_header(view, type, CAMERA_INPUT_SIZE);
+        view.setUint32(4, sequence, true);
+        view.setBigUint64(8, BigInt(timestamp), true);
+        [transform.rotate_x, transform.rotate_y, transform.rotate_z,
+         transform.translate_camera_x, transform.translate_camera_y, transform.translate_camera_z,
+         transform.zoom].forEach(function(value, i) {
+            view.setFloat32(16 + 4 * i, value, true);
+        });
+        socket.send(view.buffer);
+    }
+
+    let overlay = document.getElementById("reprojection");
+    let reprojection = depth ? create_reprojection(overlay, canvas) : null;
+    // inputs sent after the last depth map, they move the camera the map was rendered from
+    let camera_inputs = [];
+
+    // predicts the camera from the pose of the last depth map and the inputs the server did not render yet
+    let reproject = function() {
+        if (reprojection === null) return;
+        let last = reprojection.last_depth();
+        if (last === null) return;
+        camera_inputs = camera_inputs.filter(function(input) { return input.sequence > last.input_sequence; });
+        let pose = Object.assign({}, last.pose);
+        camera_inputs.forEach(function(input) {
+            if (input.type === INPUT_POSE) {
+                pose = Object.assign({}, input.transform);
+                return;
+            }
+            Object.keys(pose).forEach(function(key) { pose[key] += input.transform[key]; });
+        });
+        if (reprojection.draw(pose)) overlay.style.visibility = "visible";
+    }
+
+    let draw_image = function(frame_id, image) {
+        // decoding is asynchronous, never draw a frame on top of a newer one
+        if (frame_id < last_frame_id) return;
+        last_frame_id = frame_id;
+        context.drawImage(image, 0, 0, canvas.width, canvas.height);
+    }
+
+    // binary frames: a fixed header (see Er_frame_header in protocol.h) followed by the encoded image
+    let update_image = function(buffer, received) {
+        let view = new DataView(buffer);
+        let header = {
+            version : view.getUint8(0),
+            codec : view.getUint8(1),
+            size : view.getUint8(2),
+            flags : view.getUint8(3),
+            frame_id : view.getUint32(4, true),
+            timestamp : Number(view.getBigUint64(8, true)),
+            width : view.getUint16(16, true),
+            height : view.getUint16(18, true),
+            input_sequence : view.getUint8(2) >= 24 ? view.getUint32(20, true) : 0,
+        };
+        let payload = new Uint8Array(buffer, header.size);
+        payloads_ready = payloads_ready.then(function() {
+            return (header.flags & FLAG_DEFLATE) ? inflate(payload) : payload;
+        }).then(function(payload) {
+            decode_payload(header, payload, received);
+        }).catch(function(error) {
+            console.error(error);
+        });
+    }
+
+    // payloads flagged FLAG_DEFLATE are standalone raw deflate streams
+    let inflate = function(payload) {
+        let stream = new Blob([payload]).stream().pipeThrough(new DecompressionStream("deflate-raw"));
+        return new Response(stream).arrayBuffer().then(function(buffer) { return new Uint8Array(buffer); });
+    }
+
+    let decode_payload = function(header, payload, received) {
+        if (header.codec === CODEC_DEPTH) {
+            if (reprojection === null) return;
+            reprojection.update_depth(header, payload);
+            // still moving: the newer depth map makes a better reprojection
+            if (overlay.style.visibility === "visible") reproject();
+            return;
+        }
+        if (header.codec === CODEC_VP8) {
+            decode_video(header, payload, received);
+            return;
+        }
+        if (header.codec === CODEC_TILES) {
+            update_tiles(header, payload, received);
+            return;
+        }
+        let blob = new Blob([payload], {type: header.codec === CODEC_PNG ? "image/png" : "image/jpeg"});
+        if (window.createImageBitmap) {
+            createImageBitmap(blob).then(function(bitmap) {
+                draw_image(header.frame_id, bitmap);
+                bitmap.close();
+                acknowledge(header, received);
+            });
+        } else {
+            let url = URL.createObjectURL(blob);
+            let image = new Image();
+            image.onload = function() {
+                draw_image(header.frame_id, image);
+                URL.revokeObjectURL(url);
+                acknowledge(header, received);
+            }
+            image.src = url;
+        }
+    }
+
+    // tile frames: rectangles (see Er_tile_entry in protocol.h) drawn over the previous frame
+    let update_tiles = function(header, payload, received) {
+        let view = new DataView(payload.buffer, payload.byteOffset, payload.byteLength);
+        let offset = 0;
+        let count = view.getUint16(offset, true);
+        offset += 2;
+        let tiles = [];
+        for (let i = 0; i < count; ++i) {
+            let tile = {
+                x : view.getUint16(offset, true),
+                y : view.getUint16(offset + 2, true),
+                width : view.getUint16(offset + 4, true),
+                height : view.getUint16(offset + 6, true),
+            };
+            let size = view.getUint32(offset + 8, true);
+            offset += 12;
+            let blob = new Blob([payload.subarray(offset, offset + size)], {type: "image/jpeg"});
+            tile.bitmap = createImageBitmap(blob);
+            tiles.push(tile);
+            offset += size;
+        }
+        // tiles are deltas: frames must be composed in order, even if a later one decodes faster
+        let decoded = Promise.all(tiles.map(function(tile) { return tile.bitmap; }));
+        tiles_drawn = tiles_drawn.then(function() { return decoded; }).then(function(bitmaps) {
+            // key frames cover the whole image, a newer jpeg frame may already be displayed
+            if ((header.flags & FLAG_KEY) && header.frame_id < last_frame_id) {
+                bitmaps.forEach(function(bitmap) { bitmap.close(); });
+                acknowledge(header, received);
+                return;
+            }
+            let scale_x = canvas.width / header.width, scale_y = canvas.height / header.height;
+            bitmaps.forEach(function(bitmap, i) {
+                let tile = tiles[i];
+                context.drawImage(bitmap, tile.x * scale_x, tile.y * scale_y, tile.width * scale_x, tile.height * scale_y);
+                bitmap.close();
+            });
+            last_frame_id = header.frame_id;
+            acknowledge(header, received);
+        }).catch(function(error) {
+            console.error(error);
+        });
+    }
+
+    // video frames: decoded in order by WebCodecs, the server starts the stream with a key frame
+    let decode_video = function(header, payload, received) {
+        if (decoder === null) {
+            decoder = new VideoDecoder({
+                output : function(frame) {
+                    context.drawImage(frame, 0, 0, canvas.width, canvas.height);
+                    let pending = pending_video.get(frame.timestamp);
+                    if (pending) {
+                        pending_video.delete(frame.timestamp);
+                        acknowledge(pending.header, pending.received);
+                    }
+                    frame.close();
+                },
+                error : function(error) {
+                    console.error(error);
+                },
+            });
+            decoder.configure({codec : "vp8", codedWidth : header.width, codedHeight : header.height, optimizeForLatency : true});
+        }
+        pending_video.set(header.timestamp, {header : header, received : received});
+        decoder.decode(new EncodedVideoChunk({
+            type : (header.flags & FLAG_KEY) ? "key" : "delta",
+            timestamp : header.timestamp,
+            data : payload,
+        }));
+    }
+
+    // legacy text frames: the whole jpeg encoded in base64
+    let update_image_base64 = function(image_data) {
+        let image = new Image();
+        let frame_id = last_frame_id + 1;
+        image.onload = function() {
+            draw_image(frame_id, image);
+        }
+        image.src = "data:image/jpg;base64," + image_data;
     }
 }
 
@@ -0,0 +1,230 @@
+// Client-side reprojection: while the camera moves, the last frame is drawn from the predicted camera
+// with its depth map (see Er_depth_entry in protocol.h) until the server frame for that camera arrives.
+let create_reprojection = function(overlay, frame) {
+    let gl = overlay.getContext("webgl", {premultipliedAlpha : false});
+    if (!gl) {
+        console.log("WebGL is not supported by this browser, frames are not reprojected");
+        return null;
+    }
+
+    /* -------- 4x4 column-major matrices, as glm and the vertex shader -------- */
+
+    let multiply = function(a, b) {
+        let out = new Float32Array(16);
+        for (let column = 0; column < 4; ++column) {
+            for (let row = 0; row < 4; ++row) {
+                let sum = 0;
+                for (let k = 0; k < 4; ++k) sum += a[k * 4 + row] * b[column * 4 + k];
+                out[column * 4 + row] = sum;
+            }
+        }
+        return out;
+    }
+
+    let invert = function(m) {
+        let inv = new Float32Array(16);
+        inv[0] = m[5] * m[10] * m[15] - m[5] * m[11] * m[14] - m[9] * m[6] * m[15] + m[9] * m[7] * m[14] + m[13] * m[6] * m[11] - m[13] * m[7] * m[10];
+        inv[4] = -m[4] * m[10] * m[15] + m[4] * m[11] * m[14] + m[8] * m[6] * m[15] - m[8] * m[7] * m[14] - m[12] * m[6] * m[11] + m[12] * m[7] * m[10];
+        inv[8] = m[4] * m[9] * m[15] - m[4] * m[11] * m[13] - m[8] * m[5] * m[15] + m[8] * m[7] * m[13] + m[12] * m[5] * m[11] - m[12] * m[7] * m[9];
+        inv[12] = -m[4] * m[9] * m[14] + m[4] * m[10] * m[13] + m[8] * m[5] * m[14] - m[8] * m[6] * m[13] - m[12] * m[5] * m[10] + m[12] * m[6] * m[9];
+        inv[1] = -m[1] * m[10] * m[15] + m[1] * m[11] * m[14] + m[9] * m[2] * m[15] - m[9] * m[3] * m[14] - m[13] * m[2] * m[11] + m[13] * m[3] * m[10];
+        inv[5] = m[0] * m[10] * m[15] - m[0] * m[11] * m[14] - m[8] * m[2] * m[15] + m[8] * m[3] * m[14] + m[12] * m[2] * m[11] - m[12] * m[3] * m[10];
+        inv[9] = -m[0] * m[9] * m[15] + m[0] * m[11] * m[13] + m[8] * m[1] * m[15] - m[8] * m[3] * m[13] - m[12] * m[1] * m[11] + m[12] * m[3] * m[9];
+        inv[13] = m[0] * m[9] * m[14] - m[0] * m[10] * m[13] - m[8] * m[1] * m[14] + m[8] * m[2] * m[13] + m[12] * m[1] * m[10] - m[12] * m[2] * m[9];
+        inv[2] = m[1] * m[6] * m[15] - m[1] * m[7] * m[14] - m[5] * m[2] * m[15] + m[5] * m[3] * m[14] + m[13] * m[2] * m[7] - m[13] * m[3] * m[6];
+        inv[6] = -m[0] * m[6] * m[15] + m[0] * m[7] * m[14] + m[4] * m[2] * m[15] - m[4] * m[3] * m[14] - m[12] * m[2] * m[7] + m[12] * m[3] * m[6];
+        inv[10] = m[0] * m[5] * m[15] - m[0] * m[7] * m[13] - m[4] * m[1] * m[15] + m[4] * m[3] * m[13] + m[12] * m[1] * m[7] - m[12] * m[3] * m[5];
+        inv[14] = -m[0] * m[5] * m[14] + m[0] * m[6] * m[13] + m[4] * m[1] * m[14] - m[4] * m[2] * m[13] - m[12] * m[1] * m[6] + m[12] * m[2] * m[5];
+        inv[3] = -m[1] * m[6] * m[11] + m[1] * m[7] * m[10] + m[5] * m[2] * m[11] - m[5] * m[3] * m[10] - m[9] * m[2] * m[7] + m[9] * m[3] * m[6];
+        inv[7] = m[0] * m[6] * m[11] - m[0] * m[7] * m[10] - m[4] * m[2] * m[11] + m[4] * m[3] * m[10] + m[8] * m[2] * m[7] - m[8] * m[3] * m[6];
+        inv[11] = -m[0] * m[5] * m[11] + m[0] * m[7] * m[9] + m[4] * m[1] * m[11] - m[4] * m[3] * m[9] - m[8] * m[1] * m[7] + m[8] * m[3] * m[5];
+        inv[15] = m[0] * m[5] * m[10] - m[0] * m[6] * m[9] - m[4] * m[1] * m[10] + m[4] * m[2] * m[9] + m[8] * m[1] * m[6] - m[8] * m[2] * m[5];
+        let det = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
+        for (let i = 0; i < 16; ++i) inv[i] /= det;
+        return inv;
+    }
+
+    let rotation = function(degrees, x, y, z) {
+        let c = Math.cos(degrees * Math.PI / 180), s = Math.sin(degrees * Math.PI / 180), t = 1 - c;
+        return new Float32Array([
+            t * x * x + c, t * x * y + s * z, t * x * z - s * y, 0,
+            t * x * y - s * z, t * y * y + c, t * y * z + s * x, 0,
+            t * x * z + s * y, t * y * z - s * x, t * z * z + c, 0,
+            0, 0, 0, 1,
+        ]);
+    }
+
+    let normalize = function(v) {
+        let length = Math.hypot(v[0], v[1], v[2]);
+        return [v[0] / length, v[1] / length, v[2] / length];
+    }
+
+    let cross = function(a, b) {
+        return [a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]];
+    }
+
+    let dot = function(a, b) {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    let look_at = function(eye, center, up) {
+        let f = normalize([center[0] - eye[0], center[1] - eye[1], center[2] - eye[2]]);
+        let s = normalize(cross(f, up));
+        let u = cross(s, f);
+        return new Float32Array([
+            s[0], u[0], -f[0], 0,
+            s[1], u[1], -f[1], 0,
+            s[2], u[2], -f[2], 0,
+            -dot(s, eye), -dot(u, eye), dot(f, eye), 1,
+        ]);
+    }
+
+    // same camera as Er_vk_engine::update_uniform_buffers, the projection never changes
+    let model_view = function(pose) {
+        let eye = [-2, -2, 2.5], center = [0, 0, 1];
+        let direction = normalize([center[0] - eye[0], center[1] - eye[1], center[2] - eye[2]]);
+        eye = eye.map(function(value, i) { return value + direction[i] * pose.zoom / 10; });
+        let model = multiply(multiply(rotation(pose.rotate_x, 1, 0, 0), rotation(pose.rotate_y, 0, 1, 0)),
+                             rotation(180 + pose.rotate_z, 0, 0, 1));
+        return multiply(look_at(eye, center, [0, 0, 1]), model);
+    }
+
+    /* -------- WebGL points, one per depth sample, textured with the frame -------- */
+
+    let compile = function(type, source) {
+        let shader = gl.createShader(type);
+        gl.shaderSource(shader, source);
+        gl.compileShader(shader);
+        if (!gl.getShaderParameter(shader, gl.COMPILE_STATUS)) console.error(gl.getShaderInfoLog(shader));
+        return shader;
+    }
+
+    let program = gl.createProgram();
+    gl.attachShader(program, compile(gl.VERTEX_SHADER,
+        "attribute vec3 position;\n" +
+        "attribute vec2 uv;\n" +
+        "uniform mat4 transform;\n" +
+        "uniform float point_size;\n" +
+        "varying vec2 frame_uv;\n" +
+        "void main() {\n" +
+        "    gl_Position = transform * vec4(position, 1.0);\n" +
+        // vulkan clip space has y pointing down
+        "    gl_Position.y = -gl_Position.y;\n" +
+        "    gl_PointSize = point_size;\n" +
+        "    frame_uv = uv;\n" +
+        "}\n"));
+    gl.attachShader(program, compile(gl.FRAGMENT_SHADER,
+        "precision mediump float;\n" +
+        "uniform sampler2D frame;\n" +
+        "varying vec2 frame_uv;\n" +
+        "void main() {\n" +
+        "    gl_FragColor = vec4(texture2D(frame, frame_uv).rgb, 1.0);\n" +
+        "}\n"));
+    gl.linkProgram(program);
+    gl.useProgram(program);
+    let position_location = gl.getAttribLocation(program, "position");
+    let uv_location = gl.getAttribLocation(program, "uv");
+    let transform_location = gl.getUniformLocation(program, "transform");
+    let point_size_location = gl.getUniformLocation(program, "point_size");
+
+    let positions = gl.createBuffer();
+    let uvs = gl.createBuffer();
+    let texture = gl.createTexture();
+    gl.bindTexture(gl.TEXTURE_2D, texture);
+    gl.texParameteri(gl.TEXTURE_2D, gl.TEXTURE_MIN_FILTER, gl.LINEAR);
+    gl.texParameteri(gl.TEXTURE_2D, gl.TEXTURE_MAG_FILTER, gl.LINEAR);
+    gl.texParameteri(gl.TEXTURE_2D, gl.TEXTURE_WRAP_S, gl.CLAMP_TO_EDGE);
+    gl.texParameteri(gl.TEXTURE_2D, gl.TEXTURE_WRAP_T, gl.CLAMP_TO_EDGE);
+    gl.enable(gl.DEPTH_TEST);
+
+    // last depth map: its frame, pose and projection, and how many points it unprojected to
+    let depth = null;
+    let texture_frame_id = 0;
+    let displayed_frame_id = 0;
+
+    // ER_CODEC_DEPTH payload: the entry then the high and low byte planes of the 16 bits depths
+    let update_depth = function(header, payload) {
+        let view = new DataView(payload.buffer, payload.byteOffset, payload.byteLength);
+        let width = view.getUint16(0, true), height = view.getUint16(2, true);
+        let floats = function(offset, count) {
+            let values = new Float32Array(count);
+            for (let i = 0; i < count; ++i) values[i] = view.getFloat32(offset + 4 * i, true);
+            return values;
+        }
+        let pose = floats(4, 7);
+        let model = floats(32, 16), camera = floats(96, 16), projection = floats(160, 16);
+        let high = payload.subarray(224, 224 + width * height);
+        let low = payload.subarray(224 + width * height, 224 + 2 * width * height);
+
+        // points are unprojected once to model space, only the model-view matrix changes while moving
+        let unproject = invert(multiply(projection, multiply(camera, model)));
+        let position_data = new Float32Array(width * height * 3);
+        let uv_data = new Float32Array(width * height * 2);
+        let count = 0;
+        for (let y = 0; y < height; ++y) {
+            for (let x = 0; x < width; ++x) {
+                let i = y * width + x;
+                let d = (high[i] << 8) | low[i];
+                // background
+                if (d === 65535) continue;
+                let ndc = [(x + 0.5) / width * 2 - 1, (y + 0.5) / height * 2 - 1, d / 65535, 1];
+                let w = 0;
+                for (let k = 0; k < 4; ++k) w += unproject[k * 4 + 3] * ndc[k];
+                for (let row = 0; row < 3; ++row) {
+                    let value = 0;
+                    for (let k = 0; k < 4; ++k) value += unproject[k * 4 + row] * ndc[k];
+                    position_data[count * 3 + row] = value / w;
+                }
+                uv_data[count * 2] = (x + 0.5) / width;
+                uv_data[count * 2 + 1] = (y + 0.5) / height;
+                count++;
+            }
+        }
+        gl.bindBuffer(gl.ARRAY_BUFFER, positions);
+        gl.bufferData(gl.ARRAY_BUFFER, position_data.subarray(0, count * 3), gl.DYNAMIC_DRAW);
+        gl.bindBuffer(gl.ARRAY_BUFFER, uvs);
+        gl.bufferData(gl.ARRAY_BUFFER, uv_data.subarray(0, count * 2), gl.DYNAMIC_DRAW);
+        depth = {
+            frame_id : header.frame_id,
+            input_sequence : header.input_sequence,
+            pose : {rotate_x : pose[0], rotate_y : pose[1], rotate_z : pose[2], translate_camera_x : pose[3],
+                    translate_camera_y : pose[4], translate_camera_z : pose[5], zoom : pose[6]},
+            projection : projection,
+            factor : frame.width / width,
+            count : count,
+        };
+    }
+
+    // draws the last frame seen from pose, returns false when there is nothing to reproject yet
+    let draw = function(pose) {
+        // the color frame of the depth map must have been displayed to be used as texture
+        if (depth === null || depth.frame_id > displayed_frame_id) return false;
+        if (texture_frame_id !== depth.frame_id) {
+            gl.bindTexture(gl.TEXTURE_2D, texture);
+            gl.texImage2D(gl.TEXTURE_2D, 0, gl.RGBA, gl.RGBA, gl.UNSIGNED_BYTE, frame);
+            texture_frame_id = depth.frame_id;
+        }
+        gl.viewport(0, 0, overlay.width, overlay.height);
+        gl.clearColor(0, 0, 0, 1);
+        gl.clear(gl.COLOR_BUFFER_BIT | gl.DEPTH_BUFFER_BIT);
+        gl.uniformMatrix4fv(transform_location, false, multiply(depth.projection, model_view(pose)));
+        // samples spread apart when zooming in, slightly larger points cover the gaps
+        gl.uniform1f(point_size_location, depth.factor * overlay.width / frame.width + 1);
+        gl.bindBuffer(gl.ARRAY_BUFFER, positions);
+        gl.enableVertexAttribArray(position_location);
+        gl.vertexAttribPointer(position_location, 3, gl.FLOAT, false, 0, 0);
+        gl.bindBuffer(gl.ARRAY_BUFFER, uvs);
+        gl.enableVertexAttribArray(uv_location);
+        gl.vertexAttribPointer(uv_location, 2, gl.FLOAT, false, 0, 0);
+        gl.drawArrays(gl.POINTS, 0, depth.count);
+        return true;
+    }
+
+    return {
+        update_depth : update_depth,
+        draw : draw,
+        // pose and input sequence of the last depth map, inputs after it are to be applied on top
+        last_depth : function() { return depth; },
+        frame_displayed : function(frame_id) { displayed_frame_id = Math.max(displayed_frame_id, frame_id); },
+    };
+}